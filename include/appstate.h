@@ -5,17 +5,33 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// per frame counters of the work the renderer managed to skip
+typedef struct {
+  int culled_draws; // draws rejected by the frustum before any geometry work
+  int culled_meshlets; // meshlets rejected by their bounds or normal cone
+  int occluded_draws;  // draws hidden behind the occluders
+} render_stats_t;
+
 typedef struct {
   SDL_Window *window;
   SDL_Renderer *renderer;
 
+  // the frame that is drawn goes into color_buffer, which is one of the two
+  // color_buffers so the one before it can be shown meanwhile
+  uint32_t *color_buffers[2];
   uint32_t *color_buffer;
   float *z_buffer;
+  // farthest(smallest 1/w) depth in every block/tile of the z_buffer
+  float *hi_z_blocks;
+  float *hi_z_tiles;
   SDL_Texture *color_buffer_texture;
 
   bool is_running;
   float previous_frame_time;
   float delta_time;
+
+  // of the last frame whose tiles are drawn
+  render_stats_t stats;
 } app_state_t;
 
 typedef struct {
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "triangle.h"
+#include <stdint.h>
+
+// triangles an arena starts with when what it will hold is not known yet
+#define TRIANGLE_ARENA_INITIAL_CAPACITY 4096
+
+// Linear arena holding the post-clip triangles of every draw in a frame.
+// It is reset(not freed) at the start of each frame and grows geometrically
+// when a frame emits more triangles than it can hold, so after the first few
+// frames there are no more allocations
+typedef struct {
+  triangle_t *triangles;
+  int count;
+  int capacity;
+  // scratch space of the depth sort, grown the same way as the arena
+  triangle_t *sort_triangles;
+  uint32_t *sort_keys;
+  int sort_capacity;
+} triangle_arena_t;
+
+// a range of triangles inside an arena that share the same material
+typedef struct {
+  material_t *material;
+  // draws can come from different arenas[one per thread]
+  triangle_arena_t *triangle_arena;
+  int first_triangle;
+  int triangle_count;
+  // View Space depth the draws are sorted by
+  float depth;
+  // position of the draw in the list, keeps the sort stable
+  int order;
+} draw_call_t;
+
+typedef struct {
+  draw_call_t *draw_calls;
+  int count;
+  int capacity;
+} draw_list_t;
+
+void triangle_arena_init(triangle_arena_t *arena, int initial_capacity);
+void triangle_arena_reserve(triangle_arena_t *arena, int extra_triangles);
+triangle_t *triangle_arena_push(triangle_arena_t *arena);
+void triangle_arena_reset(triangle_arena_t *arena);
+void triangle_arena_free(triangle_arena_t *arena);
+// stable front to back sort of a range of triangles by their nearest depth
+void triangle_arena_sort_by_depth(triangle_arena_t *arena, int first_triangle,
+                                  int triangle_count);
+
+void draw_list_init(draw_list_t *draw_list, int initial_capacity);
+void draw_list_add(draw_list_t *draw_list, material_t *material,
+                   triangle_arena_t *triangle_arena, int first_triangle,
+                   int triangle_count, float depth);
+// front to back, draws at the same depth keep the order they were added in
+void draw_list_sort_by_depth(draw_list_t *draw_list);
+void draw_list_reset(draw_list_t *draw_list);
+void draw_list_free(draw_list_t *draw_list);
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "config.h"
+#include "mesh.h"
+#include "mesh_stream.h"
+#include "texture.h"
+#include "threads.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// how many requests can wait for the streaming thread, a request past that
+// is loaded right away on the calling thread
+#define ASSETS_MAX_PENDING_REQUESTS 256
+
+typedef enum { ASSET_MESH, ASSET_TEXTURE } asset_type_t;
+typedef enum { ASSET_LOADING, ASSET_RESIDENT } asset_state_t;
+
+// One loaded file, shared by everything that acquired it
+typedef struct {
+  asset_type_t type;
+  char *path;
+  // hash of the contents, two paths to the same data share one asset
+  uint64_t content_hash;
+  int reference_count;
+  // set to ASSET_RESIDENT by whoever loaded it once the mesh/texture is
+  // complete, nothing but this is read before that
+  atomic_int state;
+  // only the one matching the type is loaded
+  mesh_t mesh;
+  texture_t texture;
+} asset_t;
+
+typedef struct {
+  // every asset is allocated on its own so the handles stay put while the
+  // registry grows
+  asset_t **assets;
+  int number_of_assets;
+  int capacity;
+  // the meshes are built on it(the streamed ones too), may be NULL
+  thread_pool_t *thread_pool;
+  // the pages of all the streamed meshes, paged in by the streaming thread
+  mesh_stream_budget_t stream_budget;
+
+  // Requests of the render thread for the streaming thread, a single
+  // producer single consumer ring: only the render thread moves the head and
+  // only the streaming thread moves the tail
+  asset_t *requests[ASSETS_MAX_PENDING_REQUESTS];
+  atomic_int request_head;
+  atomic_int request_tail;
+  // one signal per request, one per frame with streamed meshes and one more
+  // to stop
+  sem_t request_signal;
+  pthread_t streaming_thread;
+  atomic_bool is_streaming;
+} asset_manager_t;
+
+// starts the streaming thread
+void assets_init(asset_manager_t *manager, thread_pool_t *thread_pool);
+
+// Loads the file the first time it is acquired(by path or by contents) and
+// hands out the same mesh/texture after that. Every acquire needs a release
+mesh_t *assets_acquire_mesh(asset_manager_t *manager, char *obj_filename);
+texture_t *assets_acquire_texture(asset_manager_t *manager,
+                                  char *texture_filename);
+
+// Returns right away, the file is loaded on the streaming thread and the
+// asset can be used once assets_get_* returns it. Every request needs a
+// release
+asset_t *assets_request_mesh(asset_manager_t *manager, char *obj_filename);
+asset_t *assets_request_texture(asset_manager_t *manager,
+                                char *texture_filename);
+
+// NULL till the asset is resident
+mesh_t *assets_get_mesh(asset_t *asset);
+texture_t *assets_get_texture(asset_t *asset);
+
+// blocks till the streaming thread is done with the asset
+void assets_wait(asset_t *asset);
+
+// pages in what the virtual textures were sampled at and lets the streamed
+// meshes page in what was visible since the last call, called on the render
+// thread before the geometry stage of every frame
+void assets_update(asset_manager_t *manager);
+
+// the asset is freed once the last user releases it
+void assets_release(asset_manager_t *manager, asset_t *asset);
+void assets_release_mesh(asset_manager_t *manager, mesh_t *mesh);
+void assets_release_texture(asset_manager_t *manager, texture_t *texture);
+
+// bytes the asset keeps in memory(a mapped cache file counts as its size,
+// a virtual texture or a streamed mesh as the pages it has resident)
+size_t assets_resident_bytes(asset_t *asset);
+#if USE_DIAGNOSTICS
+// prints the resident bytes of every asset and of all of them
+void assets_print_memory(asset_manager_t *manager);
+#endif
+
+// stops the streaming thread(after it finished the requests it has) and
+// frees everything that is still loaded, whatever was not released is
+// reported
+void assets_free(asset_manager_t *manager);
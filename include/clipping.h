@@ -1,5 +1,6 @@
 #pragma once
 
+#include "matrix.h"
 #include "texture.h"
 #include "triangle.h"
 #include "vector.h"
@@ -13,7 +14,36 @@ typedef struct {
   int num_vertices;
 } polygon_t;
 
+// a plane in the form dot(normal, p) + distance = 0 with the normal pointing
+// inside the frustum
+typedef struct {
+  vec3_t normal;
+  float distance;
+} plane_t;
+
+// the six planes of the camera frustum in View Space
+typedef struct {
+  plane_t planes[6];
+} frustum_t;
+
+// the planes the clipper keeps the triangles of `projection_matrix`
+// inside(-w <= x, y, z <= w) moved back into View Space, so the culling never
+// drops anything the projection would have drawn
+frustum_t frustum_from_projection(mat4_t projection_matrix);
+bool frustum_is_sphere_visible(frustum_t *frustum, vec3_t center,
+                               float radius);
+
+typedef enum { BOX_OUTSIDE, BOX_INTERSECTING, BOX_INSIDE } box_visibility_t;
+
+// moves the planes into the space that the matrix maps to the space the
+// planes are in, e.g. View Space planes + view matrix => World Space planes
+frustum_t frustum_transform(frustum_t *frustum, mat4_t matrix);
+box_visibility_t frustum_test_box(frustum_t *frustum, vec3_t box_min,
+                                  vec3_t box_max);
+
 polygon_t create_polygon_from_triangle(triangle_t triangle);
 void clip_polygon(polygon_t *polygon);
+// only clips against near/far, the side planes are handled by the rasterizer
+void clip_polygon_guard_band(polygon_t *polygon);
 void triangle_from_polygon(polygon_t *polygon, triangle_t triangles[],
                            int *number_of_triangles_from_polygon);
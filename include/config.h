@@ -8,3 +8,90 @@
 #define PER_FRAME_TARGET_TIME (1000.0 / FPS)
 
 #define TILE_SIZE 32
+#define TILES_X ((WINDOW_WIDTH + TILE_SIZE - 1) / TILE_SIZE)
+#define TILES_Y ((WINDOW_HEIGHT + TILE_SIZE - 1) / TILE_SIZE)
+
+// Hierarchical Z: the farthest depth of every tile and of every block of
+// HI_Z_BLOCK_SIZE x HI_Z_BLOCK_SIZE pixels of the z_buffer is kept so that
+// the tiled rasterizer can skip the triangles/blocks that are completely
+// behind what is already drawn(TILE_SIZE has to be a multiple of the block)
+#define USE_HIERARCHICAL_Z 1
+#define HI_Z_BLOCK_SIZE 8
+#define HI_Z_BLOCKS_X ((WINDOW_WIDTH + HI_Z_BLOCK_SIZE - 1) / HI_Z_BLOCK_SIZE)
+#define HI_Z_BLOCKS_Y ((WINDOW_HEIGHT + HI_Z_BLOCK_SIZE - 1) / HI_Z_BLOCK_SIZE)
+// relative slack on the nearest depth of a triangle as the interpolated
+// depth can be a rounding error nearer than any of the vertices
+#define HI_Z_EPSILON 1e-5
+
+// Guard band clipping: only the near(and optionally far) plane is clipped
+// geometrically, triangles crossing the side planes are left to the
+// rasterizer which already scissors against the tile/screen bounds.
+// GUARD_BAND_SCALE is how far past [-w,w] a vertex may go before we fall back
+// to clipping against the side planes(keeps the edge functions precise)
+#define USE_GUARD_BAND_CLIPPING 1
+#define CLIP_AGAINST_FAR_PLANE 1
+#define GUARD_BAND_SCALE 4.0
+
+// the rasterizer snaps the screen space vertices to 1/SUBPIXEL_STEPS of a
+// pixel, the edge functions of two triangles sharing an edge are then exact
+// opposites and no pixel along the edge is dropped even out in the guard band
+#define SUBPIXEL_STEPS 16.0
+
+// opaque draws are rasterized front to back(by the nearest point of their
+// bounding sphere) so that the early depth test rejects the hidden pixels
+// before they get shaded, the triangles inside of each draw can also be
+// sorted front to back with a radix sort on their quantised nearest depth
+#define USE_FRONT_TO_BACK_SORTING 1
+#define USE_TRIANGLE_DEPTH_SORTING 1
+
+// the faces of every meshlet are reordered at load for vertex reuse, the
+// vertex buffer follows the same order so the geometry stage reads it close
+// to linearly
+#define USE_VERTEX_CACHE_OPTIMIZATION 1
+
+// prints what the loading did(the ACMR of every mesh in the file, in meshlet
+// order and optimized) and the memory of the assets once they are resident
+#define USE_DIAGNOSTICS 0
+
+// compressed vertex layout(14 instead of 32 bytes): positions and texture
+// coordinates are stored in 16 bit steps over the bounds of the mesh and
+// normals are octahedral encoded into 2x16 bits, all of it is decoded in the
+// geometry stage
+#define USE_QUANTIZED_VERTICES 0
+
+// the built mesh(vertex buffer, indices, meshlets and bounds of every level)
+// is written to a .rmesh file next to the OBJ file, later starts map that
+// file and use it as is instead of parsing and building the mesh again
+#define USE_MESH_CACHE 1
+
+// meshes too large to keep in memory are drawn from pages of their meshlets
+// that a thread builds out of the mapped .rmesh file once they were visible,
+// within a memory budget and replacing the ones not visible for the longest.
+// A level of detail that is not resident yet falls back to a coarser one
+#define USE_MESH_STREAMING 1
+
+// the decoded pixels of every image and their whole mip chain are written to
+// a .rtex file next to it, later starts map that file instead of decoding the
+// image again(the pages are only read once they are sampled)
+#define USE_TEXTURE_CACHE 1
+
+// textures are block compressed at load(BC1 for color, BC4 for grey, BC5 for
+// two channels) in the format that fits their contents and are decoded one
+// 4x4 block at a time while sampling, 4-8x less memory than RGBA8
+#define USE_TEXTURE_COMPRESSION 1
+
+// large textures are split into pages that are copied in from their .rtex
+// file once they were sampled and replaced when they were not for the
+// longest, a page that is not resident yet is read from a coarser level. The
+// base textures are sampled at the level that fits the size of the triangle
+#define USE_VIRTUAL_TEXTURES 1
+
+// objects hidden behind the occluders of the scene are skipped before any of
+// their geometry is transformed
+#define USE_OCCLUSION_CULLING 1
+
+// the geometry stage of the next frame runs while the threads draw the tiles
+// of the current one and the frame before is shown meanwhile, everything
+// they share per frame(triangles, draws, lights, color buffer) is double
+// buffered. Frames are shown one frame later
+#define USE_FRAME_PIPELINING 1
@@ -6,7 +6,10 @@
 void display_init(app_state_t *app_state);
 void display_clear_buffer(app_state_t *app_state, uint32_t color);
 void display_clear_depth_buffer(app_state_t *app_state);
-void display_render_buffer(app_state_t *app_state);
+// clears the color, depth and hi-z of one TILE_SIZE tile
+void display_clear_tile(app_state_t *app_state, int tile_id, uint32_t color);
+// shows `color_buffer`(one of the color_buffers of the app state)
+void display_render_buffer(app_state_t *app_state, uint32_t *color_buffer);
 void display_cleanup(app_state_t *app_state);
 
 void display_draw_pixel(int x, int y, uint32_t color, app_state_t *app_state);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "appstate.h"
+#include "arena.h"
+#include "clipping.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "triangle.h"
+
+// One copy of a mesh in the scene
+typedef struct {
+  mat4_t model_matrix;
+  // part of the model matrix the normals go through
+  mat4_t rotation_matrix;
+  material_t *material;
+  // level of detail the instance was drawn with in the last frame
+  int lod;
+  // the triangles the instance produced in this frame
+  draw_call_t draw_call;
+} instance_t;
+
+instance_t instance_new(mat4_t scale_matrix, mat4_t rotation_matrix,
+                        mat4_t translation_matrix, material_t *material);
+
+// Culls and transforms a single instance into the arena, the resulting range
+// of triangles is left in instance->draw_call
+void instance_draw(mesh_t *mesh, instance_t *instance,
+                   triangle_arena_t *triangle_arena, render_stats_t *stats,
+                   mat4_t view_matrix, mat4_t projection_matrix,
+                   frustum_t *frustum);
+
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "vector.h"
+#include <stdbool.h>
 
 typedef struct {
   float data[4][4];
@@ -19,5 +20,10 @@ mat4_t mat4_make_look_at(vec3_t eye, vec3_t target, vec3_t up);
 mat4_t mat4_make_perspective(float fov, float aspect_ratio, float near,
                              float far);
 
+mat4_t mat4_make_model(mat4_t scale_matrix, mat4_t rotation_matrix,
+                       mat4_t translation_matrix);
+float mat4_get_max_scale(mat4_t m);
+bool mat4_preserves_angles(mat4_t m);
+
 vec4_t mat4_mul_vec4(mat4_t m, vec4_t v);
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b);
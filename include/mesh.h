@@ -1,18 +1,94 @@
 #pragma once
+#include "arena.h"
+#include "clipping.h"
+#include "config.h"
 #include "matrix.h"
+#include "meshlet.h"
 #include "texture.h"
+#include "threads.h"
 #include "triangle.h"
 #include "vector.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// number of levels of detail including the full detail one
+#define MESH_MAX_LODS 4
+// every level keeps about this ratio of the faces of the previous one
+#define MESH_LOD_REDUCTION 0.5
+// largest error(in pixels) a level is allowed to have on the screen
+#define MESH_LOD_MAX_SCREEN_ERROR 1.0
+// how far(relative) past the switching point a level change has to be before
+// it happens, keeps a mesh sitting at the switching distance from popping
+// between two levels every frame
+#define MESH_LOD_HYSTERESIS 0.25
+
+// One vertex of the mesh with all of its attributes next to each other,
+// every distinct (v, vt, vn) tuple of the OBJ file becomes one of these.
+// The attributes are read through mesh_get_vertex_*
+#if USE_QUANTIZED_VERTICES
+typedef struct {
+  // 0..65535 over the bounding box of the mesh
+  uint16_t position[3];
+  // octahedral encoding of the unit normal, -32767..32767
+  int16_t normal[2];
+  // 0..65535 over the texture coordinate bounds of the mesh
+  uint16_t tex_coord[2];
+} vertex_t;
+#else
+typedef struct {
+  vec3_t position;
+  vec3_t normal;
+  tex2_t tex_coord;
+} vertex_t;
+#endif
+
 typedef struct {
-  vec3_t *vertices;
-  vec3_t *normals;
-  tex2_t *tex_coords;
-  face_t *faces;
-  texture_t texture_data;
+  // three indices into the vertices of the mesh per face, each of them is
+  // mesh->index_size bytes
+  void *indices;
+  meshlet_t *meshlets;
   int number_of_faces;
+  int number_of_meshlets;
+  // largest distance(model space) the level is off from the full detail mesh
+  float error;
+} mesh_lod_t;
+
+// the meshlets of a mesh that is paged in on demand, see mesh_stream.h
+typedef struct mesh_stream_t mesh_stream_t;
+typedef struct mesh_stream_budget_t mesh_stream_budget_t;
+
+typedef struct {
+  vertex_t *vertices;
+  int number_of_vertices;
+  // 2 bytes(uint16_t) when every vertex can be reached with 16 bits and 4
+  // bytes(uint32_t) otherwise
+  int index_size;
+#if USE_QUANTIZED_VERTICES
+  // quantized => model space: offset + quantized * scale
+  vec3_t position_offset;
+  vec3_t position_scale;
+  tex2_t tex_coord_offset;
+  tex2_t tex_coord_scale;
+#endif
+  // level 0 is the full detail mesh, the others share its vertices
+  mesh_lod_t lods[MESH_MAX_LODS];
+  int number_of_lods;
+
+  // model space bounds of the vertices, used to cull the whole mesh
+  vec3_t bounding_box_min;
+  vec3_t bounding_box_max;
+  vec3_t bounding_sphere_center;
+  float bounding_sphere_radius;
+
+  // the .rmesh file the vertices, indices and meshlets point into when the
+  // mesh came from the cache, NULL when they were allocated
+  void *mapping;
+  size_t mapping_size;
+
+  // set for meshes too large to keep resident, only the pages of the
+  // meshlets that were visible are drawn from
+  mesh_stream_t *stream;
 } mesh_t;
 
 /////////////////////////////////////////////////////
@@ -24,13 +100,43 @@ void free_mesh_data(mesh_t mesh);
 ///////////////////////////////////////////////////////
 //////////////////////////////////////////////////////
 
-mesh_t load_mesh_obj(char *obj_filename, char *texture_filename);
+// source_hash(mesh_cache_hash_file) identifies the .rmesh cache of the
+// file, the OBJ file is parsed on the thread pool(NULL parses it on the
+// calling thread). A mesh large enough to be streamed pages in within
+// `stream_budget`. Meshes are normally loaded through the asset manager
+mesh_t load_mesh_obj(char *obj_filename, uint64_t source_hash,
+                     thread_pool_t *thread_pool,
+                     mesh_stream_budget_t *stream_budget);
+
+// the three vertex indices of a face of a level of detail
+void mesh_get_face_indices(mesh_t *mesh, mesh_lod_t *level, int face_index,
+                           uint32_t indices[3]);
+
+// the attributes of a vertex of the mesh(decoded when they are quantized)
+vec3_t mesh_get_vertex_position(mesh_t *mesh, vertex_t *vertex);
+vec3_t mesh_get_vertex_normal(mesh_t *mesh, vertex_t *vertex);
+tex2_t mesh_get_vertex_tex_coord(mesh_t *mesh, vertex_t *vertex);
 
 ///////////////////////////////////////////////////////
 //////////////////////////////////////////////////////
 
+// checks the bounding sphere of the mesh against the view frustum
+bool mesh_is_inside_frustum(mesh_t *mesh, mat4_t model_matrix,
+                            mat4_t view_matrix, frustum_t *frustum);
+
+// View Space depth of the closest point of the bounding sphere of the mesh
+// (negative when the camera is inside of it)
+float mesh_get_nearest_depth(mesh_t *mesh, mat4_t model_matrix,
+                             mat4_t view_matrix);
+
+// picks the coarsest level of detail whose error stays under
+// MESH_LOD_MAX_SCREEN_ERROR pixels, current_lod is the level used last frame
+int mesh_select_lod(mesh_t *mesh, int current_lod, mat4_t model_matrix,
+                    mat4_t view_matrix, mat4_t projection_matrix);
+
+// the rotation matrix is the part of the model matrix the normals go through
 void mesh_apply_transform_view_projection(
-    mesh_t *mesh, triangle_t *triangles_to_render,
-    int *triangles_to_render_count, mat4_t scale_matrix, mat4_t rotation_matrix,
-    mat4_t translation_matrix, mat4_t view_matrix, mat4_t projection_matrix,
+    mesh_t *mesh, int lod, triangle_arena_t *triangle_arena,
+    mat4_t model_matrix, mat4_t rotation_matrix, mat4_t view_matrix,
+    mat4_t projection_matrix, frustum_t *frustum, render_stats_t *stats,
     bool is_skybox);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "mesh.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// bump whenever the layout of the file or anything the loader builds changes
+#define MESH_CACHE_VERSION 4
+// every section of the file starts at a multiple of this(so the arrays can be
+// used in place from the mapping)
+#define MESH_CACHE_ALIGNMENT 64
+
+typedef struct {
+  uint64_t indices_offset;
+  uint64_t meshlets_offset;
+  int32_t number_of_faces;
+  int32_t number_of_meshlets;
+  float error;
+  int32_t padding;
+} mesh_cache_lod_t;
+
+// Header at the start of a .rmesh file, the vertices, the indices and the
+// meshlets of every level follow at the offsets(from the start of the file)
+typedef struct {
+  char magic[4];
+  int32_t version;
+  // FNV-1a of the OBJ file and of the settings the mesh was built with
+  uint64_t source_hash;
+  uint64_t file_size;
+
+  uint64_t vertices_offset;
+  int32_t number_of_vertices;
+  int32_t vertex_size;
+  int32_t index_size;
+  int32_t number_of_lods;
+  mesh_cache_lod_t lods[MESH_MAX_LODS];
+
+  vec3_t bounding_box_min;
+  vec3_t bounding_box_max;
+  vec3_t bounding_sphere_center;
+  float bounding_sphere_radius;
+  vec3_t position_offset;
+  vec3_t position_scale;
+  tex2_t tex_coord_offset;
+  tex2_t tex_coord_scale;
+} mesh_cache_header_t;
+
+// "assets/register.obj" => "assets/register.rmesh", the result has to be freed
+char *mesh_cache_filename(char *obj_filename);
+
+// hash the cache is checked against, it changes with the contents of the OBJ
+// file and with the build settings of the mesh
+uint64_t mesh_cache_hash_file(char *filename);
+
+// Maps the cache file and points the vertices, indices and meshlets of the
+// mesh straight into the mapping(nothing is parsed or copied). False when
+// there is no cache file, it was written for another source or version or
+// an index or meshlet in it points outside of the mesh
+bool mesh_cache_load(char *cache_filename, uint64_t source_hash,
+                     mesh_t *mesh);
+
+// writes the mesh next to its OBJ file, a failure only means the next start
+// builds the mesh again
+void mesh_cache_save(char *cache_filename, uint64_t source_hash,
+                     mesh_t *mesh);
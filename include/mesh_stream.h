@@ -0,0 +1,109 @@
+#pragma once
+
+#include "clipping.h"
+#include "matrix.h"
+#include "mesh.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// meshes with at least this many faces(full detail) are streamed
+#define MESH_STREAM_MIN_FACES (1 << 20)
+// bytes of meshlet pages all the streamed meshes keep resident at most
+#define MESH_STREAM_BUDGET (64 * 1024 * 1024)
+// pages the streaming thread builds per frame(of all the streamed meshes),
+// the rest follow later
+#define MESH_STREAM_MAX_UPLOADS 1024
+
+// The faces of one meshlet with their own copy of the vertices they use,
+// the indices are into those vertices
+typedef struct {
+  vertex_t *vertices;
+  uint16_t *indices;
+  int number_of_vertices;
+  int number_of_faces;
+  // bytes of the page including this header
+  size_t size;
+} mesh_page_t;
+
+// The pages of every streamed mesh, they share MESH_STREAM_BUDGET. The
+// streaming thread of the asset manager builds the missing ones once a frame
+// and evicts the ones that were not visible for the longest, whatever mesh
+// they belong to
+struct mesh_stream_budget_t {
+  // the frame the geometry stage is in, every frame before it is done
+  atomic_uint frame;
+  // the streams are added and removed by whoever loads and frees the meshes,
+  // the streaming thread holds it while it pages
+  pthread_mutex_t lock;
+  mesh_stream_t **streams;
+  int number_of_streams;
+  int capacity;
+  // bytes of the pages of all the streams, under the lock
+  size_t resident_bytes;
+};
+
+// A mesh whose meshlets are paged in from the .rmesh mapping. The geometry
+// stage records which meshlets were visible, the streaming thread builds the
+// pages of those that are missing within the budget. A level of detail that
+// is not complete yet falls back to a coarser one
+struct mesh_stream_t {
+  mesh_stream_budget_t *budget;
+  // the mapped mesh the pages are built from
+  mesh_t source;
+  // index of the first meshlet of every level in the tables below
+  int first_meshlet[MESH_MAX_LODS];
+  int number_of_meshlets;
+
+  // page of every meshlet, NULL while it is not resident
+  _Atomic(mesh_page_t *) *pages;
+  // frame every meshlet was last visible in
+  atomic_uint *last_visible;
+
+  // under the lock of the budget
+  int *resident_meshlets;
+  int number_of_resident_meshlets;
+  size_t resident_bytes;
+  // evicted pages wait here till the frame that might still read them is
+  // done
+  mesh_page_t **retired_pages;
+  uint32_t *retired_frames;
+  int number_of_retired_pages;
+
+  atomic_size_t reported_bytes;
+};
+
+void mesh_stream_budget_init(mesh_stream_budget_t *budget);
+// every stream of it has to be freed before
+void mesh_stream_budget_free(mesh_stream_budget_t *budget);
+
+// Called on the render thread before the geometry stage of every frame, the
+// meshlets visible in the last one can be paged in after it
+void mesh_stream_budget_update(mesh_stream_budget_t *budget);
+// Called on the streaming thread after mesh_stream_budget_update, builds the
+// missing pages of what was visible in the last frame
+void mesh_stream_budget_page_in(mesh_stream_budget_t *budget);
+
+// true for meshes large enough to be streamed
+bool mesh_stream_is_needed(mesh_t *mesh);
+// starts streaming the mapped `mesh` within `budget`, nothing is resident
+// at first
+mesh_stream_t *mesh_stream_create(mesh_t *mesh, mesh_stream_budget_t *budget);
+// takes the stream out of its budget and frees the pages
+void mesh_stream_free(mesh_stream_t *stream);
+
+// Records the visible meshlets of `lod` as wanted and returns the first
+// level from it on whose visible meshlets are all resident(the coarsest
+// level when none is complete yet)
+int mesh_stream_select_resident_lod(mesh_stream_t *stream, int lod,
+                                    mat4_t model_view_matrix, float max_scale,
+                                    bool can_cone_cull, frustum_t *frustum);
+// page of meshlet `meshlet_index` of the level, NULL while it is not
+// resident. Safe from any thread during the geometry stage
+mesh_page_t *mesh_stream_get_page(mesh_stream_t *stream, int lod,
+                                  int meshlet_index);
+
+// bytes of the resident pages and of the tables
+size_t mesh_stream_get_size(mesh_stream_t *stream);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "clipping.h"
+#include "matrix.h"
+#include "triangle.h"
+#include "vector.h"
+#include <stdbool.h>
+
+#define MESHLET_MAX_FACES 128
+// a face only joins a meshlet if its normal is within ~45 degrees of the
+// meshlet's average normal, which keeps the normal cones narrow enough to cull
+#define MESHLET_MIN_NORMAL_DOT 0.7
+// how much the normal deviation weighs against the distance when picking the
+// next face of a meshlet
+#define MESHLET_CONE_WEIGHT 2.0
+// how many faces ahead on the morton curve a meshlet looks for more faces
+// once it runs out of connected ones
+#define MESHLET_SEED_WINDOW 64
+
+// A cluster of neighbouring faces that can be culled as a whole before any
+// of its faces are touched
+typedef struct {
+  int first_face;
+  int number_of_faces;
+
+  // model space bounding sphere of the faces in the meshlet
+  vec3_t bounding_sphere_center;
+  float bounding_sphere_radius;
+
+  // all the face normals are inside the cone around the cone_axis
+  // cone_cutoff is the sine of the half angle of the cone
+  // (1 when the cone is too wide for the meshlet to ever be backfacing)
+  vec3_t cone_axis;
+  float cone_cutoff;
+} meshlet_t;
+
+// Groups the faces into meshlets, the faces are reordered in place so that
+// each meshlet is a contiguous range of faces. Returns the number of meshlets
+int meshlets_build(vec3_t *vertices, int number_of_vertices, face_t *faces,
+                   int number_of_faces, meshlet_t **meshlets);
+
+bool meshlet_is_visible(meshlet_t *meshlet, mat4_t model_view_matrix,
+                        float max_scale, bool can_cone_cull,
+                        frustum_t *frustum);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "threads.h"
+#include "triangle.h"
+#include "vector.h"
+
+// Everything the renderer uses out of an OBJ file, the indices of the faces
+// are already 0 based and every face has all three attributes
+typedef struct {
+  vec3_t *positions;
+  vec3_t *normals;
+  tex2_t *tex_coords;
+  face_t *faces;
+  int number_of_positions;
+  int number_of_normals;
+  int number_of_tex_coords;
+  int number_of_faces;
+  int positions_capacity;
+  int normals_capacity;
+  int tex_coords_capacity;
+  int faces_capacity;
+} obj_data_t;
+
+// Parses a memory mapping of the file. With a thread pool the file is split
+// at line boundaries into chunks that are first counted in parallel, a
+// prefix sum of the counts gives every chunk where its elements go and a
+// second parallel pass parses them there[so the indices stay the same as in a
+// serial parse]. NULL parses the whole file on the calling thread.
+// Faces can be `v/vt/vn`, `v//vn`, `v/vt` or `v`(negative indices count from
+// the end) and polygons are split into triangle fans. Corners without a
+// normal get the flat normal of their face and corners without a texture
+// coordinate get (0, 0)
+void obj_load(char *filename, obj_data_t *obj, thread_pool_t *thread_pool);
+void obj_free(obj_data_t *obj);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "matrix.h"
+#include "mesh.h"
+#include "vector.h"
+#include <stdbool.h>
+
+#define OCCLUSION_BUFFER_WIDTH 256
+#define OCCLUSION_BUFFER_HEIGHT 128
+// occluder triangles and boxes closer than this(View Space z) are skipped,
+// they would cover huge and imprecise parts of the buffer
+#define OCCLUSION_NEAR 0.1
+
+// Low resolution depth buffer of the occluders, objects that are completely
+// behind it do not need to be transformed at all
+typedef struct {
+  float *depth; // 1/w like the z_buffer, 0 is infinitely far
+  int width;
+  int height;
+
+  // scratch space for the projected vertices of an occluder
+  vec4_t *projected_vertices;
+  int projected_vertices_capacity;
+} occlusion_buffer_t;
+
+void occlusion_buffer_init(occlusion_buffer_t *buffer);
+void occlusion_buffer_free(occlusion_buffer_t *buffer);
+void occlusion_buffer_clear(occlusion_buffer_t *buffer);
+
+// Rasterizes the full detail faces of the mesh. Every triangle is drawn at
+// the depth of its farthest vertex so that the buffer is never nearer than
+// the occluder really is
+void occlusion_buffer_draw_mesh(occlusion_buffer_t *buffer, mesh_t *mesh,
+                                mat4_t model_view_projection_matrix);
+
+// true when everything the World Space box covers in the buffer is nearer
+// than the nearest corner of the box
+bool occlusion_buffer_is_box_occluded(occlusion_buffer_t *buffer,
+                                      vec3_t box_min, vec3_t box_max,
+                                      mat4_t view_projection_matrix);
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "appstate.h"
+#include "arena.h"
+#include "clipping.h"
+#include "instance.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "occlusion.h"
+#include "threads.h"
+#include "triangle.h"
+#include "vector.h"
+#include <stdbool.h>
+
+// most objects a leaf of the BVH holds
+#define SCENE_BVH_MAX_LEAF_OBJECTS 4
+// number of buckets along each axis the split planes are tried at
+#define SCENE_BVH_SAH_BINS 12
+// depth after which the nodes are split in half instead of by the SAH
+#define SCENE_BVH_MAX_SAH_DEPTH 32
+
+typedef struct {
+  mesh_t *mesh;
+  // transform, material and level of detail of the object
+  instance_t instance;
+  // World Space bounds of the mesh with the transform applied
+  vec3_t bounding_box_min;
+  vec3_t bounding_box_max;
+  // drawn into the occlusion buffer to hide the objects behind it
+  bool is_occluder;
+} scene_object_t;
+
+typedef struct {
+  vec3_t bounding_box_min;
+  vec3_t bounding_box_max;
+  // -1 for leaves, the right child always comes right after the left one
+  int left_child;
+  // -1 for the root
+  int parent;
+  // the objects below a node are one range of scene->object_order
+  int first_object;
+  int number_of_objects;
+  // leaf holding an object that moved since the last refit
+  bool is_dirty;
+} bvh_node_t;
+
+typedef struct {
+  scene_object_t *objects;
+  int number_of_objects;
+  int capacity;
+
+  // Bounding Volume Hierarchy over the objects, node 0 is the root and the
+  // children are always stored after their parent
+  bvh_node_t *nodes;
+  int number_of_nodes;
+  int *object_order;
+  // objects flagged as occluders, the occlusion pass is skipped without any
+  int number_of_occluders;
+  bool is_bvh_built; // objects were added since the last build
+  // leaf of every object
+  int *object_leaves;
+  // leaves with objects that moved since the last refit
+  int *dirty_leaves;
+  int number_of_dirty_leaves;
+
+  // objects that survived the frustum traversal in this frame
+  int *visible_objects;
+  int number_of_visible_objects;
+
+  occlusion_buffer_t occlusion_buffer;
+} scene_t;
+
+void scene_init(scene_t *scene, int initial_capacity);
+void scene_free(scene_t *scene);
+
+// returns the id of the object
+int scene_add_object(scene_t *scene, mesh_t *mesh, material_t *material,
+                     mat4_t scale_matrix, mat4_t rotation_matrix,
+                     mat4_t translation_matrix);
+void scene_set_object_transform(scene_t *scene, int object_id,
+                                mat4_t scale_matrix, mat4_t rotation_matrix,
+                                mat4_t translation_matrix);
+// Occluders should be large and simple[walls, floors, big props or a low
+// poly proxy] as their full detail is drawn into the occlusion buffer on the
+// main thread every frame. Streamed meshes are never drawn as occluders and
+// an occluder is never culled itself
+void scene_set_object_occluder(scene_t *scene, int object_id,
+                               bool is_occluder);
+
+// Surface Area Heuristic build over the objects
+void scene_build_bvh(scene_t *scene);
+// updates the bounds of the leaves with objects that moved and of their
+// ancestors till one does not change, the structure of the tree stays the
+// same
+void scene_refit_bvh(scene_t *scene);
+
+// Walks the BVH with the frustum and draws the visible objects on the thread
+// pool, one object per job index. Every thread writes the triangles into its
+// own arena[thread_triangle_arenas and thread_stats have one entry per
+// thread] and the draws are added in the traversal order, so the result does
+// not depend on which thread took which object
+void scene_draw(scene_t *scene, thread_pool_t *thread_pool,
+                triangle_arena_t *thread_triangle_arenas,
+                render_stats_t *thread_stats, draw_list_t *draw_list,
+                mat4_t view_matrix, mat4_t projection_matrix,
+                frustum_t *frustum, render_stats_t *stats);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "triangle.h"
+#include "vector.h"
+
+// extra weight of the planes that keep the open borders of a mesh in place
+#define SIMPLIFY_BOUNDARY_WEIGHT 100.0
+
+// A simplified version of a mesh, made out of the same vertices
+typedef struct {
+  face_t *faces;
+  int number_of_faces;
+  // the largest distance(model space) the simplification might have moved
+  // the surface by
+  float error;
+} simplified_level_t;
+
+// Quadric Error Metric simplification[Garland & Heckbert]
+// Collapses edges of the faces in the order of the smallest error until only
+// about `reduction` of the faces are left, that result becomes a level and
+// the simplification continues from there for the next level.
+// Returns the number of levels that could be built(at most max_levels)
+int simplify_build_levels(vec3_t *vertices, int number_of_vertices,
+                          face_t *faces, int number_of_faces, float reduction,
+                          int max_levels, simplified_level_t *levels);
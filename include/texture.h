@@ -1,12 +1,54 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+
+// enough levels for a 16384x16384 texture down to 1x1
+#define TEXTURE_MAX_MIPS 15
+
+// decoded 4x4 blocks every thread keeps around, a power of two
+#define TEXTURE_BLOCK_CACHE_SIZE 64
+
+// Layout of the texels: RGBA8 is one uint32_t per texel(0xAABBGGRR), the BC
+// formats are 4x4 blocks of texels(see texture_compression.h) that are
+// decoded when they are sampled
+typedef enum {
+  TEXTURE_FORMAT_RGBA8,
+  TEXTURE_FORMAT_BC1,
+  TEXTURE_FORMAT_BC4,
+  TEXTURE_FORMAT_BC5
+} texture_format_t;
+
+typedef struct {
+  int width;
+  int height;
+  // texels in rows, or blocks in rows for the BC formats
+  void *data;
+} texture_mip_t;
+
+// the pages of a texture that is paged in on demand, see virtual_texture.h
+typedef struct virtual_texture_t virtual_texture_t;
+
 typedef struct {
+  // size of level 0, the texels are read through texture_fetch
   int width;
   int height;
   int no_of_channels;
-  uint32_t *data;
+
+  texture_format_t format;
+  // every level is half the size of the previous one down to 1x1
+  texture_mip_t mips[TEXTURE_MAX_MIPS];
+  int number_of_mips;
+
+  // the .rtex file the levels point into when the texture came from the
+  // cache, NULL when they were allocated
+  void *mapping;
+  size_t mapping_size;
+
+  // set for large textures, only the pages that were sampled are resident
+  // and texture_fetch reads through it
+  virtual_texture_t *virtual_texture;
 } texture_t;
 
 typedef struct {
@@ -14,5 +56,26 @@ typedef struct {
   float v;
 } tex2_t;
 
-texture_t load_texture_data(char *filename);
+// source_hash(texture_cache_hash_file) identifies the .rtex cache of the
+// file, textures are normally loaded through the asset manager
+texture_t load_texture_data(char *filename, uint64_t source_hash);
+void free_texture_data(texture_t texture);
+// bytes of a level of the format
+size_t texture_get_mip_size(texture_format_t format, int width, int height);
+// bytes of all the levels
+size_t texture_get_size(texture_t *texture);
+// the texel at x, y of level 0(which have to be inside of the texture) read
+// from `level`, the coordinates are scaled down to it
+uint32_t texture_fetch(texture_t *texture, int x, int y, int level);
+// the texel at x, y of rows of texels(or 4x4 blocks) that are `width` texels
+// wide, the BC blocks are decoded through the block cache of the thread
+uint32_t texture_fetch_texel(texture_format_t format, const void *data,
+                             int width, int x, int y);
+// the blocks the threads decoded are not handed out again, for when the
+// memory they were decoded from gets new contents
+void texture_invalidate_block_cache(void);
+// The level a triangle with those texture coordinates that covers
+// `screen_area`(twice the area in pixels) samples at, one texel per pixel
+int texture_get_mip_level(texture_t *texture, tex2_t t0, tex2_t t1, tex2_t t2,
+                          float screen_area);
 tex2_t tex2_clone(tex2_t *t);
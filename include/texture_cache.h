@@ -0,0 +1,49 @@
+#pragma once
+
+#include "texture.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// bump whenever the layout of the file or the way the mips are built changes
+#define TEXTURE_CACHE_VERSION 2
+// every level starts at a multiple of this inside of the file
+#define TEXTURE_CACHE_ALIGNMENT 64
+
+typedef struct {
+  uint64_t offset;
+  int32_t width;
+  int32_t height;
+} texture_cache_mip_t;
+
+// Header at the start of a .rtex file, the pixels of every level follow at
+// the offsets(from the start of the file)
+typedef struct {
+  char magic[4];
+  int32_t version;
+  // FNV-1a of the image file and of the settings the levels were built with
+  uint64_t source_hash;
+  uint64_t file_size;
+  int32_t format;
+  int32_t no_of_channels;
+  int32_t number_of_mips;
+  int32_t padding;
+  texture_cache_mip_t mips[TEXTURE_MAX_MIPS];
+} texture_cache_header_t;
+
+// "assets/register.png" => "assets/register.rtex", the result has to be freed
+char *texture_cache_filename(char *image_filename);
+
+// hash the cache is checked against, it changes with the contents of the
+// image file and with the way the levels are built
+uint64_t texture_cache_hash_file(char *filename);
+
+// Maps the cache file and points the levels of the texture straight into the
+// mapping, the pages are only read once they are sampled. False when there
+// is no cache file or it was written for another source or version
+bool texture_cache_load(char *cache_filename, uint64_t source_hash,
+                        texture_t *texture);
+
+// writes the texture next to its image file, a failure only means the next
+// start decodes the image again
+void texture_cache_save(char *cache_filename, uint64_t source_hash,
+                        texture_t *texture);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Block compression of RGBA8 texels(0xAABBGGRR), every 4x4 block of texels
+// becomes one fixed size block:
+// BC1: 8 bytes, two 5:6:5 endpoints and 2 bit indices, alpha is 0 or 255
+// BC4: 8 bytes, one grey channel(encoded from red) with two 8 bit endpoints
+//      and 3 bit indices
+// BC5: 16 bytes, two BC4 blocks for the red and the green channel
+
+// `texels` are the 16 texels of the block in rows
+void texture_encode_bc1_block(uint32_t texels[16], uint8_t block[8]);
+void texture_encode_bc4_block(uint32_t texels[16], int shift,
+                              uint8_t block[8]);
+void texture_encode_bc5_block(uint32_t texels[16], uint8_t block[16]);
+
+// the decoded texels are written in rows and opaque unless BC1 says
+// otherwise, BC4 comes out grey and BC5 with blue 0
+void texture_decode_bc1_block(const uint8_t block[8], uint32_t texels[16]);
+void texture_decode_bc4_block(const uint8_t block[8], uint32_t texels[16]);
+void texture_decode_bc5_block(const uint8_t block[16], uint32_t texels[16]);
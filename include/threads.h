@@ -1,32 +1,115 @@
 #pragma once
 
 #include "appstate.h"
+#include "arena.h"
 #include "triangle.h"
-#include <bits/pthreadtypes.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 
+// slots of the deque of every thread, a power of two. A job takes one slot
+// for every thread that can help with it
+#define THREADS_DEQUE_SIZE 256
+
+// A job is the same function run `count` times, every run gets its own index
+// and the index of the thread it runs on[so that it can use per thread
+// storage without any locks]
+typedef void (*job_function_t)(void *job_data, int job_index,
+                               int thread_index);
+
+// number of submitted jobs that are not done yet, threads can wait for it to
+// reach 0
+typedef struct {
+  atomic_int value;
+} threads_counter_t;
+
+typedef struct job_t job_t;
+struct job_t {
+  job_function_t function;
+  void *data;
+  int count;
+
+  // the next index to run, every thread that holds the job takes the next one
+  atomic_int next_index;
+  // threads that still hold(or will pop) the job, the last one to let go of
+  // it finishes the job
+  atomic_int references;
+  // decremented once every index ran
+  threads_counter_t *counter;
+  // links the job into the injected jobs of the pool
+  job_t *next_injected;
+  // slots the job still has in the injected jobs
+  int injected_slots;
+};
+
+// Chase-Lev deque of jobs, the thread that owns it pushes and pops at the
+// bottom while the other threads steal from the top
+typedef struct {
+  atomic_long top;
+  atomic_long bottom;
+  _Atomic(job_t *) slots[THREADS_DEQUE_SIZE];
+} thread_deque_t;
+
+typedef struct thread_pool_t thread_pool_t;
+
+typedef struct {
+  int thread_index;
+  thread_pool_t *thread_pool;
+} thread_t;
+
+// The main thread is thread 0 and works through the jobs while it waits, the
+// other threads run whatever is in their own deque and steal from the others
+// once it is empty
+struct thread_pool_t {
+  pthread_t *threads;
+  thread_t *thread_data;
+  thread_deque_t *deques;
+  // including the main thread
+  int number_of_threads;
+
+  // slots of all the deques that hold a job, threads only sleep at 0
+  atomic_int queued_jobs;
+  atomic_int sleeping_threads;
+  pthread_mutex_t lock;
+  pthread_cond_t wake_signal;
+  // jobs submitted by threads outside of the pool, which have no deque,
+  // guarded by the lock. The count of their slots is read without it
+  job_t *injected_jobs;
+  atomic_int number_of_injected;
+  atomic_bool is_running;
+};
+
+// data of the tile rendering job, one job index per tile
 typedef struct {
   app_state_t *app_state;
-  atomic_int *tile_counter;
-  sem_t *start_signal;
-  sem_t *done_signal;
-  bool *is_main_thread_running;
-  // all the properties required to render a triangle
-  material_t *base_material;
-  material_t *skybox_material;
+  draw_list_t *draw_list;
   scene_info_t *scene_info;
-} thread_t;
+} tile_job_t;
+
+// starts one thread per core besides the main one
+void threads_initialize(thread_pool_t *thread_pool);
+
+// Queues `count` runs of `function` without waiting for them. The job memory
+// belongs to the caller and has to stay valid till `counter` reaches 0. A
+// thread outside of the pool(the asset streaming thread) can submit too, its
+// jobs are run by the threads of the pool once their deques are empty, the
+// main thread only while it waits in threads_wait
+void threads_submit(thread_pool_t *thread_pool, job_t *job,
+                    job_function_t function, void *data, int count,
+                    threads_counter_t *counter);
+
+// runs queued jobs on the calling thread till `counter` is 0(a job of another
+// counter is left to the other threads as soon as it is), a thread outside of
+// the pool sleeps instead
+void threads_wait(thread_pool_t *thread_pool, threads_counter_t *counter);
+
+// runs the job on all the threads and waits till every index is done
+void threads_run_job(thread_pool_t *thread_pool, job_function_t function,
+                     void *data, int count);
 
-void threads_initialize(app_state_t *app_state, pthread_t **thread_pool,
-                        thread_t **thread_data, sem_t **start_signals,
-                        sem_t **done_signals, atomic_int *tile_counter,
-                        bool *is_main_thread_running, material_t *base_material,
-                        material_t *skybox_material, scene_info_t *scene_info);
+void threads_cleanup(thread_pool_t *thread_pool);
 
-void threads_cleanup(pthread_t *thread_pool, thread_t *thread_data,
-                     sem_t *start_signals, sem_t *done_signals);
+void *thread_worker(void *arg);
 
-void *thread_render(void *arg);
+// clears the tile and draws every draw of the frame that covers it
+void thread_render_tile(void *job_data, int tile_id, int thread_index);
@@ -55,8 +55,6 @@ typedef struct {
 } bounding_box_t;
 
 typedef struct {
-  triangle_t *triangles_to_render;
-  int *triangles_to_render_count;
   // BRDF related textures
   texture_t *base_texture_data;
   texture_t *radiance_texture_data;
@@ -77,3 +75,9 @@ void draw_triangle_fill_tiled_with_lighting_effect(
     bounding_box_t tile_bounding_box, app_state_t *app_state);
 
 void draw_triangle_wireframe(triangle_t triangle, app_state_t *app_state);
+
+// Depth only variant used for the occlusion buffer, the vertices are already
+// in the pixels of the buffer and the whole triangle gets the same depth(1/w)
+void draw_triangle_depth_only(vec2_t v0, vec2_t v1, vec2_t v2, float depth,
+                              float *depth_buffer, int buffer_width,
+                              int buffer_height);
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 typedef struct {
   uint8_t a;
@@ -15,3 +18,21 @@ float lerp(float a, float b, float t);
 uint32_t lerp_uint32(uint32_t a, uint32_t b, float t);
 float clamp(float v, float min, float max);
 uint32_t create_color_uint32(color_t color);
+
+// FNV-1a, start with HASH_SEED and feed the result back in to hash more data
+#define HASH_SEED 14695981039346656037ULL
+uint64_t hash_fnv1a(uint64_t hash, const void *data, size_t size);
+// continues the hash over the contents of the file
+uint64_t hash_file(uint64_t hash, char *filename);
+
+// "assets/register.obj" + ".rmesh" => "assets/register.rmesh" and
+// "register.rmesh" + ".tmp" => "register.rmesh.tmp", the result has to be
+// freed
+char *filename_replace_extension(char *filename, char *extension);
+char *filename_append(char *filename, char *suffix);
+
+// rounds the offset up to a multiple of the alignment
+size_t align_up(size_t offset, size_t alignment);
+// writes `size` bytes at `offset`(at or past the end of the file), the gap
+// before it is filled with zeros
+bool file_write_at(FILE *file, size_t offset, const void *data, size_t size);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "meshlet.h"
+#include "triangle.h"
+
+// number of entries of the FIFO cache the faces are ordered for and measured
+// with
+#define VERTEX_CACHE_SIZE 16
+
+// Chains the meshlets so that each one starts with as many vertices as
+// possible still in the cache from the previous one and reorders the faces
+// inside of every meshlet(Tipsify) so that consecutive faces keep reusing the
+// same few vertices. Every meshlet stays a contiguous range of faces and the
+// order they came in is kept when the new one does not have a lower ACMR
+void vertex_cache_optimize_meshlets(face_t *faces, int number_of_vertices,
+                                    meshlet_t *meshlets,
+                                    int number_of_meshlets);
+
+// Average Cache Miss Ratio: vertices fetched per face through a FIFO cache of
+// VERTEX_CACHE_SIZE entries, 3 is the worst and ~0.5 the best a closed mesh
+// can do
+float vertex_cache_acmr(face_t *faces, int number_of_faces,
+                        int number_of_vertices);
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "texture.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// texels on each side of a page, a multiple of the 4x4 blocks
+#define VIRTUAL_TEXTURE_PAGE_SIZE 64
+// pages every virtual texture keeps resident at most
+#define VIRTUAL_TEXTURE_SLOTS 256
+// pages copied in by one update, the rest follow in the next frames
+#define VIRTUAL_TEXTURE_MAX_UPLOADS 64
+// textures at least this large on one side are paged
+#define VIRTUAL_TEXTURE_MIN_SIZE 1024
+
+typedef struct {
+  int width;
+  int height;
+  int pages_x;
+  int pages_y;
+  // index of the first page of the level in the page table and feedback
+  int first_page;
+  // the level the pages are copied from(normally inside of the .rtex mapping)
+  const uint8_t *source;
+} virtual_texture_level_t;
+
+typedef struct {
+  // page held by the slot, -1 while it is free
+  int page;
+  // update the page was last sampled before
+  uint32_t last_used;
+} virtual_texture_slot_t;
+
+// A texture split into pages of VIRTUAL_TEXTURE_PAGE_SIZE texels, only the
+// pages the samplers asked for are copied into the slots and a page that is
+// not resident yet is read from the next coarser level that is. The levels
+// that fit into one page(the tail) are always resident
+struct virtual_texture_t {
+  texture_format_t format;
+  // bytes of one page of texels or blocks
+  size_t page_size;
+
+  virtual_texture_level_t levels[TEXTURE_MAX_MIPS];
+  int number_of_paged_levels;
+  texture_mip_t tail[TEXTURE_MAX_MIPS];
+  int number_of_tail_levels;
+
+  // slot of every page of the paged levels, -1 while it is not resident
+  int *page_table;
+  // set by the samplers(on any thread) for every page they wanted during the
+  // frame, read and cleared by the update
+  atomic_uchar *feedback;
+  int number_of_pages;
+
+  uint8_t *slot_data;
+  virtual_texture_slot_t slots[VIRTUAL_TEXTURE_SLOTS];
+  int number_of_resident_pages;
+  uint32_t frame;
+
+  // the file the levels point into, what was read from it is dropped again
+  void *mapping;
+  size_t mapping_size;
+};
+
+// true for textures large enough to be paged
+bool virtual_texture_is_needed(texture_t *texture);
+// pages the levels of `texture`, which have to stay valid while it is used
+virtual_texture_t *virtual_texture_create(texture_t *texture);
+void virtual_texture_free(virtual_texture_t *virtual_texture);
+
+// The texel at x, y of level 0 read from `level`, or from the nearest coarser
+// level that is resident. Records the page for the next update, safe to call
+// from any thread while no update runs
+uint32_t virtual_texture_fetch(virtual_texture_t *virtual_texture, int x, int y,
+                               int level);
+
+// Copies in the pages sampled since the last update(coarse levels first) in
+// place of the ones that were not used for the longest, called between frames
+void virtual_texture_update(virtual_texture_t *virtual_texture);
+
+// bytes of the slots, the tail and the tables
+size_t virtual_texture_get_size(virtual_texture_t *virtual_texture);
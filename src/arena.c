@@ -0,0 +1,207 @@
+#include "arena.h"
+#include "triangle.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+////////////////////////////////////////////////////////////////
+/////////////////////// TRIANGLE ARENA /////////////////////////
+////////////////////////////////////////////////////////////////
+
+void triangle_arena_init(triangle_arena_t *arena, int initial_capacity) {
+  arena->count = 0;
+  arena->capacity = initial_capacity > 0 ? initial_capacity : 1;
+  arena->triangles = malloc(sizeof(triangle_t) * arena->capacity);
+  if (!arena->triangles) {
+    fprintf(stderr, "Error: Could not allocate the triangle arena\n");
+    exit(1);
+  }
+  // the sort scratch is only allocated once a range gets sorted
+  arena->sort_triangles = NULL;
+  arena->sort_keys = NULL;
+  arena->sort_capacity = 0;
+}
+
+// makes sure that the next extra_triangles pushes will not have to grow the
+// arena
+void triangle_arena_reserve(triangle_arena_t *arena, int extra_triangles) {
+  int required_capacity = arena->count + extra_triangles;
+  if (required_capacity <= arena->capacity)
+    return;
+
+  // double the capacity so that the number of reallocations stays
+  // logarithmic to the peak triangle count
+  int new_capacity = arena->capacity;
+  while (new_capacity < required_capacity)
+    new_capacity *= 2;
+
+  triangle_t *triangles =
+      realloc(arena->triangles, sizeof(triangle_t) * new_capacity);
+  if (!triangles) {
+    fprintf(stderr, "Error: Could not grow the triangle arena to %d\n",
+            new_capacity);
+    exit(1);
+  }
+  arena->triangles = triangles;
+  arena->capacity = new_capacity;
+}
+
+// returns the next free triangle slot
+// (the pointer is only valid until the next push as the arena might move)
+triangle_t *triangle_arena_push(triangle_arena_t *arena) {
+  triangle_arena_reserve(arena, 1);
+  return &arena->triangles[arena->count++];
+}
+
+void triangle_arena_reset(triangle_arena_t *arena) { arena->count = 0; }
+
+void triangle_arena_free(triangle_arena_t *arena) {
+  free(arena->triangles);
+  free(arena->sort_triangles);
+  free(arena->sort_keys);
+  arena->triangles = NULL;
+  arena->sort_triangles = NULL;
+  arena->sort_keys = NULL;
+  arena->count = 0;
+  arena->capacity = 0;
+  arena->sort_capacity = 0;
+}
+
+// sort key of a triangle: the bits of its nearest w(the View Space depth),
+// for positive floats the bits grow with the value so they sort as integers
+uint32_t triangle_depth_key(triangle_t *triangle) {
+  float nearest_w =
+      fminf(triangle->vertices[0].w,
+            fminf(triangle->vertices[1].w, triangle->vertices[2].w));
+  uint32_t key;
+  memcpy(&key, &nearest_w, sizeof(key));
+  return key;
+}
+
+void triangle_arena_sort_by_depth(triangle_arena_t *arena, int first_triangle,
+                                  int triangle_count) {
+  if (triangle_count < 2)
+    return;
+
+  if (triangle_count > arena->sort_capacity) {
+    int new_capacity = arena->sort_capacity > 0 ? arena->sort_capacity : 1;
+    while (new_capacity < triangle_count)
+      new_capacity *= 2;
+    triangle_t *sort_triangles =
+        realloc(arena->sort_triangles, sizeof(triangle_t) * new_capacity);
+    uint32_t *sort_keys =
+        realloc(arena->sort_keys, sizeof(uint32_t) * 2 * new_capacity);
+    if (!sort_triangles || !sort_keys) {
+      fprintf(stderr, "Error: Could not grow the sort scratch to %d\n",
+              new_capacity);
+      exit(1);
+    }
+    arena->sort_triangles = sort_triangles;
+    arena->sort_keys = sort_keys;
+    arena->sort_capacity = new_capacity;
+  }
+
+  triangle_t *triangles = &arena->triangles[first_triangle];
+  uint32_t *keys = arena->sort_keys;
+  for (int i = 0; i < triangle_count; ++i) {
+    keys[i] = triangle_depth_key(&triangles[i]);
+  }
+
+  // LSD radix sort on the top 16 bits of the key[sign, exponent and the top
+  // of the mantissa], two passes of 8 bits so the triangles end up back in
+  // the arena. Every pass is stable so equal depths keep their order
+  triangle_t *source_triangles = triangles;
+  triangle_t *target_triangles = arena->sort_triangles;
+  uint32_t *source_keys = keys;
+  uint32_t *target_keys = keys + arena->sort_capacity;
+  for (int shift = 16; shift < 32; shift += 8) {
+    int offsets[256] = {0};
+    for (int i = 0; i < triangle_count; ++i) {
+      offsets[(source_keys[i] >> shift) & 0xFF]++;
+    }
+    int offset = 0;
+    for (int b = 0; b < 256; ++b) {
+      int bucket_count = offsets[b];
+      offsets[b] = offset;
+      offset += bucket_count;
+    }
+    for (int i = 0; i < triangle_count; ++i) {
+      int target = offsets[(source_keys[i] >> shift) & 0xFF]++;
+      target_triangles[target] = source_triangles[i];
+      target_keys[target] = source_keys[i];
+    }
+
+    triangle_t *swap_triangles = source_triangles;
+    source_triangles = target_triangles;
+    target_triangles = swap_triangles;
+    uint32_t *swap_keys = source_keys;
+    source_keys = target_keys;
+    target_keys = swap_keys;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+///////////////////////// DRAW LIST ////////////////////////////
+////////////////////////////////////////////////////////////////
+
+void draw_list_init(draw_list_t *draw_list, int initial_capacity) {
+  draw_list->count = 0;
+  draw_list->capacity = initial_capacity > 0 ? initial_capacity : 1;
+  draw_list->draw_calls = malloc(sizeof(draw_call_t) * draw_list->capacity);
+  if (!draw_list->draw_calls) {
+    fprintf(stderr, "Error: Could not allocate the draw list\n");
+    exit(1);
+  }
+}
+
+void draw_list_add(draw_list_t *draw_list, material_t *material,
+                   triangle_arena_t *triangle_arena, int first_triangle,
+                   int triangle_count, float depth) {
+  // nothing survived culling/clipping
+  if (triangle_count == 0)
+    return;
+
+  if (draw_list->count == draw_list->capacity) {
+    int new_capacity = draw_list->capacity * 2;
+    draw_call_t *draw_calls =
+        realloc(draw_list->draw_calls, sizeof(draw_call_t) * new_capacity);
+    if (!draw_calls) {
+      fprintf(stderr, "Error: Could not grow the draw list to %d\n",
+              new_capacity);
+      exit(1);
+    }
+    draw_list->draw_calls = draw_calls;
+    draw_list->capacity = new_capacity;
+  }
+
+  draw_call_t draw_call = {.material = material,
+                           .triangle_arena = triangle_arena,
+                           .first_triangle = first_triangle,
+                           .triangle_count = triangle_count,
+                           .depth = depth,
+                           .order = draw_list->count};
+  draw_list->draw_calls[draw_list->count++] = draw_call;
+}
+
+int draw_call_compare_depth(const void *a, const void *b) {
+  const draw_call_t *draw_call_a = (const draw_call_t *)a;
+  const draw_call_t *draw_call_b = (const draw_call_t *)b;
+  if (draw_call_a->depth != draw_call_b->depth)
+    return draw_call_a->depth < draw_call_b->depth ? -1 : 1;
+  return draw_call_a->order - draw_call_b->order;
+}
+
+void draw_list_sort_by_depth(draw_list_t *draw_list) {
+  qsort(draw_list->draw_calls, draw_list->count, sizeof(draw_call_t),
+        draw_call_compare_depth);
+}
+
+void draw_list_reset(draw_list_t *draw_list) { draw_list->count = 0; }
+
+void draw_list_free(draw_list_t *draw_list) {
+  free(draw_list->draw_calls);
+  draw_list->draw_calls = NULL;
+  draw_list->count = 0;
+  draw_list->capacity = 0;
+}
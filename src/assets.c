@@ -0,0 +1,358 @@
+#include "assets.h"
+#include "config.h"
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_stream.h"
+#include "texture.h"
+#include "texture_cache.h"
+#include "threads.h"
+#include "utilities.h"
+#include "virtual_texture.h"
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void *assets_streaming_worker(void *arg);
+
+void assets_init(asset_manager_t *manager, thread_pool_t *thread_pool) {
+  manager->assets = NULL;
+  manager->number_of_assets = 0;
+  manager->capacity = 0;
+  manager->thread_pool = thread_pool;
+  mesh_stream_budget_init(&manager->stream_budget);
+  atomic_init(&manager->request_head, 0);
+  atomic_init(&manager->request_tail, 0);
+  atomic_init(&manager->is_streaming, true);
+  sem_init(&manager->request_signal, 0, 0);
+  pthread_create(&manager->streaming_thread, NULL, assets_streaming_worker,
+                 manager);
+}
+
+bool assets_is_resident(asset_t *asset) {
+  return atomic_load_explicit(&asset->state, memory_order_acquire) ==
+         ASSET_RESIDENT;
+}
+
+// the asset of that type with the same path, or failing that(when
+// `content_hash` is given) the same contents
+asset_t *assets_find(asset_manager_t *manager, asset_type_t type,
+                     char *filename, uint64_t *content_hash) {
+  for (int i = 0; i < manager->number_of_assets; ++i) {
+    asset_t *asset = manager->assets[i];
+    if (asset->type == type && strcmp(asset->path, filename) == 0)
+      return asset;
+  }
+  if (!content_hash)
+    return NULL;
+
+  *content_hash = type == ASSET_MESH ? mesh_cache_hash_file(filename)
+                                     : texture_cache_hash_file(filename);
+  for (int i = 0; i < manager->number_of_assets; ++i) {
+    asset_t *asset = manager->assets[i];
+    // the hash of a streamed asset is only known once it is resident
+    if (asset->type == type && assets_is_resident(asset) &&
+        asset->content_hash == *content_hash)
+      return asset;
+  }
+  return NULL;
+}
+
+asset_t *assets_add(asset_manager_t *manager, asset_type_t type,
+                    char *filename) {
+  if (manager->number_of_assets == manager->capacity) {
+    int new_capacity = manager->capacity > 0 ? manager->capacity * 2 : 16;
+    asset_t **grown =
+        realloc(manager->assets, sizeof(asset_t *) * new_capacity);
+    if (!grown) {
+      fprintf(stderr, "Error: Could not grow the asset registry to %d\n",
+              new_capacity);
+      exit(1);
+    }
+    manager->assets = grown;
+    manager->capacity = new_capacity;
+  }
+
+  asset_t *asset = calloc(1, sizeof(asset_t));
+  char *path = malloc(strlen(filename) + 1);
+  if (!asset || !path) {
+    fprintf(stderr, "Error: Could not allocate the asset: %s\n", filename);
+    exit(1);
+  }
+  strcpy(path, filename);
+  asset->type = type;
+  asset->path = path;
+  atomic_init(&asset->state, ASSET_LOADING);
+  manager->assets[manager->number_of_assets++] = asset;
+  return asset;
+}
+
+// Loads the file of the asset and publishes it, `content_hash` is 0 when it
+// still has to be computed. The release store makes the mesh/texture visible
+// to whoever sees the asset as resident
+void assets_load(asset_manager_t *manager, asset_t *asset,
+                 uint64_t content_hash, thread_pool_t *thread_pool) {
+  if (asset->type == ASSET_MESH) {
+    if (!content_hash)
+      content_hash = mesh_cache_hash_file(asset->path);
+    asset->mesh = load_mesh_obj(asset->path, content_hash, thread_pool,
+                                &manager->stream_budget);
+  } else {
+    if (!content_hash)
+      content_hash = texture_cache_hash_file(asset->path);
+    asset->texture = load_texture_data(asset->path, content_hash);
+  }
+  asset->content_hash = content_hash;
+  atomic_store_explicit(&asset->state, ASSET_RESIDENT, memory_order_release);
+}
+
+asset_t *assets_acquire(asset_manager_t *manager, asset_type_t type,
+                        char *filename) {
+  uint64_t content_hash;
+  asset_t *asset = assets_find(manager, type, filename, &content_hash);
+  if (!asset) {
+    asset = assets_add(manager, type, filename);
+    assets_load(manager, asset, content_hash, manager->thread_pool);
+  }
+  // it might have been requested before and still be streaming
+  assets_wait(asset);
+  asset->reference_count++;
+  return asset;
+}
+
+mesh_t *assets_acquire_mesh(asset_manager_t *manager, char *obj_filename) {
+  return &assets_acquire(manager, ASSET_MESH, obj_filename)->mesh;
+}
+
+texture_t *assets_acquire_texture(asset_manager_t *manager,
+                                  char *texture_filename) {
+  return &assets_acquire(manager, ASSET_TEXTURE, texture_filename)->texture;
+}
+
+/////////////////////////////////////////////////////
+//////////////////// STREAMING //////////////////////
+/////////////////////////////////////////////////////
+
+void *assets_streaming_worker(void *arg) {
+  asset_manager_t *manager = (asset_manager_t *)arg;
+  uint32_t paged_frame = atomic_load(&manager->stream_budget.frame);
+  while (true) {
+    sem_wait(&manager->request_signal);
+    int tail = atomic_load_explicit(&manager->request_tail,
+                                    memory_order_relaxed);
+    int head =
+        atomic_load_explicit(&manager->request_head, memory_order_acquire);
+    if (tail == head) {
+      // the frames it fell behind on are paged in at once, their signals
+      // find nothing left to do
+      uint32_t frame = atomic_load(&manager->stream_budget.frame);
+      if (frame != paged_frame) {
+        paged_frame = frame;
+        mesh_stream_budget_page_in(&manager->stream_budget);
+        continue;
+      }
+      if (!atomic_load(&manager->is_streaming))
+        break;
+      continue;
+    }
+
+    asset_t *asset = manager->requests[tail % ASSETS_MAX_PENDING_REQUESTS];
+    // the threads of the pool parse for the streaming thread, a pool of only
+    // the render thread would not get to it while the render thread waits
+    // for the asset
+    thread_pool_t *thread_pool = manager->thread_pool;
+    if (thread_pool && thread_pool->number_of_threads == 1)
+      thread_pool = NULL;
+    assets_load(manager, asset, 0, thread_pool);
+    atomic_store_explicit(&manager->request_tail, tail + 1,
+                          memory_order_release);
+  }
+  return NULL;
+}
+
+asset_t *assets_request(asset_manager_t *manager, asset_type_t type,
+                        char *filename) {
+  // only by path, the contents are not read on the render thread
+  asset_t *asset = assets_find(manager, type, filename, NULL);
+  if (asset) {
+    asset->reference_count++;
+    return asset;
+  }
+
+  asset = assets_add(manager, type, filename);
+  asset->reference_count++;
+  int head =
+      atomic_load_explicit(&manager->request_head, memory_order_relaxed);
+  int tail =
+      atomic_load_explicit(&manager->request_tail, memory_order_acquire);
+  if (head - tail == ASSETS_MAX_PENDING_REQUESTS) {
+    assets_load(manager, asset, 0, manager->thread_pool);
+    return asset;
+  }
+  manager->requests[head % ASSETS_MAX_PENDING_REQUESTS] = asset;
+  atomic_store_explicit(&manager->request_head, head + 1,
+                        memory_order_release);
+  sem_post(&manager->request_signal);
+  return asset;
+}
+
+asset_t *assets_request_mesh(asset_manager_t *manager, char *obj_filename) {
+  return assets_request(manager, ASSET_MESH, obj_filename);
+}
+
+asset_t *assets_request_texture(asset_manager_t *manager,
+                                char *texture_filename) {
+  return assets_request(manager, ASSET_TEXTURE, texture_filename);
+}
+
+mesh_t *assets_get_mesh(asset_t *asset) {
+  return assets_is_resident(asset) ? &asset->mesh : NULL;
+}
+
+texture_t *assets_get_texture(asset_t *asset) {
+  return assets_is_resident(asset) ? &asset->texture : NULL;
+}
+
+void assets_wait(asset_t *asset) {
+  while (!assets_is_resident(asset))
+    sched_yield();
+}
+
+void assets_update(asset_manager_t *manager) {
+  bool has_streamed_meshes = false;
+  for (int i = 0; i < manager->number_of_assets; ++i) {
+    asset_t *asset = manager->assets[i];
+    if (!assets_is_resident(asset))
+      continue;
+    if (asset->type == ASSET_MESH && asset->mesh.stream)
+      has_streamed_meshes = true;
+    else if (asset->type == ASSET_TEXTURE && asset->texture.virtual_texture)
+      virtual_texture_update(asset->texture.virtual_texture);
+  }
+  if (has_streamed_meshes) {
+    mesh_stream_budget_update(&manager->stream_budget);
+    sem_post(&manager->request_signal);
+  }
+}
+
+/////////////////////////////////////////////////////
+///////////////////// RELEASE ///////////////////////
+/////////////////////////////////////////////////////
+
+void assets_unload(asset_t *asset) {
+  // the streaming thread might still be writing it
+  assets_wait(asset);
+  if (asset->type == ASSET_MESH)
+    free_mesh_data(asset->mesh);
+  else
+    free_texture_data(asset->texture);
+  free(asset->path);
+  free(asset);
+}
+
+void assets_release(asset_manager_t *manager, asset_t *asset) {
+  for (int i = 0; i < manager->number_of_assets; ++i) {
+    if (manager->assets[i] != asset)
+      continue;
+    if (--asset->reference_count > 0)
+      return;
+    assets_unload(asset);
+    manager->assets[i] = manager->assets[--manager->number_of_assets];
+    return;
+  }
+  fprintf(stderr, "Error: Released an asset that is not registered\n");
+  exit(1);
+}
+
+void assets_release_mesh(asset_manager_t *manager, mesh_t *mesh) {
+  for (int i = 0; i < manager->number_of_assets; ++i) {
+    if (&manager->assets[i]->mesh == mesh) {
+      assets_release(manager, manager->assets[i]);
+      return;
+    }
+  }
+  fprintf(stderr, "Error: Released a mesh that is not an asset\n");
+  exit(1);
+}
+
+void assets_release_texture(asset_manager_t *manager, texture_t *texture) {
+  for (int i = 0; i < manager->number_of_assets; ++i) {
+    if (&manager->assets[i]->texture == texture) {
+      assets_release(manager, manager->assets[i]);
+      return;
+    }
+  }
+  fprintf(stderr, "Error: Released a texture that is not an asset\n");
+  exit(1);
+}
+
+size_t assets_resident_bytes(asset_t *asset) {
+  if (!assets_is_resident(asset))
+    return 0;
+  if (asset->type == ASSET_TEXTURE)
+    return asset->texture.mapping && !asset->texture.virtual_texture
+               ? asset->texture.mapping_size
+               : texture_get_size(&asset->texture);
+
+  mesh_t *mesh = &asset->mesh;
+  if (mesh->stream)
+    return mesh_stream_get_size(mesh->stream);
+  if (mesh->mapping)
+    return mesh->mapping_size;
+  size_t bytes = sizeof(vertex_t) * mesh->number_of_vertices;
+  for (int l = 0; l < mesh->number_of_lods; ++l) {
+    bytes += (size_t)mesh->index_size * 3 * mesh->lods[l].number_of_faces;
+    bytes += sizeof(meshlet_t) * mesh->lods[l].number_of_meshlets;
+  }
+  return bytes;
+}
+
+#if USE_DIAGNOSTICS
+void assets_print_memory(asset_manager_t *manager) {
+  size_t total_bytes = 0;
+  for (int i = 0; i < manager->number_of_assets; ++i) {
+    asset_t *asset = manager->assets[i];
+    size_t bytes = assets_resident_bytes(asset);
+    total_bytes += bytes;
+    const char *note = "";
+    if (!assets_is_resident(asset))
+      note = " (loading)";
+    else if (asset->type == ASSET_MESH && asset->mesh.stream)
+      note = " (streamed)";
+    else if (asset->type == ASSET_TEXTURE && asset->texture.virtual_texture)
+      note = " (virtual)";
+    else if (asset->type == ASSET_MESH ? asset->mesh.mapping != NULL
+                                       : asset->texture.mapping != NULL)
+      note = " (mapped)";
+    printf("%-8s %8.1f KB  refs %d  %s%s\n",
+           asset->type == ASSET_MESH ? "mesh" : "texture", bytes / 1024.0,
+           asset->reference_count, asset->path, note);
+  }
+  printf("assets: %d, %.1f KB resident\n", manager->number_of_assets,
+         total_bytes / 1024.0);
+}
+#endif
+
+void assets_free(asset_manager_t *manager) {
+  atomic_store(&manager->is_streaming, false);
+  sem_post(&manager->request_signal);
+  pthread_join(manager->streaming_thread, NULL);
+  sem_destroy(&manager->request_signal);
+
+  for (int i = 0; i < manager->number_of_assets; ++i) {
+    asset_t *asset = manager->assets[i];
+    fprintf(stderr, "Warning: %s is still referenced %d times\n", asset->path,
+            asset->reference_count);
+    assets_unload(asset);
+  }
+  mesh_stream_budget_free(&manager->stream_budget);
+  free(manager->assets);
+  manager->assets = NULL;
+  manager->number_of_assets = 0;
+  manager->capacity = 0;
+}
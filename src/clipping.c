@@ -1,11 +1,97 @@
 #include "clipping.h"
+#include "config.h"
 #include "texture.h"
 #include "utilities.h"
 #include "vector.h"
+#include <math.h>
 #include <stdbool.h>
 
 typedef enum { TOP, BOTTOM, LEFT, RIGHT, NEAR, FAR } clipping_axis;
 
+plane_t plane_new(float nx, float ny, float nz, float distance) {
+  // keep the normal unit length so that the distance to the plane can be
+  // directly compared against a radius
+  float magnitude = sqrtf(nx * nx + ny * ny + nz * nz);
+  plane_t plane = {.normal = {nx / magnitude, ny / magnitude, nz / magnitude},
+                   .distance = distance / magnitude};
+  return plane;
+}
+
+// the plane where row w + sign * row `row` of the projection is 0, a point
+// is inside when the clip space coordinate of the row is within +/- w
+plane_t plane_from_projection_rows(mat4_t *m, int row, float sign) {
+  return plane_new(m->data[3][0] + sign * m->data[row][0],
+                   m->data[3][1] + sign * m->data[row][1],
+                   m->data[3][2] + sign * m->data[row][2],
+                   m->data[3][3] + sign * m->data[row][3]);
+}
+
+frustum_t frustum_from_projection(mat4_t projection_matrix) {
+  // the near and far planes are where the projection really puts them, not
+  // the values it was made from
+  frustum_t frustum = {
+      .planes = {
+          [TOP] = plane_from_projection_rows(&projection_matrix, 1, -1),
+          [BOTTOM] = plane_from_projection_rows(&projection_matrix, 1, 1),
+          [LEFT] = plane_from_projection_rows(&projection_matrix, 0, 1),
+          [RIGHT] = plane_from_projection_rows(&projection_matrix, 0, -1),
+          [NEAR] = plane_from_projection_rows(&projection_matrix, 2, 1),
+          [FAR] = plane_from_projection_rows(&projection_matrix, 2, -1),
+      }};
+  return frustum;
+}
+
+bool frustum_is_sphere_visible(frustum_t *frustum, vec3_t center,
+                               float radius) {
+  for (int i = 0; i < 6; ++i) {
+    plane_t *plane = &frustum->planes[i];
+    float signed_distance = vec3_dot(plane->normal, center) + plane->distance;
+    // the whole sphere is behind one of the planes
+    if (signed_distance < -radius)
+      return false;
+  }
+  return true;
+}
+
+frustum_t frustum_transform(frustum_t *frustum, mat4_t matrix) {
+  frustum_t transformed;
+  for (int i = 0; i < 6; ++i) {
+    plane_t *plane = &frustum->planes[i];
+    vec3_t n = plane->normal;
+    // dot(n, M * p) + d = dot(transpose(M) * n, p) + dot(n, translation) + d
+    float nx = n.x * matrix.data[0][0] + n.y * matrix.data[1][0] +
+               n.z * matrix.data[2][0];
+    float ny = n.x * matrix.data[0][1] + n.y * matrix.data[1][1] +
+               n.z * matrix.data[2][1];
+    float nz = n.x * matrix.data[0][2] + n.y * matrix.data[1][2] +
+               n.z * matrix.data[2][2];
+    float distance = n.x * matrix.data[0][3] + n.y * matrix.data[1][3] +
+                     n.z * matrix.data[2][3] + plane->distance;
+    transformed.planes[i] = plane_new(nx, ny, nz, distance);
+  }
+  return transformed;
+}
+
+box_visibility_t frustum_test_box(frustum_t *frustum, vec3_t box_min,
+                                  vec3_t box_max) {
+  box_visibility_t visibility = BOX_INSIDE;
+  for (int i = 0; i < 6; ++i) {
+    plane_t *plane = &frustum->planes[i];
+    // the corners of the box the furthest along and against the normal
+    vec3_t furthest_inside = {plane->normal.x > 0 ? box_max.x : box_min.x,
+                              plane->normal.y > 0 ? box_max.y : box_min.y,
+                              plane->normal.z > 0 ? box_max.z : box_min.z};
+    vec3_t furthest_outside = {plane->normal.x > 0 ? box_min.x : box_max.x,
+                               plane->normal.y > 0 ? box_min.y : box_max.y,
+                               plane->normal.z > 0 ? box_min.z : box_max.z};
+    if (vec3_dot(plane->normal, furthest_inside) + plane->distance < 0)
+      return BOX_OUTSIDE;
+    if (vec3_dot(plane->normal, furthest_outside) + plane->distance < 0)
+      visibility = BOX_INTERSECTING;
+  }
+  return visibility;
+}
+
 polygon_t create_polygon_from_triangle(triangle_t triangle) {
   polygon_t polygon = {.vertices = {triangle.vertices[0], triangle.vertices[1],
                                     triangle.vertices[2]},
@@ -186,6 +272,63 @@ void clip_polygon(polygon_t *polygon) {
   clip_polygon_against_axis(polygon, FAR);
 }
 
+// bitmask of the side planes[TOP,BOTTOM,LEFT,RIGHT] the vertex is outside of
+int get_side_planes_outcode(vec4_t *v) {
+  int outcode = 0;
+  if (!is_vertex_inside(v, TOP))
+    outcode |= 1 << TOP;
+  if (!is_vertex_inside(v, BOTTOM))
+    outcode |= 1 << BOTTOM;
+  if (!is_vertex_inside(v, LEFT))
+    outcode |= 1 << LEFT;
+  if (!is_vertex_inside(v, RIGHT))
+    outcode |= 1 << RIGHT;
+  return outcode;
+}
+
+// the guard band is the [-w,w] range of the side planes scaled up by
+// GUARD_BAND_SCALE
+bool is_vertex_inside_guard_band(vec4_t *v) {
+  float guard_band_w = v->w * GUARD_BAND_SCALE;
+  return v->x >= -guard_band_w && v->x <= guard_band_w &&
+         v->y >= -guard_band_w && v->y <= guard_band_w;
+}
+
+void clip_polygon_guard_band(polygon_t *polygon) {
+  int common_outcode = ~0;
+  bool is_inside_guard_band = true;
+  for (int i = 0; i < polygon->num_vertices; ++i) {
+    common_outcode &= get_side_planes_outcode(&polygon->vertices[i]);
+    is_inside_guard_band =
+        is_inside_guard_band &&
+        is_vertex_inside_guard_band(&polygon->vertices[i]);
+  }
+
+  // all the vertices are outside of the same side plane so the polygon can
+  // never reach the screen
+  if (common_outcode != 0) {
+    polygon->num_vertices = 0;
+    return;
+  }
+
+  clip_polygon_against_axis(polygon, NEAR);
+#if CLIP_AGAINST_FAR_PLANE
+  clip_polygon_against_axis(polygon, FAR);
+#endif
+
+  // the rasterizer only scissors the bounding box, so vertices that are way
+  // outside the screen would still lose precision in the edge functions.
+  // Those rare polygons still get the full clipping
+  // (clipping against near first keeps the result inside the original
+  // polygon so the guard band check done above still holds)
+  if (!is_inside_guard_band) {
+    clip_polygon_against_axis(polygon, TOP);
+    clip_polygon_against_axis(polygon, BOTTOM);
+    clip_polygon_against_axis(polygon, LEFT);
+    clip_polygon_against_axis(polygon, RIGHT);
+  }
+}
+
 void triangle_from_polygon(polygon_t *polygon, triangle_t *triangles,
                            int *number_of_triangles_from_polygon) {
 
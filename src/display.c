@@ -45,13 +45,19 @@ void display_init(app_state_t *app_state) {
     app_state->is_running = false;
   }
 
-  // Allocate memory space for the color buffer
-  app_state->color_buffer =
-      (uint32_t *)calloc(WINDOW_WIDTH * WINDOW_HEIGHT, sizeof(uint32_t));
+  // Allocate memory space for the color buffers
+  for (int i = 0; i < 2; ++i) {
+    app_state->color_buffers[i] =
+        (uint32_t *)calloc(WINDOW_WIDTH * WINDOW_HEIGHT, sizeof(uint32_t));
+  }
+  app_state->color_buffer = app_state->color_buffers[0];
 
   // allocate memory for the depth buffer
   app_state->z_buffer =
       (float *)malloc(WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(float));
+  app_state->hi_z_blocks =
+      (float *)malloc(HI_Z_BLOCKS_X * HI_Z_BLOCKS_Y * sizeof(float));
+  app_state->hi_z_tiles = (float *)malloc(TILES_X * TILES_Y * sizeof(float));
 }
 
 void display_clear_buffer(app_state_t *app_state, uint32_t color) {
@@ -69,12 +75,42 @@ void display_clear_depth_buffer(app_state_t *app_state) {
   for (int i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; ++i) {
     app_state->z_buffer[i] = 0.0;
   }
+  for (int i = 0; i < HI_Z_BLOCKS_X * HI_Z_BLOCKS_Y; ++i) {
+    app_state->hi_z_blocks[i] = 0.0;
+  }
+  for (int i = 0; i < TILES_X * TILES_Y; ++i) {
+    app_state->hi_z_tiles[i] = 0.0;
+  }
+}
+
+void display_clear_tile(app_state_t *app_state, int tile_id, uint32_t color) {
+  int x_min = (tile_id % TILES_X) * TILE_SIZE;
+  int y_min = (tile_id / TILES_X) * TILE_SIZE;
+  // the last row/column of tiles can hang outside the screen
+  int x_max =
+      x_min + TILE_SIZE < WINDOW_WIDTH ? x_min + TILE_SIZE : WINDOW_WIDTH;
+  int y_max =
+      y_min + TILE_SIZE < WINDOW_HEIGHT ? y_min + TILE_SIZE : WINDOW_HEIGHT;
+  for (int y = y_min; y < y_max; ++y) {
+    for (int x = x_min; x < x_max; ++x) {
+      app_state->color_buffer[y * WINDOW_WIDTH + x] = color;
+      app_state->z_buffer[y * WINDOW_WIDTH + x] = 0.0;
+    }
+  }
+  // the tiles are a multiple of the blocks
+  for (int block_y = y_min / HI_Z_BLOCK_SIZE;
+       block_y < (y_max + HI_Z_BLOCK_SIZE - 1) / HI_Z_BLOCK_SIZE; ++block_y) {
+    for (int block_x = x_min / HI_Z_BLOCK_SIZE;
+         block_x < (x_max + HI_Z_BLOCK_SIZE - 1) / HI_Z_BLOCK_SIZE; ++block_x) {
+      app_state->hi_z_blocks[block_y * HI_Z_BLOCKS_X + block_x] = 0.0;
+    }
+  }
+  app_state->hi_z_tiles[tile_id] = 0.0;
 }
 
-void display_render_buffer(app_state_t *app_state) {
+void display_render_buffer(app_state_t *app_state, uint32_t *color_buffer) {
   // copy the color data from the color buffer to the texture
-  SDL_UpdateTexture(app_state->color_buffer_texture, NULL,
-                    app_state->color_buffer,
+  SDL_UpdateTexture(app_state->color_buffer_texture, NULL, color_buffer,
                     (int)(WINDOW_WIDTH * sizeof(uint32_t)));
 
   // Put the texture data onto the renderer
@@ -87,8 +123,11 @@ void display_render_buffer(app_state_t *app_state) {
 
 void display_cleanup(app_state_t *app_state) {
   // Free Up allocated memory space
-  free(app_state->color_buffer);
+  free(app_state->color_buffers[0]);
+  free(app_state->color_buffers[1]);
   free(app_state->z_buffer);
+  free(app_state->hi_z_blocks);
+  free(app_state->hi_z_tiles);
   SDL_DestroyTexture(app_state->color_buffer_texture);
   SDL_DestroyRenderer(app_state->renderer);
   SDL_DestroyWindow(app_state->window);
@@ -0,0 +1,52 @@
+#include "instance.h"
+#include "appstate.h"
+#include "arena.h"
+#include "config.h"
+#include "matrix.h"
+#include "mesh.h"
+
+instance_t instance_new(mat4_t scale_matrix, mat4_t rotation_matrix,
+                        mat4_t translation_matrix, material_t *material) {
+  instance_t instance = {
+      .model_matrix =
+          mat4_make_model(scale_matrix, rotation_matrix, translation_matrix),
+      .rotation_matrix = rotation_matrix,
+      .material = material,
+      .lod = 0};
+  return instance;
+}
+
+void instance_draw(mesh_t *mesh, instance_t *instance,
+                   triangle_arena_t *triangle_arena, render_stats_t *stats,
+                   mat4_t view_matrix, mat4_t projection_matrix,
+                   frustum_t *frustum) {
+  instance->draw_call =
+      (draw_call_t){.material = instance->material,
+                    .triangle_arena = triangle_arena,
+                    .first_triangle = triangle_arena->count,
+                    .triangle_count = 0,
+                    .depth = mesh_get_nearest_depth(
+                        mesh, instance->model_matrix, view_matrix)};
+
+  // only if some part of the instance can end up on the screen
+  if (!mesh_is_inside_frustum(mesh, instance->model_matrix, view_matrix,
+                              frustum)) {
+    stats->culled_draws++;
+    return;
+  }
+
+  instance->lod = mesh_select_lod(mesh, instance->lod, instance->model_matrix,
+                                  view_matrix, projection_matrix);
+  mesh_apply_transform_view_projection(
+      mesh, instance->lod, triangle_arena, instance->model_matrix,
+      instance->rotation_matrix, view_matrix, projection_matrix, frustum, stats,
+      false);
+
+  instance->draw_call.triangle_count =
+      triangle_arena->count - instance->draw_call.first_triangle;
+#if USE_TRIANGLE_DEPTH_SORTING
+  triangle_arena_sort_by_depth(triangle_arena,
+                               instance->draw_call.first_triangle,
+                               instance->draw_call.triangle_count);
+#endif
+}
@@ -372,8 +372,8 @@ uint32_t light_pbr(light_t lights[], int total_lights_in_scene,
   vec2_t uv_radiance =
       uv_from_surface_normal(reflected_view_vector, radiance_texture_data);
   //  Get the irradiance value from the irradiance texture cubemap
-  uint32_t radiance = radiance_texture_data->data[(
-      int)(uv_radiance.x + (uv_radiance.y * radiance_texture_data->width))];
+  uint32_t radiance = texture_fetch(radiance_texture_data, (int)uv_radiance.x,
+                                    (int)uv_radiance.y, 0);
   // convert the irradiance to its appropriate seperate channels in the [0,1]
   // range
   float radiance_r = ((radiance >> 16) & 0xFF) / 255.0;
@@ -399,8 +399,7 @@ uint32_t light_pbr(light_t lights[], int total_lights_in_scene,
   // The V coordinate stores the bias values based on Roughness
   int LUT_v = (int)((1.0 - ALPHA) * (LUT_texture_data->height - 1));
 
-  uint32_t LUT_value =
-      LUT_texture_data->data[LUT_u + (LUT_v * LUT_texture_data->width)];
+  uint32_t LUT_value = texture_fetch(LUT_texture_data, LUT_u, LUT_v, 0);
 
   // Extract the scale(Red_channel) and bias(Green_channel) in the range[0,1]
   float scale = ((LUT_value >> 16) & 0xFF) / 255.0;
@@ -414,10 +413,8 @@ uint32_t light_pbr(light_t lights[], int total_lights_in_scene,
   vec2_t uv_irradiance =
       uv_from_surface_normal(surface_normal, irradiance_texture_data);
   //  Get the irradiance value from the irradiance texture cubemap
-  uint32_t irradiance =
-      irradiance_texture_data
-          ->data[(int)(uv_irradiance.x +
-                       (uv_irradiance.y * irradiance_texture_data->width))];
+  uint32_t irradiance = texture_fetch(
+      irradiance_texture_data, (int)uv_irradiance.x, (int)uv_irradiance.y, 0);
   // convert the irradiance to its appropriate seperate channels in the [0,1]
   // range
   float irradiance_r = ((irradiance >> 16) & 0xFF) / 255.0;
@@ -1,10 +1,13 @@
 #include "appstate.h"
+#include "arena.h"
+#include "assets.h"
 #include "camera.h"
 #include "config.h"
 #include "display.h"
 #include "lights.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "scene.h"
 #include "texture.h"
 #include "threads.h"
 #include "triangle.h"
@@ -17,6 +20,7 @@
 #include <SDL_stdinc.h>
 #include <SDL_timer.h>
 #include <bits/pthreadtypes.h>
+#include <float.h>
 #include <math.h>
 #include <semaphore.h>
 #include <stdatomic.h>
@@ -35,6 +39,8 @@ void update(app_state_t *app_state);
 void render(app_state_t *app_state);
 void render_with_threads(app_state_t *app_state);
 void cleanup(app_state_t *app_state);
+void bind_streamed_assets(void);
+void update_assets(void);
 
 //////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////
@@ -75,30 +81,65 @@ int main(void) {
 /////////////////////////////////////////////////////////////////////////////////////
 
 // THREADS are declared here
-pthread_t *thread_pool;  // an array of thread with an array size == no of cores
-                         // in the system
-thread_t *thread_data;   // data to be passed to each thread in the pool
-atomic_int tile_counter; // a global storage of all the tile ID's
-sem_t *start_signals;    // array of semaphore to signal to start the
-                         // work[decerements a value ifnot zero]
-sem_t *done_signals; // array of semaphore to signal that a thread has done its
-                     // work[incrementsthe value]
-bool is_main_thread_running;
-
+thread_pool_t thread_pool; // one thread per core in the system
+
+// Everything a frame needs from its geometry stage till its tiles are drawn,
+// the geometry of the next frame is built into one while the threads still
+// draw the tiles of the other
+typedef struct {
+  // Post-clip triangles of all the draws in the frame and the draws themselves
+  triangle_arena_t triangle_arena;
+  draw_list_t draw_list;
+  // instanced draws are transformed in parallel, each thread gets its own
+  // arena
+  triangle_arena_t *thread_triangle_arenas;
+  // the lights the tiles are shaded with
+  light_t lights[MAX_NUMBER_OF_LIGHTS];
+  int total_lights_in_scene;
+  scene_info_t scene_info;
+  tile_job_t tile_job; // what the threads need to render the tiles
+  // what the geometry stage skipped, shown once the tiles are drawn
+  render_stats_t stats;
+} frame_t;
+
+frame_t frames[2];
+// the frame the next geometry stage is built into
+int frame_index = 0;
+// the tiles of the frame before, drawn while the geometry of this one is built
+job_t tile_render_job;
+threads_counter_t tile_render_counter;
+// the frame before was drawn but is not shown yet
+bool is_frame_pending = false;
+render_stats_t *thread_stats;
+
+// every mesh and texture is loaded once and shared through here, they are
+// streamed in the background and bound the first frame they are resident
+asset_manager_t assets;
+bool are_assets_resident = false;
+// stands in for the textures that are still streaming
+uint32_t placeholder_texel = 0xFF808080;
+texture_t placeholder_texture = {
+    .width = 1,
+    .height = 1,
+    .no_of_channels = 4,
+    .format = TEXTURE_FORMAT_RGBA8,
+    .mips = {{.width = 1, .height = 1, .data = &placeholder_texel}},
+    .number_of_mips = 1};
 // 3D Mesh
-mesh_t mesh;
-triangle_t *triangles_to_render;
-int triangles_to_render_count = 0;
+asset_t *mesh_asset;
+asset_t *mesh_texture_asset;
+// all the objects that get drawn with the meshes
+scene_t scene;
+int mesh_object;
 // SkyBox
-mesh_t skybox;
-triangle_t *triangles_to_render_in_skybox;
-int triangles_to_render_in_skybox_count = 0;
-// Radiance Cubemap Mesh
-mesh_t radiance_cubemap_mesh;
-// Irradiance Cubemap Mesh
-mesh_t irradiance_cubemap_mesh;
+asset_t *skybox_asset;
+asset_t *skybox_texture_asset;
+// Radiance Cubemap
+asset_t *radiance_asset;
+// Irradiance Cubemap
+asset_t *irradiance_asset;
 // LUT texture data
-texture_t LUT_texture_data;
+asset_t *LUT_asset;
 // Base material
 material_t base_material;
 // skybox material
@@ -126,8 +167,8 @@ const float near = 0.01;
 const float far = 1000.0;
 const float aspect_ratio = (float)WINDOW_WIDTH / WINDOW_HEIGHT;
 
-// Scene Info Initializer
-scene_info_t scene_info;
+// View Frustum used to cull whole meshes
+frustum_t view_frustum;
 //////////////////////////////////////////////////////////////////////////////////////
 
 void setup(app_state_t *app_state) {
@@ -135,73 +176,93 @@ void setup(app_state_t *app_state) {
   app_state->previous_frame_time = 0.0;
   app_state->delta_time = 0.0;
 
+  // initialize and start the threads
+  threads_initialize(&thread_pool);
+
   //////////////////////////////////////////////////////////////////
+  // everything is only requested here, the first frames are drawn while the
+  // streaming thread loads it
   // load_cube_mesh_data();
-  mesh = load_mesh_obj("../assets/register.obj", "../assets/register.png");
-  triangles_to_render = malloc(sizeof(triangle_t) * mesh.number_of_faces);
+  assets_init(&assets, &thread_pool);
+  mesh_asset = assets_request_mesh(&assets, "../assets/register.obj");
+  mesh_texture_asset =
+      assets_request_texture(&assets, "../assets/register.png");
 
   // load the skybox
-  skybox = load_mesh_obj("../assets/skybox.obj", "../assets/club_cubemap.png");
-  triangles_to_render_in_skybox =
-      malloc(sizeof(triangle_t) * skybox.number_of_faces);
+  skybox_asset = assets_request_mesh(&assets, "../assets/skybox.obj");
+  skybox_texture_asset =
+      assets_request_texture(&assets, "../assets/club_cubemap.png");
 
   // Load the LUT texture data
-  LUT_texture_data = load_texture_data("../assets/IBL/club_r/LUT.png");
+  LUT_asset = assets_request_texture(&assets, "../assets/IBL/club_r/LUT.png");
 
   // Load the Radiance Map
   // Load it based on the roughness level
   // extremely metal  then rougness level is 0
   // and the other way around will be a blurred at level[what ever max level you
   // have]
-  radiance_cubemap_mesh =
-      load_mesh_obj("../assets/skybox.obj",
-                    "../assets/IBL/club_r/club_radiance_map_level_0.png");
+  radiance_asset = assets_request_texture(
+      &assets, "../assets/IBL/club_r/club_radiance_map_level_0.png");
 
   // Load the Irradiance Map
-  irradiance_cubemap_mesh =
-      load_mesh_obj("../assets/skybox.obj",
-                    "../assets/IBL/club_ir/club_irradiance_cubemap.png");
-
-  // Update the base material with the texture and triangle information
-  base_material.triangles_to_render = triangles_to_render;
-  base_material.triangles_to_render_count = &triangles_to_render_count;
-  base_material.base_texture_data = &mesh.texture_data;
-  base_material.radiance_texture_data = &radiance_cubemap_mesh.texture_data;
-  base_material.irradiance_texture_data = &irradiance_cubemap_mesh.texture_data;
-  base_material.LUT_texture_data = &LUT_texture_data;
+  irradiance_asset = assets_request_texture(
+      &assets, "../assets/IBL/club_ir/club_irradiance_cubemap.png");
+
+  // the textures are bound by bind_streamed_assets once they are resident
+  base_material.base_texture_data = &placeholder_texture;
+  base_material.radiance_texture_data = &placeholder_texture;
+  base_material.irradiance_texture_data = &placeholder_texture;
+  base_material.LUT_texture_data = &placeholder_texture;
   base_material.is_PBR = true;
 
   // Do the same for the skybox material
-  skybox_material.triangles_to_render = triangles_to_render_in_skybox;
-  skybox_material.triangles_to_render_count =
-      &triangles_to_render_in_skybox_count;
-  skybox_material.base_texture_data = &skybox.texture_data;
+  skybox_material.base_texture_data = &placeholder_texture;
   skybox_material.radiance_texture_data = NULL;
   skybox_material.irradiance_texture_data = NULL;
   skybox_material.LUT_texture_data = NULL;
   skybox_material.is_PBR = false;
 
+  // the mesh joins the scene once it is resident
+  scene_init(&scene, 1);
+  mesh_object = -1;
+
   // load the lights in the scene
   init_lights_in_scene(lights, &total_lights_in_scene);
 
   // load the base camera
   camera = create_base_camera();
+  view_frustum = frustum_from_projection(
+      mat4_make_perspective(fov_vertical, aspect_ratio, near, far));
 
   display_init(app_state);
 
   // disable the visual of mouse cursor
   SDL_SetRelativeMouseMode(SDL_TRUE);
 
-  // intialize scene information
-  scene_info.lights = lights;
-  scene_info.total_lights_in_scene = &total_lights_in_scene;
-  scene_info.camera_position = &camera_position_at_view_space;
+  // per frame and per thread storage of the rendering, the meshes are not
+  // loaded yet so the arenas grow once they are
+  thread_stats = malloc(sizeof(render_stats_t) * thread_pool.number_of_threads);
+  for (int f = 0; f < 2; ++f) {
+    frame_t *frame = &frames[f];
+    triangle_arena_init(&frame->triangle_arena,
+                        TRIANGLE_ARENA_INITIAL_CAPACITY);
+    draw_list_init(&frame->draw_list, 2);
+    frame->thread_triangle_arenas =
+        malloc(sizeof(triangle_arena_t) * thread_pool.number_of_threads);
+    for (int t = 0; t < thread_pool.number_of_threads; ++t) {
+      triangle_arena_init(&frame->thread_triangle_arenas[t],
+                          TRIANGLE_ARENA_INITIAL_CAPACITY);
+    }
 
-  // initialize and start the threads
-  is_main_thread_running = true;
-  threads_initialize(app_state, &thread_pool, &thread_data, &start_signals,
-                     &done_signals, &tile_counter, &is_main_thread_running,
-                     &base_material, &skybox_material, &scene_info);
+    // intialize scene information
+    frame->scene_info =
+        (scene_info_t){.lights = frame->lights,
+                       .total_lights_in_scene = &frame->total_lights_in_scene,
+                       .camera_position = &camera_position_at_view_space};
+    frame->tile_job = (tile_job_t){.app_state = app_state,
+                                   .draw_list = &frame->draw_list,
+                                   .scene_info = &frame->scene_info};
+  }
 }
 
 void process_input(app_state_t *app_state) {
@@ -250,11 +311,60 @@ void process_input(app_state_t *app_state) {
   }
 }
 
+// binds the texture once it is resident, the placeholder till then
+void bind_texture(texture_t **binding, asset_t *asset) {
+  texture_t *texture = assets_get_texture(asset);
+  *binding = texture ? texture : &placeholder_texture;
+}
+
+// hooks up whatever the streaming thread finished since the last frame
+void bind_streamed_assets(void) {
+  if (are_assets_resident)
+    return;
+
+  mesh_t *mesh = assets_get_mesh(mesh_asset);
+  if (mesh_object == -1 && mesh)
+    mesh_object =
+        scene_add_object(&scene, mesh, &base_material, mat4_make_identity(),
+                         mat4_make_identity(), mat4_make_identity());
+  bind_texture(&base_material.base_texture_data, mesh_texture_asset);
+  bind_texture(&base_material.radiance_texture_data, radiance_asset);
+  bind_texture(&base_material.irradiance_texture_data, irradiance_asset);
+  bind_texture(&base_material.LUT_texture_data, LUT_asset);
+  bind_texture(&skybox_material.base_texture_data, skybox_texture_asset);
+
+  are_assets_resident =
+      mesh_object != -1 && assets_get_mesh(skybox_asset) &&
+      assets_get_texture(mesh_texture_asset) &&
+      assets_get_texture(radiance_asset) &&
+      assets_get_texture(irradiance_asset) && assets_get_texture(LUT_asset) &&
+      assets_get_texture(skybox_texture_asset);
+#if USE_DIAGNOSTICS
+  if (are_assets_resident)
+    assets_print_memory(&assets);
+#endif
+}
+
+// Everything the tiles read besides the frame itself changes here, while no
+// tile is drawn: the streamed assets are bound and the pages the last frame
+// sampled are streamed in
+void update_assets(void) {
+  bind_streamed_assets();
+  assets_update(&assets);
+}
+
 void update(app_state_t *app_state) {
+  // the tiles of the frame before might still be drawn from the other frame
+  frame_t *frame = &frames[frame_index];
+
   /////////////////////////////////////////////////////////////
-  // reset triangles to render count
-  triangles_to_render_count = 0;
-  triangles_to_render_in_skybox_count = 0;
+  // reset the triangles and draws of the frame this one was built into last
+  triangle_arena_reset(&frame->triangle_arena);
+  for (int t = 0; t < thread_pool.number_of_threads; ++t) {
+    triangle_arena_reset(&frame->thread_triangle_arenas[t]);
+  }
+  draw_list_reset(&frame->draw_list);
+  frame->stats = (render_stats_t){0};
 
   // Create a Rotation Matrix for rotation around Y-Axis
   rotation_Y += 0.5 * app_state->delta_time;
@@ -302,72 +412,119 @@ void update(app_state_t *app_state) {
         vec3_from_vec4(mat4_mul_vec4(view_matrix, light_pos));
     view_space_lights[l].color = lights[l].color;
   }
-
-  // loop through all the faces/triangles
-  mesh_apply_transform_view_projection(&mesh, triangles_to_render,
-                                       &triangles_to_render_count, scale_matrix,
-                                       rotation_matrix, translation_matrix,
-                                       view_matrix, perspective_matrix, false);
+  // the tiles shade with their own copy
+  for (int l = 0; l < total_lights_in_scene; ++l) {
+    frame->lights[l] = lights[l];
+  }
+  frame->total_lights_in_scene = total_lights_in_scene;
+
+  // the mesh moves every frame, the scene refits its BVH around it
+  if (mesh_object != -1)
+    scene_set_object_transform(&scene, mesh_object, scale_matrix,
+                               rotation_matrix, translation_matrix);
+
+  // loop through all the faces/triangles of the objects that can end up on
+  // the screen
+  scene_draw(&scene, &thread_pool, frame->thread_triangle_arenas, thread_stats,
+             &frame->draw_list, view_matrix, perspective_matrix, &view_frustum,
+             &frame->stats);
   ///////////////////////////////////////////////////////////////////////////////
-  mesh_apply_transform_view_projection(
-      &skybox, triangles_to_render_in_skybox,
-      &triangles_to_render_in_skybox_count, scale_matrix_for_camera,
-      rotation_matrix_for_camera, translation_matrix_to_camera_position,
-      view_matrix, perspective_matrix, true);
+  // the skybox is always around the camera so it is never culled
+  mesh_t *skybox = assets_get_mesh(skybox_asset);
+  if (skybox) {
+    int first_skybox_triangle = frame->triangle_arena.count;
+    mesh_apply_transform_view_projection(
+        skybox, 0, &frame->triangle_arena,
+        mat4_make_model(scale_matrix_for_camera, rotation_matrix_for_camera,
+                        translation_matrix_to_camera_position),
+        rotation_matrix_for_camera, view_matrix, perspective_matrix,
+        &view_frustum, &frame->stats, true);
+    // it is behind everything else so it always goes last
+    draw_list_add(&frame->draw_list, &skybox_material, &frame->triangle_arena,
+                  first_skybox_triangle,
+                  frame->triangle_arena.count - first_skybox_triangle, FLT_MAX);
+  }
+#if USE_FRONT_TO_BACK_SORTING
+  draw_list_sort_by_depth(&frame->draw_list);
+#endif
   //////////////////////////////////////////////////////////////////////////////
 }
 
 void render(app_state_t *app_state) {
+  frame_t *frame = &frames[frame_index];
+  update_assets();
+  app_state->color_buffer = app_state->color_buffers[frame_index];
+
   display_clear_buffer(app_state, 0xFF000000);
   display_clear_depth_buffer(app_state);
   ////////////////////////////////////////////////////////////
-  //////////// Draw the Mesh /////////////////////////////////
+  //////////// Draw the Mesh and then the SkyBox /////////////
   ////////////////////////////////////////////////////////////
-  for (int i = 0; i < triangles_to_render_count; ++i) {
-    draw_triangle_fill_with_lighting_effect(
-        triangles_to_render[i], &base_material, &scene_info, app_state);
-  }
-
-  ////////////////////////////////////////////////////////////
-  //////////// Draw the SkyBox /////////////////////////////////
-  ////////////////////////////////////////////////////////////
-
-  for (int i = 0; i < triangles_to_render_in_skybox_count; ++i) {
-    draw_triangle_fill_with_lighting_effect(triangles_to_render_in_skybox[i],
-                                            &skybox_material, &scene_info,
-                                            app_state);
+  draw_list_t *draw_list = &frame->draw_list;
+  for (int d = 0; d < draw_list->count; ++d) {
+    draw_call_t *draw_call = &draw_list->draw_calls[d];
+    for (int i = 0; i < draw_call->triangle_count; ++i) {
+      draw_triangle_fill_with_lighting_effect(
+          draw_call->triangle_arena->triangles[draw_call->first_triangle + i],
+          draw_call->material, &frame->scene_info, app_state);
+    }
   }
   /////////////////////////////////////////
   //////////////////////
 
-  display_render_buffer(app_state);
+  display_render_buffer(app_state, app_state->color_buffer);
+  app_state->stats = frame->stats;
+  frame_index = 1 - frame_index;
 }
 
 void render_with_threads(app_state_t *app_state) {
-  display_clear_buffer(app_state, 0xFF000000);
-  display_clear_depth_buffer(app_state);
-  int total_no_of_cores_in_the_system = sysconf(_SC_NPROCESSORS_ONLN);
-
-  // Reset the tile counter each Frame
-  atomic_store(&tile_counter, 0);
-
-  // Wake up the threads
-  for (int i = 0; i < total_no_of_cores_in_the_system; ++i)
-    sem_post(&start_signals[i]);
-
-  // Wait for the threads to finish
-  for (int i = 0; i < total_no_of_cores_in_the_system; ++i)
-    sem_wait(&done_signals[i]);
-
-  display_render_buffer(app_state);
+  frame_t *frame = &frames[frame_index];
+  // the tiles of the frame before were drawn while the geometry of this one
+  // was built
+  threads_wait(&thread_pool, &tile_render_counter);
+  // the stats are only handed out once the tiles of their frame are done
+  app_state->stats = frames[1 - frame_index].stats;
+  update_assets();
+
+  // one job index per tile, every tile clears itself before it is drawn
+  app_state->color_buffer = app_state->color_buffers[frame_index];
+  threads_submit(&thread_pool, &tile_render_job, thread_render_tile,
+                 &frame->tile_job, TILES_X * TILES_Y, &tile_render_counter);
+
+#if USE_FRAME_PIPELINING
+  // the frame before is shown while the threads draw this one
+  if (is_frame_pending)
+    display_render_buffer(app_state, app_state->color_buffers[1 - frame_index]);
+  is_frame_pending = true;
+#else
+  threads_wait(&thread_pool, &tile_render_counter);
+  display_render_buffer(app_state, app_state->color_buffer);
+#endif
+  frame_index = 1 - frame_index;
 }
 
 void cleanup(app_state_t *app_state) {
-  threads_cleanup(thread_pool, thread_data, start_signals, done_signals);
-  free(triangles_to_render);
-  free(triangles_to_render_in_skybox);
-  free_mesh_data(mesh);
-  free_mesh_data(skybox);
-  free_mesh_data(irradiance_cubemap_mesh);
+  // the last frame might still be drawn
+  threads_wait(&thread_pool, &tile_render_counter);
+  free(thread_stats);
+  for (int f = 0; f < 2; ++f) {
+    for (int t = 0; t < thread_pool.number_of_threads; ++t) {
+      triangle_arena_free(&frames[f].thread_triangle_arenas[t]);
+    }
+    free(frames[f].thread_triangle_arenas);
+    triangle_arena_free(&frames[f].triangle_arena);
+    draw_list_free(&frames[f].draw_list);
+  }
+  scene_free(&scene);
+  assets_release(&assets, mesh_asset);
+  assets_release(&assets, mesh_texture_asset);
+  assets_release(&assets, skybox_asset);
+  assets_release(&assets, skybox_texture_asset);
+  assets_release(&assets, radiance_asset);
+  assets_release(&assets, irradiance_asset);
+  assets_release(&assets, LUT_asset);
+  // the streaming thread parses on the pool till it is stopped
+  assets_free(&assets);
+  threads_cleanup(&thread_pool);
   display_cleanup(app_state);
 }
@@ -119,6 +119,53 @@ mat4_t mat4_make_perspective(float fov, float aspect_ratio, float near,
   return m;
 }
 
+/////////////////////////////////////////////////////////////////
+/////////////////////  MODEL MATRIX /////////////////////////////
+// Scale first, then Rotate and finally Translate
+mat4_t mat4_make_model(mat4_t scale_matrix, mat4_t rotation_matrix,
+                       mat4_t translation_matrix) {
+  return mat4_mul_mat4(translation_matrix,
+                       mat4_mul_mat4(rotation_matrix, scale_matrix));
+}
+
+// the largest scale applied on any of the axes[length of the basis vectors]
+// used to grow bounding spheres along with the model
+float mat4_get_max_scale(mat4_t m) {
+  float max_scale_squared = 0.0;
+  for (int j = 0; j < 3; ++j) {
+    float scale_squared = m.data[0][j] * m.data[0][j] +
+                          m.data[1][j] * m.data[1][j] +
+                          m.data[2][j] * m.data[2][j];
+    if (scale_squared > max_scale_squared)
+      max_scale_squared = scale_squared;
+  }
+  return sqrtf(max_scale_squared);
+}
+
+// true when the matrix is only made up of rotations, translations and a
+// uniform positive scale, which keeps the angles between directions the
+// same(needed for the normal cones to be transformed like a direction)
+bool mat4_preserves_angles(mat4_t m) {
+  float scale_x = m.data[0][0] * m.data[0][0] + m.data[1][0] * m.data[1][0] +
+                  m.data[2][0] * m.data[2][0];
+  float scale_y = m.data[0][1] * m.data[0][1] + m.data[1][1] * m.data[1][1] +
+                  m.data[2][1] * m.data[2][1];
+  float scale_z = m.data[0][2] * m.data[0][2] + m.data[1][2] * m.data[1][2] +
+                  m.data[2][2] * m.data[2][2];
+  float tolerance = 1e-3 * scale_x;
+  if (fabsf(scale_x - scale_y) > tolerance ||
+      fabsf(scale_x - scale_z) > tolerance)
+    return false;
+
+  // a negative determinant mirrors the model which flips the winding
+  float minor_x = m.data[1][1] * m.data[2][2] - m.data[1][2] * m.data[2][1];
+  float minor_y = m.data[1][0] * m.data[2][2] - m.data[1][2] * m.data[2][0];
+  float minor_z = m.data[1][0] * m.data[2][1] - m.data[1][1] * m.data[2][0];
+  float determinant = m.data[0][0] * minor_x - m.data[0][1] * minor_y +
+                      m.data[0][2] * minor_z;
+  return determinant > 0;
+}
+
 //////////////////////////////////////////////////////////////////////
 ///////////////////// MATRIX MATHS //////////////////////////////////
 /////////////////////////////////////////////////////////////////////
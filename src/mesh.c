@@ -1,250 +1,634 @@
 #include "mesh.h"
+#include "arena.h"
 #include "clipping.h"
 #include "config.h"
-#include "stb_image.h"
+#include "mesh_cache.h"
+#include "mesh_stream.h"
+#include "obj.h"
+#include "simplify.h"
 #include "texture.h"
 #include "triangle.h"
+#include "utilities.h"
 #include "vector.h"
+#include "vertex_cache.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 void free_mesh_data(mesh_t mesh) {
-  free(mesh.vertices);
-  free(mesh.normals);
-  free(mesh.tex_coords);
-  free(mesh.faces);
-  stbi_image_free(mesh.texture_data.data);
+  if (mesh.stream)
+    mesh_stream_free(mesh.stream);
+  if (mesh.mapping) {
+    munmap(mesh.mapping, mesh.mapping_size);
+  } else {
+    free(mesh.vertices);
+    for (int l = 0; l < mesh.number_of_lods; ++l) {
+      free(mesh.lods[l].indices);
+      free(mesh.lods[l].meshlets);
+    }
+  }
 }
 
-mesh_t load_mesh_obj(char *obj_filename, char *texture_filename) {
-  mesh_t mesh = {0};
+void mesh_compute_bounds(mesh_t *mesh, vec3_t *positions,
+                         int number_of_positions) {
+  if (number_of_positions == 0)
+    return;
+
+  // Axis Aligned Bounding Box
+  vec3_t box_min = positions[0];
+  vec3_t box_max = positions[0];
+  for (int i = 1; i < number_of_positions; ++i) {
+    vec3_t v = positions[i];
+    box_min = vec3_new(min(box_min.x, v.x), min(box_min.y, v.y),
+                       min(box_min.z, v.z));
+    box_max = vec3_new(max(box_max.x, v.x), max(box_max.y, v.y),
+                       max(box_max.z, v.z));
+  }
+  mesh->bounding_box_min = box_min;
+  mesh->bounding_box_max = box_max;
+
+  // the sphere is centered on the box but its radius is taken from the
+  // farthest vertex which is tighter than half the box diagonal
+  vec3_t center = vec3_add(box_min, box_max);
+  vec3_mul(&center, 0.5);
+  float max_distance_squared = 0.0;
+  for (int i = 0; i < number_of_positions; ++i) {
+    vec3_t d = vec3_sub(positions[i], center);
+    max_distance_squared = max(max_distance_squared, vec3_dot(d, d));
+  }
+  mesh->bounding_sphere_center = center;
+  mesh->bounding_sphere_radius = sqrtf(max_distance_squared);
+}
 
-  FILE *file_pointer = fopen(obj_filename, "r");
-  if (!file_pointer) {
-    fprintf(stderr, "Error: Could nor open file: %s\n", obj_filename);
-    exit(1);
+// builds the coarser levels of detail out of the full detail
+// faces(lod_faces[0]) and groups the faces of every level into meshlets.
+// The faces of every level are left in lod_faces
+void mesh_build_lods(mesh_t *mesh, vec3_t *positions, int number_of_positions,
+                     face_t **lod_faces) {
+  simplified_level_t levels[MESH_MAX_LODS - 1];
+  int number_of_levels = simplify_build_levels(
+      positions, number_of_positions, lod_faces[0],
+      mesh->lods[0].number_of_faces, MESH_LOD_REDUCTION, MESH_MAX_LODS - 1,
+      levels);
+
+  for (int l = 0; l < number_of_levels; ++l) {
+    lod_faces[l + 1] = levels[l].faces;
+    mesh->lods[l + 1] =
+        (mesh_lod_t){.number_of_faces = levels[l].number_of_faces,
+                     .error = levels[l].error};
+  }
+  mesh->number_of_lods = number_of_levels + 1;
+
+  for (int l = 0; l < mesh->number_of_lods; ++l) {
+    mesh_lod_t *level = &mesh->lods[l];
+    level->number_of_meshlets =
+        meshlets_build(positions, number_of_positions, lod_faces[l],
+                       level->number_of_faces, &level->meshlets);
+#if USE_VERTEX_CACHE_OPTIMIZATION
+#if USE_DIAGNOSTICS
+    // grouping into meshlets throws the order of the file away, so that is
+    // what the optimization has to be measured against
+    float acmr_meshlets = vertex_cache_acmr(
+        lod_faces[l], level->number_of_faces, number_of_positions);
+#endif
+    vertex_cache_optimize_meshlets(lod_faces[l], number_of_positions,
+                                   level->meshlets, level->number_of_meshlets);
+#if USE_DIAGNOSTICS
+    if (l == 0)
+      printf("  ACMR %.3f in meshlet order -> %.3f optimized\n", acmr_meshlets,
+             vertex_cache_acmr(lod_faces[l], level->number_of_faces,
+                               number_of_positions));
+#endif
+#endif
   }
+}
 
-  char line[1024];
+#if USE_QUANTIZED_VERTICES
+// value in [offset, offset + 65535 * scale] => 0..65535
+uint16_t mesh_quantize_unorm16(float value, float offset, float scale) {
+  if (scale == 0.0)
+    return 0;
+  float quantized = roundf((value - offset) / scale);
+  return (uint16_t)fminf(fmaxf(quantized, 0.0), 65535.0);
+}
 
-  // loop through the OBJ file line by line
-  // to get the number of vertices and faces
-  int number_of_vertices = 0;
-  int number_of_normals = 0;
-  int number_of_texcoords = 0;
-  int number_of_faces = 0;
-  while (fgets(line, sizeof(line), file_pointer)) {
-    // Parse the vertex line
-    if (strncmp(line, "v ", 2) == 0) {
-      number_of_vertices++;
-    }
-    // Parse the Normal line
-    if (strncmp(line, "vn ", 3) == 0) {
-      number_of_normals++;
-    }
-    // Parse the texture coordinate line
-    if (strncmp(line, "vt ", 3) == 0) {
-      number_of_texcoords++;
-    }
-    // Parse the face line
-    if (strncmp(line, "f ", 2) == 0) {
-      number_of_faces++;
+// the unit sphere is folded onto the octahedron |x|+|y|+|z|=1 and the lower
+// half of it is unfolded over the corners of the square
+void mesh_encode_octahedral(vec3_t n, int16_t encoded[2]) {
+  float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+  float x = sum > 0.0 ? n.x / sum : 0.0;
+  float y = sum > 0.0 ? n.y / sum : 0.0;
+  if (n.z < 0.0) {
+    float folded_x = (1.0 - fabsf(y)) * (x >= 0.0 ? 1.0 : -1.0);
+    float folded_y = (1.0 - fabsf(x)) * (y >= 0.0 ? 1.0 : -1.0);
+    x = folded_x;
+    y = folded_y;
+  }
+  encoded[0] = (int16_t)roundf(fminf(fmaxf(x, -1.0), 1.0) * 32767.0);
+  encoded[1] = (int16_t)roundf(fminf(fmaxf(y, -1.0), 1.0) * 32767.0);
+}
+
+vec3_t mesh_decode_octahedral(int16_t encoded[2]) {
+  vec3_t n = {encoded[0] / 32767.0, encoded[1] / 32767.0, 0.0};
+  n.z = 1.0 - fabsf(n.x) - fabsf(n.y);
+  // unfold the lower half back
+  float t = fmaxf(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  vec3_normalize(&n);
+  return n;
+}
+
+// the quantization ranges: the bounding box for the positions and the
+// bounds of the texture coordinates the faces use
+void mesh_compute_quantization(mesh_t *mesh, tex2_t *tex_coords,
+                               face_t **lod_faces) {
+  vec3_t extent = vec3_sub(mesh->bounding_box_max, mesh->bounding_box_min);
+  mesh->position_offset = mesh->bounding_box_min;
+  mesh->position_scale =
+      vec3_new(extent.x / 65535.0, extent.y / 65535.0, extent.z / 65535.0);
+
+  tex2_t tex_coord_min = {INFINITY, INFINITY};
+  tex2_t tex_coord_max = {-INFINITY, -INFINITY};
+  for (int l = 0; l < mesh->number_of_lods; ++l) {
+    for (int i = 0; i < mesh->lods[l].number_of_faces; ++i) {
+      face_t *face = &lod_faces[l][i];
+      int corners[3] = {face->a_uv, face->b_uv, face->c_uv};
+      for (int j = 0; j < 3; ++j) {
+        tex2_t tex_coord = tex_coords[corners[j]];
+        tex_coord_min.u = fminf(tex_coord_min.u, tex_coord.u);
+        tex_coord_min.v = fminf(tex_coord_min.v, tex_coord.v);
+        tex_coord_max.u = fmaxf(tex_coord_max.u, tex_coord.u);
+        tex_coord_max.v = fmaxf(tex_coord_max.v, tex_coord.v);
+      }
     }
   }
+  if (tex_coord_min.u > tex_coord_max.u)
+    tex_coord_min = tex_coord_max = (tex2_t){0.0, 0.0};
+  mesh->tex_coord_offset = tex_coord_min;
+  mesh->tex_coord_scale =
+      (tex2_t){(tex_coord_max.u - tex_coord_min.u) / 65535.0,
+               (tex_coord_max.v - tex_coord_min.v) / 65535.0};
+}
+#endif
+
+vertex_t mesh_encode_vertex(mesh_t *mesh, vec3_t position, vec3_t normal,
+                            tex2_t tex_coord) {
+#if USE_QUANTIZED_VERTICES
+  vertex_t vertex;
+  vertex.position[0] = mesh_quantize_unorm16(
+      position.x, mesh->position_offset.x, mesh->position_scale.x);
+  vertex.position[1] = mesh_quantize_unorm16(
+      position.y, mesh->position_offset.y, mesh->position_scale.y);
+  vertex.position[2] = mesh_quantize_unorm16(
+      position.z, mesh->position_offset.z, mesh->position_scale.z);
+  mesh_encode_octahedral(normal, vertex.normal);
+  vertex.tex_coord[0] = mesh_quantize_unorm16(
+      tex_coord.u, mesh->tex_coord_offset.u, mesh->tex_coord_scale.u);
+  vertex.tex_coord[1] = mesh_quantize_unorm16(
+      tex_coord.v, mesh->tex_coord_offset.v, mesh->tex_coord_scale.v);
+  return vertex;
+#else
+  return (vertex_t){
+      .position = position, .normal = normal, .tex_coord = tex_coord};
+#endif
+}
+
+vec3_t mesh_get_vertex_position(mesh_t *mesh, vertex_t *vertex) {
+#if USE_QUANTIZED_VERTICES
+  return vec3_new(
+      mesh->position_offset.x + vertex->position[0] * mesh->position_scale.x,
+      mesh->position_offset.y + vertex->position[1] * mesh->position_scale.y,
+      mesh->position_offset.z + vertex->position[2] * mesh->position_scale.z);
+#else
+  return vertex->position;
+#endif
+}
+
+vec3_t mesh_get_vertex_normal(mesh_t *mesh, vertex_t *vertex) {
+#if USE_QUANTIZED_VERTICES
+  return mesh_decode_octahedral(vertex->normal);
+#else
+  return vertex->normal;
+#endif
+}
+
+tex2_t mesh_get_vertex_tex_coord(mesh_t *mesh, vertex_t *vertex) {
+#if USE_QUANTIZED_VERTICES
+  return (tex2_t){
+      mesh->tex_coord_offset.u + vertex->tex_coord[0] * mesh->tex_coord_scale.u,
+      mesh->tex_coord_offset.v +
+          vertex->tex_coord[1] * mesh->tex_coord_scale.v};
+#else
+  return vertex->tex_coord;
+#endif
+}
+
+// Every distinct (position, normal, texture coordinate) tuple the faces use
+// becomes one interleaved vertex, the vertices are numbered in the order the
+// faces(full detail first) first use them so the geometry stage reads them
+// close to linearly. The faces of every level turn into three indices each
+void mesh_build_vertex_buffer(mesh_t *mesh, vec3_t *positions,
+                              vec3_t *normals, tex2_t *tex_coords,
+                              face_t **lod_faces) {
+  size_t number_of_corners = 0;
+  for (int l = 0; l < mesh->number_of_lods; ++l) {
+    number_of_corners += (size_t)mesh->lods[l].number_of_faces * 3;
+  }
 
-  // loop through the OBJ file second time to allocate required
-  // memory space as well as the actual data
-  mesh.vertices = malloc(sizeof(vec3_t) * number_of_vertices);
-  int current_vertex = 0;
-  mesh.normals = malloc(sizeof(vec3_t) * number_of_normals);
-  int current_normal = 0;
-  mesh.tex_coords = malloc(sizeof(tex2_t) * number_of_texcoords);
-  int current_texcoord = 0;
-  mesh.faces = malloc(sizeof(face_t) * number_of_faces);
-  int current_face = 0;
-
-  // Reset the file pointer to the start of the OBJ text file
-  if (fseek(file_pointer, 0, SEEK_SET) != 0) {
-    fprintf(stderr, "ERROR:Failed to reset file pointer\n");
+  // open addressing hash table from a tuple to its vertex, at most half full
+  size_t table_size = 1;
+  while (table_size < number_of_corners * 2)
+    table_size *= 2;
+  int *table = malloc(sizeof(int) * table_size);
+  // the tuple every vertex was made from
+  int *vertex_tuples = malloc(sizeof(int) * 3 * number_of_corners);
+  uint32_t *corner_vertices = malloc(sizeof(uint32_t) * number_of_corners);
+  mesh->vertices = malloc(sizeof(vertex_t) * number_of_corners);
+  if (!table || !vertex_tuples || !corner_vertices || !mesh->vertices) {
+    fprintf(stderr, "Error: Could not allocate the vertex buffer\n");
     exit(1);
   }
+  memset(table, -1, sizeof(int) * table_size);
+#if USE_QUANTIZED_VERTICES
+  mesh_compute_quantization(mesh, tex_coords, lod_faces);
+#endif
 
-  while (fgets(line, sizeof(line), file_pointer)) {
-    // Parse the vertex line
-    if (strncmp(line, "v ", 2) == 0) {
-      vec3_t vertex;
-      sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-      vertex.y *= -1;
-      mesh.vertices[current_vertex++] = vertex;
+  int number_of_vertices = 0;
+  size_t corner = 0;
+  for (int l = 0; l < mesh->number_of_lods; ++l) {
+    for (int i = 0; i < mesh->lods[l].number_of_faces; ++i) {
+      face_t *face = &lod_faces[l][i];
+      int tuples[3][3] = {{face->a, face->a_uv, face->n_a},
+                          {face->b, face->b_uv, face->n_b},
+                          {face->c, face->c_uv, face->n_c}};
+      for (int j = 0; j < 3; ++j) {
+        int *tuple = tuples[j];
+        uint32_t hash = (uint32_t)tuple[0] * 73856093u ^
+                        (uint32_t)tuple[1] * 19349663u ^
+                        (uint32_t)tuple[2] * 83492791u;
+        size_t slot = hash & (table_size - 1);
+        while (table[slot] != -1) {
+          int *existing = &vertex_tuples[(size_t)table[slot] * 3];
+          if (existing[0] == tuple[0] && existing[1] == tuple[1] &&
+              existing[2] == tuple[2])
+            break;
+          slot = (slot + 1) & (table_size - 1);
+        }
+
+        if (table[slot] == -1) {
+          table[slot] = number_of_vertices;
+          memcpy(&vertex_tuples[(size_t)number_of_vertices * 3], tuple,
+                 sizeof(int) * 3);
+          mesh->vertices[number_of_vertices++] =
+              mesh_encode_vertex(mesh, positions[tuple[0]], normals[tuple[2]],
+                                 tex_coords[tuple[1]]);
+        }
+        corner_vertices[corner++] = table[slot];
+      }
     }
-
-    // Parse the normal line
-    if (strncmp(line, "vn ", 3) == 0) {
-      vec3_t normal;
-      sscanf(line, "vn %f %f %f", &normal.x, &normal.y, &normal.z);
-      // normal.y *= -1;
-      mesh.normals[current_normal++] = normal;
+  }
+  mesh->vertices =
+      realloc(mesh->vertices, sizeof(vertex_t) * max(number_of_vertices, 1));
+  mesh->number_of_vertices = number_of_vertices;
+
+  // 16 bit indices whenever they are enough
+  mesh->index_size = number_of_vertices <= 65536 ? 2 : 4;
+  corner = 0;
+  for (int l = 0; l < mesh->number_of_lods; ++l) {
+    mesh_lod_t *level = &mesh->lods[l];
+    int number_of_indices = level->number_of_faces * 3;
+    level->indices = malloc(mesh->index_size * max(number_of_indices, 1));
+    if (!level->indices) {
+      fprintf(stderr, "Error: Could not allocate the indices\n");
+      exit(1);
     }
-
-    // Parse the vertex coordinate line
-    if (strncmp(line, "vt ", 3) == 0) {
-      tex2_t texcoord;
-      sscanf(line, "vt %f %f", &texcoord.u, &texcoord.v);
-      texcoord.v = 1.0 - texcoord.v;
-      mesh.tex_coords[current_texcoord++] = texcoord;
+    for (int i = 0; i < number_of_indices; ++i) {
+      if (mesh->index_size == 2)
+        ((uint16_t *)level->indices)[i] = corner_vertices[corner++];
+      else
+        ((uint32_t *)level->indices)[i] = corner_vertices[corner++];
     }
+  }
 
-    // Parse the face line
-    if (strncmp(line, "f ", 2) == 0) {
-      int vertex_indices[3];
-      int texture_indices[3];
-      int normal_indices[3];
-      sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d", &vertex_indices[0],
-             &texture_indices[0], &normal_indices[0], &vertex_indices[1],
-             &texture_indices[1], &normal_indices[1], &vertex_indices[2],
-             &texture_indices[2], &normal_indices[2]);
-      face_t face = {.a = vertex_indices[0] - 1,
-                     .b = vertex_indices[1] - 1,
-                     .c = vertex_indices[2] - 1,
-                     .n_a = normal_indices[0] - 1,
-                     .n_b = normal_indices[1] - 1,
-                     .n_c = normal_indices[2] - 1,
-                     .a_uv = texture_indices[0] - 1,
-                     .b_uv = texture_indices[1] - 1,
-                     .c_uv = texture_indices[2] - 1,
-                     .color = 0xFFFFFFFF};
-      mesh.faces[current_face++] = face;
+  free(table);
+  free(vertex_tuples);
+  free(corner_vertices);
+}
+
+void mesh_get_face_indices(mesh_t *mesh, mesh_lod_t *level, int face_index,
+                           uint32_t indices[3]) {
+  int first_index = face_index * 3;
+  if (mesh->index_size == 2) {
+    uint16_t *level_indices = (uint16_t *)level->indices;
+    indices[0] = level_indices[first_index];
+    indices[1] = level_indices[first_index + 1];
+    indices[2] = level_indices[first_index + 2];
+  } else {
+    uint32_t *level_indices = (uint32_t *)level->indices;
+    indices[0] = level_indices[first_index];
+    indices[1] = level_indices[first_index + 1];
+    indices[2] = level_indices[first_index + 2];
+  }
+}
+
+// builds the mesh out of the OBJ file
+mesh_t mesh_build_from_obj(char *obj_filename, thread_pool_t *thread_pool) {
+  mesh_t mesh = {0};
+  obj_data_t obj;
+  obj_load(obj_filename, &obj, thread_pool);
+
+  mesh.lods[0] = (mesh_lod_t){.number_of_faces = obj.number_of_faces,
+                               .error = 0.0};
+  mesh.number_of_lods = 1;
+  face_t *lod_faces[MESH_MAX_LODS] = {obj.faces};
+
+  mesh_compute_bounds(&mesh, obj.positions, obj.number_of_positions);
+#if USE_VERTEX_CACHE_OPTIMIZATION && USE_DIAGNOSTICS
+  printf("%s: ACMR %.3f in the file\n", obj_filename,
+         vertex_cache_acmr(obj.faces, obj.number_of_faces,
+                           obj.number_of_positions));
+#endif
+  mesh_build_lods(&mesh, obj.positions, obj.number_of_positions, lod_faces);
+  mesh_build_vertex_buffer(&mesh, obj.positions, obj.normals, obj.tex_coords,
+                           lod_faces);
+
+  // the separate attributes and the faces are only needed while building
+  for (int l = 1; l < mesh.number_of_lods; ++l) {
+    free(lod_faces[l]);
+  }
+  obj_free(&obj);
+  return mesh;
+}
+
+mesh_t load_mesh_obj(char *obj_filename, uint64_t source_hash,
+                     thread_pool_t *thread_pool,
+                     mesh_stream_budget_t *stream_budget) {
+  mesh_t mesh = {0};
+
+#if USE_MESH_CACHE
+  // the mesh is only built from the OBJ file when there is no cache of it
+  // yet or the file changed since the cache was written
+  char *cache_filename = mesh_cache_filename(obj_filename);
+  if (!mesh_cache_load(cache_filename, source_hash, &mesh)) {
+    mesh = mesh_build_from_obj(obj_filename, thread_pool);
+    mesh_cache_save(cache_filename, source_hash, &mesh);
+#if USE_MESH_STREAMING
+    // a streamed mesh pages in from the file, the built arrays would keep all
+    // of it resident
+    mesh_t mapped_mesh = {0};
+    if (mesh_stream_is_needed(&mesh) &&
+        mesh_cache_load(cache_filename, source_hash, &mapped_mesh)) {
+      free_mesh_data(mesh);
+      mesh = mapped_mesh;
     }
+#endif
   }
-  mesh.number_of_faces = number_of_faces;
+  free(cache_filename);
+
+#if USE_MESH_STREAMING
+  // streaming needs the mapping to page in from
+  if (mesh.mapping && mesh_stream_is_needed(&mesh))
+    mesh.stream = mesh_stream_create(&mesh, stream_budget);
+#endif
+#else
+  mesh = mesh_build_from_obj(obj_filename, thread_pool);
+#endif
 
-  // load the texture data
-  mesh.texture_data = load_texture_data(texture_filename);
   return mesh;
 }
 
-void mesh_apply_transform_view_projection(
-    mesh_t *mesh, triangle_t *triangles_to_render,
-    int *triangles_to_render_count, mat4_t scale_matrix, mat4_t rotation_matrix,
-    mat4_t translation_matrix, mat4_t view_matrix, mat4_t projection_matrix,
-    bool is_skybox) {
+bool mesh_is_inside_frustum(mesh_t *mesh, mat4_t model_matrix,
+                            mat4_t view_matrix, frustum_t *frustum) {
+  mat4_t model_view_matrix = mat4_mul_mat4(view_matrix, model_matrix);
 
-  // loop through all the faces/triangles
-  for (int i = 0; i < mesh->number_of_faces; ++i) {
-    triangle_t triangle;
-    // One face is one triangle
-    triangle.vertices[0] = vec4_from_vec3(mesh->vertices[mesh->faces[i].a]);
-    triangle.vertices[1] = vec4_from_vec3(mesh->vertices[mesh->faces[i].b]);
-    triangle.vertices[2] = vec4_from_vec3(mesh->vertices[mesh->faces[i].c]);
-    triangle.normals[0] = mesh->normals[mesh->faces[i].n_a];
-    triangle.normals[1] = mesh->normals[mesh->faces[i].n_b];
-    triangle.normals[2] = mesh->normals[mesh->faces[i].n_c];
-    triangle.texcoords[0] = mesh->tex_coords[mesh->faces[i].a_uv];
-    triangle.texcoords[1] = mesh->tex_coords[mesh->faces[i].b_uv];
-    triangle.texcoords[2] = mesh->tex_coords[mesh->faces[i].c_uv];
-
-    // Transformations
-    for (int j = 0; j < 3; ++j) {
-      vec4_t transformed_points = triangle.vertices[j];
-      vec4_t transformed_normals = vec4_from_vec3(triangle.normals[j]);
+  vec3_t center = vec3_from_vec4(mat4_mul_vec4(
+      model_view_matrix, vec4_from_vec3(mesh->bounding_sphere_center)));
+  float radius =
+      mesh->bounding_sphere_radius * mat4_get_max_scale(model_matrix);
 
-      // Scale
-      transformed_points = mat4_mul_vec4(scale_matrix, transformed_points);
+  return frustum_is_sphere_visible(frustum, center, radius);
+}
 
-      // Rotations
-      transformed_points = mat4_mul_vec4(rotation_matrix, transformed_points);
+// error of a level of detail in pixels, for a mesh whose closest point is
+// `depth` away from the camera
+float mesh_lod_screen_error(mesh_lod_t *level, float depth,
+                            float pixels_per_unit) {
+  return level->error * pixels_per_unit / depth;
+}
 
-      // Also Rotate the normals
-      transformed_normals = mat4_mul_vec4(rotation_matrix, transformed_normals);
+float mesh_get_nearest_depth(mesh_t *mesh, mat4_t model_matrix,
+                             mat4_t view_matrix) {
+  mat4_t model_view_matrix = mat4_mul_mat4(view_matrix, model_matrix);
+  vec3_t center = vec3_from_vec4(mat4_mul_vec4(
+      model_view_matrix, vec4_from_vec3(mesh->bounding_sphere_center)));
+  return center.z -
+         mesh->bounding_sphere_radius * mat4_get_max_scale(model_matrix);
+}
 
-      // Translation
-      transformed_points =
-          mat4_mul_vec4(translation_matrix, transformed_points);
+int mesh_select_lod(mesh_t *mesh, int current_lod, mat4_t model_matrix,
+                    mat4_t view_matrix, mat4_t projection_matrix) {
+  float max_scale = mat4_get_max_scale(model_matrix);
+
+  // measure at the closest point of the bounding sphere so the error is
+  // never underestimated, the camera being inside of it means full detail
+  float depth = mesh_get_nearest_depth(mesh, model_matrix, view_matrix);
+  if (depth <= 0.0)
+    return 0;
+
+  // size of one model space unit on the screen at a depth of 1
+  float pixels_per_unit =
+      max_scale * projection_matrix.data[1][1] * WINDOW_HEIGHT * 0.5;
+
+  int target_lod = 0;
+  for (int l = 1; l < mesh->number_of_lods; ++l) {
+    if (mesh_lod_screen_error(&mesh->lods[l], depth, pixels_per_unit) <=
+        MESH_LOD_MAX_SCREEN_ERROR)
+      target_lod = l;
+  }
 
-      triangle.vertices[j] = transformed_points;
-      triangle.normals[j] = vec3_from_vec4(transformed_normals);
-    }
+  if (current_lod >= mesh->number_of_lods)
+    return target_lod;
+
+  // only go coarser once the coarser level is clearly under the limit and
+  // only go finer once the current level is clearly over it
+  if (target_lod > current_lod &&
+      mesh_lod_screen_error(&mesh->lods[target_lod], depth, pixels_per_unit) >
+          MESH_LOD_MAX_SCREEN_ERROR * (1.0 - MESH_LOD_HYSTERESIS))
+    return current_lod;
+  if (target_lod < current_lod &&
+      mesh_lod_screen_error(&mesh->lods[current_lod], depth,
+                            pixels_per_unit) <=
+          MESH_LOD_MAX_SCREEN_ERROR * (1.0 + MESH_LOD_HYSTERESIS))
+    return current_lod;
+
+  return target_lod;
+}
 
-    // Move the vertices and normals to View Space
-    for (int j = 0; j < 3; ++j) {
-      triangle.vertices[j] = mat4_mul_vec4(view_matrix, triangle.vertices[j]);
+// Model->View->Projection of a single face followed by clipping, the
+// resulting triangles are pushed into the arena
+void mesh_transform_face(mesh_t *mesh, vertex_t *face_vertices[3],
+                         triangle_arena_t *triangle_arena,
+                         mat4_t model_view_matrix, mat4_t normal_matrix,
+                         mat4_t projection_matrix, bool is_skybox) {
+  triangle_t triangle;
+
+  // One face is one triangle
+  // Move the vertices straight to View Space
+  for (int j = 0; j < 3; ++j) {
+    triangle.vertices[j] =
+        mat4_mul_vec4(model_view_matrix,
+                      vec4_from_vec3(mesh_get_vertex_position(
+                          mesh, face_vertices[j])));
+  }
 
-      // store the view space vertices that will be further used for lighting
-      // calculations
-      triangle.view_space_vertices[j] = triangle.vertices[j];
+  // Back face culling
+  // done before anything else is computed for the triangle and only the
+  // sign of the dot product matters so nothing has to be normalized
+  vec3_t vertex_a = vec3_from_vec4(triangle.vertices[0]);
+  vec3_t vertex_b = vec3_from_vec4(triangle.vertices[1]);
+  vec3_t vertex_c = vec3_from_vec4(triangle.vertices[2]);
 
-      vec4_t normal = vec4_from_vec3(triangle.normals[j]);
-      normal.w = 0.0; // this removes translation from the normal as we dont
-                      // want to move normals only rotate them
-      triangle.normals[j] = vec3_from_vec4(mat4_mul_vec4(view_matrix, normal));
-      vec3_normalize(&triangle.normals[j]);
-    }
+  vec3_t ab = vec3_sub(vertex_b, vertex_a);
+  vec3_t ac = vec3_sub(vertex_c, vertex_a);
+  vec3_t normal = vec3_cross(ac, ab);
 
-    // Back face culling
-    vec3_t vertex_a = vec3_from_vec4(triangle.vertices[0]);
-    vec3_t vertex_b = vec3_from_vec4(triangle.vertices[1]);
-    vec3_t vertex_c = vec3_from_vec4(triangle.vertices[2]);
+  // camera is at the origin in the view space so the ray from the vertex to
+  // the camera is just -vertex_a
+  vec3_t camera_ray = {-vertex_a.x, -vertex_a.y, -vertex_a.z};
 
-    vec3_t ab = vec3_sub(vertex_b, vertex_a);
-    vec3_t ac = vec3_sub(vertex_c, vertex_a);
-    vec3_t normal = vec3_cross(ac, ab);
-    vec3_normalize(&normal);
+  float dot = vec3_dot(normal, camera_ray);
+  if (dot < 0) {
+    return;
+  }
 
-    vec3_t origin = {0.0, 0.0, 0.0};
-    vec3_t camera_ray = vec3_sub(origin, vertex_a);
-    vec3_normalize(&camera_ray);
+  // the triangle is visible, fetch the rest of its attributes
+  for (int j = 0; j < 3; ++j) {
+    triangle.normals[j] = mesh_get_vertex_normal(mesh, face_vertices[j]);
+    triangle.texcoords[j] = mesh_get_vertex_tex_coord(mesh, face_vertices[j]);
+  }
 
-    float dot = vec3_dot(normal, camera_ray);
-    if (dot < 0) {
-      continue;
+  for (int j = 0; j < 3; ++j) {
+    // store the view space vertices that will be further used for lighting
+    // calculations
+    triangle.view_space_vertices[j] = triangle.vertices[j];
+
+    vec4_t normal = vec4_from_vec3(triangle.normals[j]);
+    normal.w = 0.0; // this removes translation from the normal as we dont
+                    // want to move normals only rotate them
+    triangle.normals[j] = vec3_from_vec4(mat4_mul_vec4(normal_matrix, normal));
+    vec3_normalize(&triangle.normals[j]);
+  }
+
+  // perspective projecion->perspective divide
+  for (int j = 0; j < 3; ++j) {
+    // perspective projection
+    vec4_t projected_points = triangle.vertices[j];
+    projected_points = mat4_mul_vec4(projection_matrix, projected_points);
+    if (is_skybox) {
+      projected_points.z = 0.0001;
     }
+    triangle.vertices[j] = projected_points;
+  }
 
-    // perspective projecion->perspective divide
+  // CLIPPING Space
+  polygon_t polygon = create_polygon_from_triangle(triangle);
+#if USE_GUARD_BAND_CLIPPING
+  clip_polygon_guard_band(&polygon);
+#else
+  clip_polygon(&polygon);
+#endif
+  // after clipping we get new set of vertices which we will need to create
+  // new triangles
+  triangle_t triangles_after_clipping[MAX_NUM_POLYGON_VERTICES];
+  int num_triangles_after_clipping;
+  triangle_from_polygon(&polygon, triangles_after_clipping,
+                        &num_triangles_after_clipping);
+
+  // loop through this new set of triangles
+  for (int ct = 0; ct < num_triangles_after_clipping;
+       ++ct) { // ct->clipped triangle
+    triangle = triangles_after_clipping[ct];
+    // perspective divide
     for (int j = 0; j < 3; ++j) {
-      // perspective projection
-      vec4_t projected_points = triangle.vertices[j];
-      projected_points = mat4_mul_vec4(projection_matrix, projected_points);
-      if (is_skybox) {
-        projected_points.z = 0.0001;
-      }
-      triangle.vertices[j] = projected_points;
+      // Will also scale the values in the range [-1,1]
+      triangle.vertices[j].x /= triangle.vertices[j].w;
+      triangle.vertices[j].y /= triangle.vertices[j].w;
+      triangle.vertices[j].z /= triangle.vertices[j].w;
     }
 
-    // CLIPPING Space
-    polygon_t polygon = create_polygon_from_triangle(triangle);
-    clip_polygon(&polygon);
-    // after clipping we get new set of vertices which we will need to create
-    // new triangles
-    triangle_t triangles_after_clipping[MAX_NUM_POLYGON_VERTICES];
-    int num_triangles_after_clipping;
-    triangle_from_polygon(&polygon, triangles_after_clipping,
-                          &num_triangles_after_clipping);
-
-    // loop through this new set of triangles
-    for (int ct = 0; ct < num_triangles_after_clipping;
-         ++ct) { // ct->clipped triangle
-      triangle = triangles_after_clipping[ct];
-      // perspective divide
-      for (int j = 0; j < 3; ++j) {
-        // Will also scale the values in the range [-1,1]
-        triangle.vertices[j].x /= triangle.vertices[j].w;
-        triangle.vertices[j].y /= triangle.vertices[j].w;
-        triangle.vertices[j].z /= triangle.vertices[j].w;
-      }
+    for (int j = 0; j < 3; ++j) {
+      // scale NDC[-1 to 1] to SCREEN_SPACE[0,1]
+      triangle.vertices[j].x = (triangle.vertices[j].x + 1.0) * 0.5;
+      triangle.vertices[j].y = (triangle.vertices[j].y + 1.0) * 0.5;
 
-      for (int j = 0; j < 3; ++j) {
-        // scale NDC[-1 to 1] to SCREEN_SPACE[0,1]
-        triangle.vertices[j].x = (triangle.vertices[j].x + 1.0) * 0.5;
-        triangle.vertices[j].y = (triangle.vertices[j].y + 1.0) * 0.5;
+      // Scale the SCREEN_SPACE from[0,1] to [0,Width/Height]
+      triangle.vertices[j].x *= WINDOW_WIDTH;
+      triangle.vertices[j].y *= WINDOW_HEIGHT;
+    }
 
-        // Scale the SCREEN_SPACE from[0,1] to [0,Width/Height]
-        triangle.vertices[j].x *= WINDOW_WIDTH;
-        triangle.vertices[j].y *= WINDOW_HEIGHT;
+    *triangle_arena_push(triangle_arena) = triangle;
+  }
+}
+
+void mesh_apply_transform_view_projection(
+    mesh_t *mesh, int lod, triangle_arena_t *triangle_arena,
+    mat4_t model_matrix, mat4_t rotation_matrix, mat4_t view_matrix,
+    mat4_t projection_matrix, frustum_t *frustum, render_stats_t *stats,
+    bool is_skybox) {
+
+  // fuse the Model->View transformations so that each vertex is multiplied
+  // by a single matrix instead of four
+  mat4_t model_view_matrix = mat4_mul_mat4(view_matrix, model_matrix);
+  // normals are only rotated[the w=0 of the normal removes the translation]
+  mat4_t normal_matrix = mat4_mul_mat4(view_matrix, rotation_matrix);
+
+  float max_scale = mat4_get_max_scale(model_matrix);
+  bool can_cone_cull = mat4_preserves_angles(model_matrix);
+
+  // a streamed mesh is drawn at the level it has resident
+  if (mesh->stream)
+    lod = mesh_stream_select_resident_lod(mesh->stream, lod, model_view_matrix,
+                                          max_scale, can_cone_cull, frustum);
+
+  // loop through all the meshlets and only go through the faces/triangles of
+  // the ones that might be visible
+  mesh_lod_t *level = &mesh->lods[lod];
+  for (int m = 0; m < level->number_of_meshlets; ++m) {
+    meshlet_t *meshlet = &level->meshlets[m];
+    if (!meshlet_is_visible(meshlet, model_view_matrix, max_scale,
+                            can_cone_cull, frustum)) {
+      stats->culled_meshlets++;
+      continue;
+    }
+
+    if (mesh->stream) {
+      // the page is missing only while nothing coarser is complete either
+      mesh_page_t *page = mesh_stream_get_page(mesh->stream, lod, m);
+      for (int i = 0; page && i < page->number_of_faces; ++i) {
+        uint16_t *indices = &page->indices[i * 3];
+        vertex_t *face_vertices[3] = {&page->vertices[indices[0]],
+                                      &page->vertices[indices[1]],
+                                      &page->vertices[indices[2]]};
+        mesh_transform_face(mesh, face_vertices, triangle_arena,
+                            model_view_matrix, normal_matrix,
+                            projection_matrix, is_skybox);
       }
+      continue;
+    }
 
-      triangles_to_render[*triangles_to_render_count] = triangle;
-      (*triangles_to_render_count)++;
+    int last_face = meshlet->first_face + meshlet->number_of_faces;
+    for (int i = meshlet->first_face; i < last_face; ++i) {
+      uint32_t indices[3];
+      mesh_get_face_indices(mesh, level, i, indices);
+      vertex_t *face_vertices[3] = {&mesh->vertices[indices[0]],
+                                    &mesh->vertices[indices[1]],
+                                    &mesh->vertices[indices[2]]};
+      mesh_transform_face(mesh, face_vertices, triangle_arena,
+                          model_view_matrix, normal_matrix, projection_matrix,
+                          is_skybox);
     }
   }
 }
@@ -0,0 +1,220 @@
+#include "mesh_cache.h"
+#include "config.h"
+#include "mesh.h"
+#include "meshlet.h"
+#include "utilities.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+char *mesh_cache_filename(char *obj_filename) {
+  return filename_replace_extension(obj_filename, ".rmesh");
+}
+
+uint64_t mesh_cache_hash_file(char *filename) {
+  // anything that changes what the loader builds out of the same OBJ file
+  int settings[] = {MESH_CACHE_VERSION,
+                    (int)sizeof(vertex_t),
+                    USE_QUANTIZED_VERTICES,
+                    USE_VERTEX_CACHE_OPTIMIZATION,
+                    MESH_MAX_LODS,
+                    MESHLET_MAX_FACES,
+                    (int)(MESH_LOD_REDUCTION * 1000)};
+  uint64_t hash = hash_fnv1a(HASH_SEED, settings, sizeof(settings));
+  return hash_file(hash, filename);
+}
+
+// a section of `count` elements at `offset` has to be inside of the file
+bool mesh_cache_is_inside(uint64_t offset, int64_t count, size_t element_size,
+                          size_t file_size) {
+  if (count < 0 || offset % MESH_CACHE_ALIGNMENT != 0 || offset > file_size)
+    return false;
+  return (uint64_t)count <= (file_size - offset) / element_size;
+}
+
+// Every index has to name a vertex and every meshlet has to be a range of
+// the faces of its level, the rasterizer trusts both. Reads the whole level
+// once, a streamed mesh lets the pages go again afterwards
+bool mesh_cache_is_level_valid(char *data, mesh_cache_header_t *header,
+                               mesh_cache_lod_t *level) {
+  uint32_t number_of_vertices = header->number_of_vertices;
+  int64_t number_of_indices = (int64_t)level->number_of_faces * 3;
+  if (header->index_size == 2) {
+    uint16_t *indices = (uint16_t *)(data + level->indices_offset);
+    for (int64_t i = 0; i < number_of_indices; ++i) {
+      if (indices[i] >= number_of_vertices)
+        return false;
+    }
+  } else {
+    uint32_t *indices = (uint32_t *)(data + level->indices_offset);
+    for (int64_t i = 0; i < number_of_indices; ++i) {
+      if (indices[i] >= number_of_vertices)
+        return false;
+    }
+  }
+
+  meshlet_t *meshlets = (meshlet_t *)(data + level->meshlets_offset);
+  for (int m = 0; m < level->number_of_meshlets; ++m) {
+    meshlet_t *meshlet = &meshlets[m];
+    if (meshlet->first_face < 0 || meshlet->number_of_faces < 0 ||
+        meshlet->number_of_faces > MESHLET_MAX_FACES ||
+        meshlet->first_face > level->number_of_faces - meshlet->number_of_faces)
+      return false;
+  }
+  return true;
+}
+
+bool mesh_cache_load(char *cache_filename, uint64_t source_hash,
+                     mesh_t *mesh) {
+  int file_descriptor = open(cache_filename, O_RDONLY);
+  if (file_descriptor == -1)
+    return false;
+  struct stat file_stat;
+  if (fstat(file_descriptor, &file_stat) == -1 ||
+      (size_t)file_stat.st_size < sizeof(mesh_cache_header_t)) {
+    close(file_descriptor);
+    return false;
+  }
+  size_t file_size = file_stat.st_size;
+  char *data =
+      mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  close(file_descriptor);
+  if (data == MAP_FAILED)
+    return false;
+
+  // a stale or truncated cache is rebuilt, never trusted
+  mesh_cache_header_t *header = (mesh_cache_header_t *)data;
+  bool is_valid = memcmp(header->magic, "RMSH", 4) == 0 &&
+                  header->version == MESH_CACHE_VERSION &&
+                  header->source_hash == source_hash &&
+                  header->file_size == file_size &&
+                  header->vertex_size == sizeof(vertex_t) &&
+                  (header->index_size == 2 || header->index_size == 4) &&
+                  header->number_of_lods >= 1 &&
+                  header->number_of_lods <= MESH_MAX_LODS &&
+                  mesh_cache_is_inside(header->vertices_offset,
+                                       header->number_of_vertices,
+                                       sizeof(vertex_t), file_size);
+  for (int l = 0; is_valid && l < header->number_of_lods; ++l) {
+    mesh_cache_lod_t *level = &header->lods[l];
+    is_valid = mesh_cache_is_inside(level->indices_offset,
+                                    (int64_t)level->number_of_faces * 3,
+                                    header->index_size, file_size) &&
+               mesh_cache_is_inside(level->meshlets_offset,
+                                    level->number_of_meshlets,
+                                    sizeof(meshlet_t), file_size) &&
+               mesh_cache_is_level_valid(data, header, level);
+  }
+  if (!is_valid) {
+    munmap(data, file_size);
+    return false;
+  }
+
+  mesh->mapping = data;
+  mesh->mapping_size = file_size;
+  mesh->vertices = (vertex_t *)(data + header->vertices_offset);
+  mesh->number_of_vertices = header->number_of_vertices;
+  mesh->index_size = header->index_size;
+  mesh->number_of_lods = header->number_of_lods;
+  for (int l = 0; l < header->number_of_lods; ++l) {
+    mesh_cache_lod_t *level = &header->lods[l];
+    mesh->lods[l] = (mesh_lod_t){
+        .indices = data + level->indices_offset,
+        .meshlets = (meshlet_t *)(data + level->meshlets_offset),
+        .number_of_faces = level->number_of_faces,
+        .number_of_meshlets = level->number_of_meshlets,
+        .error = level->error};
+  }
+  mesh->bounding_box_min = header->bounding_box_min;
+  mesh->bounding_box_max = header->bounding_box_max;
+  mesh->bounding_sphere_center = header->bounding_sphere_center;
+  mesh->bounding_sphere_radius = header->bounding_sphere_radius;
+#if USE_QUANTIZED_VERTICES
+  mesh->position_offset = header->position_offset;
+  mesh->position_scale = header->position_scale;
+  mesh->tex_coord_offset = header->tex_coord_offset;
+  mesh->tex_coord_scale = header->tex_coord_scale;
+#endif
+  return true;
+}
+
+void mesh_cache_save(char *cache_filename, uint64_t source_hash,
+                     mesh_t *mesh) {
+  mesh_cache_header_t header = {.magic = {'R', 'M', 'S', 'H'},
+                                .version = MESH_CACHE_VERSION,
+                                .source_hash = source_hash,
+                                .number_of_vertices = mesh->number_of_vertices,
+                                .vertex_size = sizeof(vertex_t),
+                                .index_size = mesh->index_size,
+                                .number_of_lods = mesh->number_of_lods};
+  header.bounding_box_min = mesh->bounding_box_min;
+  header.bounding_box_max = mesh->bounding_box_max;
+  header.bounding_sphere_center = mesh->bounding_sphere_center;
+  header.bounding_sphere_radius = mesh->bounding_sphere_radius;
+#if USE_QUANTIZED_VERTICES
+  header.position_offset = mesh->position_offset;
+  header.position_scale = mesh->position_scale;
+  header.tex_coord_offset = mesh->tex_coord_offset;
+  header.tex_coord_scale = mesh->tex_coord_scale;
+#endif
+
+  // vertices, then the indices and meshlets of every level
+  size_t offset = align_up(sizeof(mesh_cache_header_t), MESH_CACHE_ALIGNMENT);
+  header.vertices_offset = offset;
+  offset = align_up(offset + sizeof(vertex_t) * mesh->number_of_vertices,
+                    MESH_CACHE_ALIGNMENT);
+  for (int l = 0; l < mesh->number_of_lods; ++l) {
+    mesh_lod_t *level = &mesh->lods[l];
+    header.lods[l] = (mesh_cache_lod_t){
+        .number_of_faces = level->number_of_faces,
+        .number_of_meshlets = level->number_of_meshlets,
+        .error = level->error};
+    header.lods[l].indices_offset = offset;
+    offset = align_up(offset + (size_t)mesh->index_size * 3 *
+                                   level->number_of_faces,
+                      MESH_CACHE_ALIGNMENT);
+    header.lods[l].meshlets_offset = offset;
+    offset = align_up(offset + sizeof(meshlet_t) * level->number_of_meshlets,
+                      MESH_CACHE_ALIGNMENT);
+  }
+  header.file_size = offset;
+
+  // written next to the cache and renamed over it once complete, so a crash
+  // half way never leaves a truncated cache behind
+  char *temporary_filename = filename_append(cache_filename, ".tmp");
+  FILE *file = fopen(temporary_filename, "wb");
+  if (!file) {
+    fprintf(stderr, "Warning: Could not write the mesh cache: %s\n",
+            cache_filename);
+    free(temporary_filename);
+    return;
+  }
+  bool is_written =
+      file_write_at(file, 0, &header, sizeof(header)) &&
+      file_write_at(file, header.vertices_offset, mesh->vertices,
+                    sizeof(vertex_t) * mesh->number_of_vertices);
+  for (int l = 0; is_written && l < mesh->number_of_lods; ++l) {
+    mesh_lod_t *level = &mesh->lods[l];
+    is_written =
+        file_write_at(file, header.lods[l].indices_offset, level->indices,
+                      (size_t)mesh->index_size * 3 * level->number_of_faces) &&
+        file_write_at(file, header.lods[l].meshlets_offset, level->meshlets,
+                      sizeof(meshlet_t) * level->number_of_meshlets);
+  }
+  // pad the end so the size matches the header
+  is_written = is_written && file_write_at(file, header.file_size, "", 0);
+  is_written = fclose(file) == 0 && is_written;
+
+  if (!is_written || rename(temporary_filename, cache_filename) != 0) {
+    fprintf(stderr, "Warning: Could not write the mesh cache: %s\n",
+            cache_filename);
+    remove(temporary_filename);
+  }
+  free(temporary_filename);
+}
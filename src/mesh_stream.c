@@ -0,0 +1,340 @@
+#include "mesh_stream.h"
+#include "mesh.h"
+#include "meshlet.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// slots of the table that maps the vertices of the mesh to the ones of a
+// page, a power of two and more than twice the vertices a meshlet can have
+#define MESH_STREAM_VERTEX_TABLE_SIZE 1024
+
+bool mesh_stream_is_needed(mesh_t *mesh) {
+  return mesh->lods[0].number_of_faces >= MESH_STREAM_MIN_FACES;
+}
+
+void mesh_stream_budget_init(mesh_stream_budget_t *budget) {
+  // frame 0 is never drawn, a meshlet last visible in it never was
+  atomic_init(&budget->frame, 1);
+  pthread_mutex_init(&budget->lock, NULL);
+  budget->streams = NULL;
+  budget->number_of_streams = 0;
+  budget->capacity = 0;
+  budget->resident_bytes = 0;
+}
+
+void mesh_stream_budget_free(mesh_stream_budget_t *budget) {
+  pthread_mutex_destroy(&budget->lock);
+  free(budget->streams);
+  budget->streams = NULL;
+  budget->number_of_streams = 0;
+  budget->capacity = 0;
+}
+
+void mesh_stream_budget_update(mesh_stream_budget_t *budget) {
+  atomic_fetch_add(&budget->frame, 1);
+}
+
+mesh_stream_t *mesh_stream_create(mesh_t *mesh, mesh_stream_budget_t *budget) {
+  mesh_stream_t *stream = calloc(1, sizeof(mesh_stream_t));
+  if (!stream) {
+    fprintf(stderr, "Error: Could not allocate the mesh stream\n");
+    exit(1);
+  }
+  stream->budget = budget;
+  stream->source = *mesh;
+  for (int l = 0; l < mesh->number_of_lods; ++l) {
+    stream->first_meshlet[l] = stream->number_of_meshlets;
+    stream->number_of_meshlets += mesh->lods[l].number_of_meshlets;
+  }
+  int number_of_meshlets = stream->number_of_meshlets;
+  stream->pages = calloc(number_of_meshlets + 1, sizeof(*stream->pages));
+  stream->last_visible = calloc(number_of_meshlets + 1, sizeof(atomic_uint));
+  stream->resident_meshlets = malloc(sizeof(int) * (number_of_meshlets + 1));
+  if (!stream->pages || !stream->last_visible || !stream->resident_meshlets) {
+    fprintf(stderr, "Error: Could not allocate the mesh stream\n");
+    exit(1);
+  }
+  atomic_init(&stream->reported_bytes, 0);
+
+  pthread_mutex_lock(&budget->lock);
+  if (budget->number_of_streams == budget->capacity) {
+    int new_capacity = budget->capacity > 0 ? budget->capacity * 2 : 4;
+    mesh_stream_t **grown =
+        realloc(budget->streams, sizeof(mesh_stream_t *) * new_capacity);
+    if (!grown) {
+      fprintf(stderr, "Error: Could not grow the mesh streams to %d\n",
+              new_capacity);
+      exit(1);
+    }
+    budget->streams = grown;
+    budget->capacity = new_capacity;
+  }
+  budget->streams[budget->number_of_streams++] = stream;
+  pthread_mutex_unlock(&budget->lock);
+  return stream;
+}
+
+void mesh_stream_free(mesh_stream_t *stream) {
+  mesh_stream_budget_t *budget = stream->budget;
+  pthread_mutex_lock(&budget->lock);
+  for (int i = 0; i < budget->number_of_streams; ++i) {
+    if (budget->streams[i] == stream) {
+      budget->streams[i] = budget->streams[--budget->number_of_streams];
+      break;
+    }
+  }
+  budget->resident_bytes -= stream->resident_bytes;
+  pthread_mutex_unlock(&budget->lock);
+
+  for (int i = 0; i < stream->number_of_meshlets; ++i) {
+    free(atomic_load(&stream->pages[i]));
+  }
+  for (int i = 0; i < stream->number_of_retired_pages; ++i) {
+    free(stream->retired_pages[i]);
+  }
+  free(stream->pages);
+  free(stream->last_visible);
+  free(stream->resident_meshlets);
+  free(stream->retired_pages);
+  free(stream->retired_frames);
+  free(stream);
+}
+
+int mesh_stream_select_resident_lod(mesh_stream_t *stream, int lod,
+                                    mat4_t model_view_matrix, float max_scale,
+                                    bool can_cone_cull, frustum_t *frustum) {
+  mesh_t *mesh = &stream->source;
+  unsigned frame =
+      atomic_load_explicit(&stream->budget->frame, memory_order_relaxed);
+  for (int l = lod; l < mesh->number_of_lods; ++l) {
+    mesh_lod_t *level = &mesh->lods[l];
+    bool is_complete = true;
+    for (int m = 0; m < level->number_of_meshlets; ++m) {
+      if (!meshlet_is_visible(&level->meshlets[m], model_view_matrix,
+                              max_scale, can_cone_cull, frustum))
+        continue;
+      // the read before the write keeps the threads from fighting over the
+      // cache line
+      int index = stream->first_meshlet[l] + m;
+      if (atomic_load_explicit(&stream->last_visible[index],
+                               memory_order_relaxed) != frame)
+        atomic_store_explicit(&stream->last_visible[index], frame,
+                              memory_order_relaxed);
+      is_complete = is_complete && atomic_load(&stream->pages[index]) != NULL;
+    }
+    if (is_complete)
+      return l;
+  }
+  return mesh->number_of_lods - 1;
+}
+
+mesh_page_t *mesh_stream_get_page(mesh_stream_t *stream, int lod,
+                                  int meshlet_index) {
+  // sequentially consistent so the streaming thread can tell which frame
+  // might still hold a page it unpublished(see mesh_stream_evict)
+  int index = stream->first_meshlet[lod] + meshlet_index;
+  return atomic_load(&stream->pages[index]);
+}
+
+size_t mesh_stream_get_size(mesh_stream_t *stream) {
+  return atomic_load(&stream->reported_bytes) +
+         (sizeof(mesh_page_t *) + sizeof(atomic_uint) + sizeof(int) +
+          sizeof(meshlet_t)) *
+             stream->number_of_meshlets;
+}
+
+/////////////////////////////////////////////////////
+//////////////////// STREAMING //////////////////////
+/////////////////////////////////////////////////////
+
+// copies the faces of the meshlet and the vertices they use out of the
+// mapping into one allocation
+mesh_page_t *mesh_stream_build_page(mesh_stream_t *stream, int lod,
+                                    int meshlet_index) {
+  mesh_t *mesh = &stream->source;
+  mesh_lod_t *level = &mesh->lods[lod];
+  meshlet_t *meshlet = &level->meshlets[meshlet_index];
+
+  uint32_t table_keys[MESH_STREAM_VERTEX_TABLE_SIZE];
+  uint16_t table_values[MESH_STREAM_VERTEX_TABLE_SIZE];
+  memset(table_keys, 0xFF, sizeof(table_keys));
+  uint32_t vertex_indices[MESHLET_MAX_FACES * 3];
+  uint16_t local_indices[MESHLET_MAX_FACES * 3];
+  int number_of_vertices = 0;
+  for (int f = 0; f < meshlet->number_of_faces; ++f) {
+    uint32_t indices[3];
+    mesh_get_face_indices(mesh, level, meshlet->first_face + f, indices);
+    for (int j = 0; j < 3; ++j) {
+      uint32_t slot = (indices[j] * 2654435761u) &
+                      (MESH_STREAM_VERTEX_TABLE_SIZE - 1);
+      while (table_keys[slot] != UINT32_MAX && table_keys[slot] != indices[j])
+        slot = (slot + 1) & (MESH_STREAM_VERTEX_TABLE_SIZE - 1);
+      if (table_keys[slot] == UINT32_MAX) {
+        table_keys[slot] = indices[j];
+        table_values[slot] = number_of_vertices;
+        vertex_indices[number_of_vertices++] = indices[j];
+      }
+      local_indices[f * 3 + j] = table_values[slot];
+    }
+  }
+
+  size_t size = sizeof(mesh_page_t) + sizeof(vertex_t) * number_of_vertices +
+                sizeof(uint16_t) * 3 * meshlet->number_of_faces;
+  mesh_page_t *page = malloc(size);
+  if (!page) {
+    fprintf(stderr, "Error: Could not allocate a page of the mesh\n");
+    exit(1);
+  }
+  *page = (mesh_page_t){.vertices = (vertex_t *)(page + 1),
+                        .number_of_vertices = number_of_vertices,
+                        .number_of_faces = meshlet->number_of_faces,
+                        .size = size};
+  page->indices = (uint16_t *)(page->vertices + number_of_vertices);
+  for (int v = 0; v < number_of_vertices; ++v) {
+    page->vertices[v] = mesh->vertices[vertex_indices[v]];
+  }
+  memcpy(page->indices, local_indices,
+         sizeof(uint16_t) * 3 * meshlet->number_of_faces);
+  return page;
+}
+
+// frees the evicted pages no frame can read anymore
+void mesh_stream_free_retired(mesh_stream_t *stream, uint32_t frame) {
+  int number_of_kept_pages = 0;
+  for (int i = 0; i < stream->number_of_retired_pages; ++i) {
+    if (stream->retired_frames[i] < frame) {
+      free(stream->retired_pages[i]);
+      continue;
+    }
+    stream->retired_pages[number_of_kept_pages] = stream->retired_pages[i];
+    stream->retired_frames[number_of_kept_pages++] = stream->retired_frames[i];
+  }
+  stream->number_of_retired_pages = number_of_kept_pages;
+}
+
+// Unpublishes the page of resident meshlet `resident`. The frame is read
+// after the page is gone, so every frame that could have picked it up is at
+// most that one and the page is freed once it is over
+void mesh_stream_evict(mesh_stream_t *stream, int resident) {
+  int index = stream->resident_meshlets[resident];
+  mesh_page_t *page = atomic_exchange(&stream->pages[index], NULL);
+  uint32_t frame = atomic_load(&stream->budget->frame);
+
+  // both arrays grow together, the capacity is the number of resident
+  // meshlets at most
+  if (!stream->retired_pages) {
+    stream->retired_pages =
+        malloc(sizeof(mesh_page_t *) * (stream->number_of_meshlets + 1));
+    stream->retired_frames =
+        malloc(sizeof(uint32_t) * (stream->number_of_meshlets + 1));
+    if (!stream->retired_pages || !stream->retired_frames) {
+      fprintf(stderr, "Error: Could not allocate the retired mesh pages\n");
+      exit(1);
+    }
+  }
+  stream->retired_pages[stream->number_of_retired_pages] = page;
+  stream->retired_frames[stream->number_of_retired_pages++] = frame;
+
+  stream->resident_bytes -= page->size;
+  stream->budget->resident_bytes -= page->size;
+  stream->resident_meshlets[resident] =
+      stream->resident_meshlets[--stream->number_of_resident_meshlets];
+}
+
+// evicts the pages that were not visible for the longest(of all the
+// streams) till `size` more bytes fit, false when everything resident is
+// still visible
+bool mesh_stream_make_room(mesh_stream_budget_t *budget, size_t size,
+                           uint32_t frame) {
+  while (budget->resident_bytes + size > MESH_STREAM_BUDGET) {
+    mesh_stream_t *oldest_stream = NULL;
+    int oldest = -1;
+    uint32_t oldest_frame = 0;
+    for (int s = 0; s < budget->number_of_streams; ++s) {
+      mesh_stream_t *stream = budget->streams[s];
+      for (int r = 0; r < stream->number_of_resident_meshlets; ++r) {
+        int index = stream->resident_meshlets[r];
+        uint32_t last_visible = atomic_load_explicit(
+            &stream->last_visible[index], memory_order_relaxed);
+        // visible in the last frame or in this one so far
+        if (last_visible + 1 >= frame)
+          continue;
+        if (oldest == -1 || last_visible < oldest_frame) {
+          oldest_stream = stream;
+          oldest = r;
+          oldest_frame = last_visible;
+        }
+      }
+    }
+    if (oldest == -1)
+      return false;
+    mesh_stream_evict(oldest_stream, oldest);
+  }
+  return true;
+}
+
+// builds the missing pages of the meshlets of the level that were visible in
+// the last frame, false once no more fit this frame
+bool mesh_stream_page_in_level(mesh_stream_t *stream, int lod, uint32_t frame,
+                               int *uploads) {
+  mesh_stream_budget_t *budget = stream->budget;
+  for (int m = 0; m < stream->source.lods[lod].number_of_meshlets; ++m) {
+    int index = stream->first_meshlet[lod] + m;
+    uint32_t last_visible = atomic_load_explicit(&stream->last_visible[index],
+                                                 memory_order_relaxed);
+    if (last_visible == 0 || last_visible + 1 < frame ||
+        atomic_load_explicit(&stream->pages[index], memory_order_relaxed))
+      continue;
+
+    if (*uploads == MESH_STREAM_MAX_UPLOADS)
+      return false;
+    mesh_page_t *page = mesh_stream_build_page(stream, lod, m);
+    if (!mesh_stream_make_room(budget, page->size, frame)) {
+      free(page);
+      return false;
+    }
+    atomic_store(&stream->pages[index], page);
+    stream->resident_meshlets[stream->number_of_resident_meshlets++] = index;
+    stream->resident_bytes += page->size;
+    budget->resident_bytes += page->size;
+    (*uploads)++;
+  }
+  return true;
+}
+
+void mesh_stream_budget_page_in(mesh_stream_budget_t *budget) {
+  pthread_mutex_lock(&budget->lock);
+  uint32_t frame = atomic_load(&budget->frame);
+  for (int s = 0; s < budget->number_of_streams; ++s) {
+    mesh_stream_free_retired(budget->streams[s], frame);
+  }
+
+  // the coarse levels of every stream first as they are what the finer ones
+  // fall back to
+  int uploads = 0;
+  bool is_full = false;
+  for (int k = 0; k < MESH_MAX_LODS && !is_full; ++k) {
+    for (int s = 0; s < budget->number_of_streams && !is_full; ++s) {
+      mesh_stream_t *stream = budget->streams[s];
+      int lod = stream->source.number_of_lods - 1 - k;
+      if (lod >= 0)
+        is_full = !mesh_stream_page_in_level(stream, lod, frame, &uploads);
+    }
+  }
+
+  for (int s = 0; s < budget->number_of_streams; ++s) {
+    mesh_stream_t *stream = budget->streams[s];
+    atomic_store(&stream->reported_bytes, stream->resident_bytes);
+    // the file pages the meshlets were copied from are not kept around
+    if (uploads > 0 && stream->source.mapping)
+      madvise(stream->source.mapping, stream->source.mapping_size,
+              MADV_DONTNEED);
+  }
+  pthread_mutex_unlock(&budget->lock);
+}
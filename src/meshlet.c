@@ -0,0 +1,364 @@
+#include "meshlet.h"
+#include "clipping.h"
+#include "matrix.h"
+#include "triangle.h"
+#include "utilities.h"
+#include "vector.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// spreads the lower 10 bits of v so that there are two zero bits between each
+// of them[used to interleave x,y,z into a morton code]
+uint32_t morton_spread_bits(uint32_t v) {
+  v &= 0x3FF;
+  v = (v | (v << 16)) & 0x030000FF;
+  v = (v | (v << 8)) & 0x0300F00F;
+  v = (v | (v << 4)) & 0x030C30C3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+typedef struct {
+  uint32_t morton_code;
+  int face_index;
+} face_sort_key_t;
+
+int compare_face_sort_keys(const void *a, const void *b) {
+  const face_sort_key_t *key_a = a;
+  const face_sort_key_t *key_b = b;
+  if (key_a->morton_code != key_b->morton_code)
+    return key_a->morton_code < key_b->morton_code ? -1 : 1;
+  // keep the original order on ties so that the result is deterministic
+  return key_a->face_index - key_b->face_index;
+}
+
+// the normal follows the same cross(ac, ab) winding the backface culling uses
+// (zero for degenerate faces)
+vec3_t face_unit_normal(vec3_t *vertices, face_t *face) {
+  vec3_t a = vertices[face->a];
+  vec3_t ab = vec3_sub(vertices[face->b], a);
+  vec3_t ac = vec3_sub(vertices[face->c], a);
+  vec3_t normal = vec3_cross(ac, ab);
+  vec3_normalize(&normal);
+  return normal;
+}
+
+void meshlet_compute_bounds(vec3_t *vertices, face_t *faces,
+                            meshlet_t *meshlet) {
+  face_t *meshlet_faces = &faces[meshlet->first_face];
+
+  // bounding sphere centered on the bounding box of the faces
+  vec3_t box_min = vertices[meshlet_faces[0].a];
+  vec3_t box_max = box_min;
+  for (int i = 0; i < meshlet->number_of_faces; ++i) {
+    int corners[3] = {meshlet_faces[i].a, meshlet_faces[i].b,
+                      meshlet_faces[i].c};
+    for (int j = 0; j < 3; ++j) {
+      vec3_t v = vertices[corners[j]];
+      box_min = vec3_new(min(box_min.x, v.x), min(box_min.y, v.y),
+                         min(box_min.z, v.z));
+      box_max = vec3_new(max(box_max.x, v.x), max(box_max.y, v.y),
+                         max(box_max.z, v.z));
+    }
+  }
+  vec3_t center = vec3_add(box_min, box_max);
+  vec3_mul(&center, 0.5);
+
+  // the normal cone axis is the average of the face normals
+  float max_distance_squared = 0.0;
+  vec3_t axis = {0, 0, 0};
+  for (int i = 0; i < meshlet->number_of_faces; ++i) {
+    int corners[3] = {meshlet_faces[i].a, meshlet_faces[i].b,
+                      meshlet_faces[i].c};
+    for (int j = 0; j < 3; ++j) {
+      vec3_t d = vec3_sub(vertices[corners[j]], center);
+      max_distance_squared = max(max_distance_squared, vec3_dot(d, d));
+    }
+    axis = vec3_add(axis, face_unit_normal(vertices, &meshlet_faces[i]));
+  }
+  meshlet->bounding_sphere_center = center;
+  meshlet->bounding_sphere_radius = sqrtf(max_distance_squared);
+
+  float axis_length = vec3_magnitude(axis);
+  if (axis_length < 1e-6) {
+    // normals cancel each other out, can not be backface culled
+    meshlet->cone_axis = vec3_new(0, 0, 1);
+    meshlet->cone_cutoff = 1.0;
+    return;
+  }
+  vec3_div(&axis, axis_length);
+
+  // the widest angle between the axis and any of the face normals
+  float min_dot = 1.0;
+  for (int i = 0; i < meshlet->number_of_faces; ++i) {
+    vec3_t normal = face_unit_normal(vertices, &meshlet_faces[i]);
+    // degenerate faces have no direction and are culled per face anyway
+    if (normal.x == 0 && normal.y == 0 && normal.z == 0)
+      continue;
+    min_dot = min(min_dot, vec3_dot(axis, normal));
+  }
+
+  meshlet->cone_axis = axis;
+  // a cone wider than ~84 degrees can practically never be fully backfacing
+  if (min_dot <= 0.1) {
+    meshlet->cone_cutoff = 1.0;
+  } else {
+    meshlet->cone_cutoff = sqrtf(1.0 - min_dot * min_dot);
+  }
+}
+
+// Meshlets are grown greedily: a seed face is taken in morton order of the
+// face centroids and then the meshlet keeps adding the neighbouring face[one
+// that shares a vertex] that is closest to its center and whose normal
+// deviates the least from its average normal
+int meshlets_build(vec3_t *vertices, int number_of_vertices, face_t *faces,
+                   int number_of_faces, meshlet_t **meshlets) {
+  *meshlets = NULL;
+  if (number_of_faces == 0)
+    return 0;
+
+  vec3_t *face_normals = malloc(sizeof(vec3_t) * number_of_faces);
+  vec3_t *face_centroids = malloc(sizeof(vec3_t) * number_of_faces);
+  face_sort_key_t *seed_order =
+      malloc(sizeof(face_sort_key_t) * number_of_faces);
+  // faces around every vertex stored as one array with per vertex offsets
+  int *vertex_face_offsets = calloc(number_of_vertices + 1, sizeof(int));
+  int *vertex_faces = malloc(sizeof(int) * number_of_faces * 3);
+  // meshlet the face belongs to, -1 while it is unassigned
+  int *face_meshlet = malloc(sizeof(int) * number_of_faces);
+  // last meshlet that had the face as a candidate, avoids duplicates
+  int *face_candidate_of = malloc(sizeof(int) * number_of_faces);
+  int *candidates = malloc(sizeof(int) * number_of_faces);
+  int *face_order = malloc(sizeof(int) * number_of_faces);
+  // there can never be more meshlets than faces
+  meshlet_t *built_meshlets = malloc(sizeof(meshlet_t) * number_of_faces);
+  face_t *ordered_faces = malloc(sizeof(face_t) * number_of_faces);
+  if (!face_normals || !face_centroids || !seed_order ||
+      !vertex_face_offsets || !vertex_faces || !face_meshlet ||
+      !face_candidate_of || !candidates || !face_order || !built_meshlets ||
+      !ordered_faces) {
+    fprintf(stderr, "Error: Could not allocate the meshlets\n");
+    exit(1);
+  }
+
+  // bounding box of the mesh to bring the centroids into a morton grid
+  vec3_t box_min = vertices[faces[0].a];
+  vec3_t box_max = box_min;
+  for (int i = 0; i < number_of_faces; ++i) {
+    face_t *face = &faces[i];
+    vec3_t centroid = vec3_add(vertices[face->a],
+                               vec3_add(vertices[face->b], vertices[face->c]));
+    vec3_div(&centroid, 3.0);
+    face_centroids[i] = centroid;
+    face_normals[i] = face_unit_normal(vertices, face);
+    box_min = vec3_new(min(box_min.x, centroid.x), min(box_min.y, centroid.y),
+                       min(box_min.z, centroid.z));
+    box_max = vec3_new(max(box_max.x, centroid.x), max(box_max.y, centroid.y),
+                       max(box_max.z, centroid.z));
+
+    face_meshlet[i] = -1;
+    face_candidate_of[i] = -1;
+    vertex_face_offsets[face->a + 1]++;
+    vertex_face_offsets[face->b + 1]++;
+    vertex_face_offsets[face->c + 1]++;
+  }
+
+  // prefix sum of the face counts turns them into offsets
+  for (int v = 0; v < number_of_vertices; ++v) {
+    vertex_face_offsets[v + 1] += vertex_face_offsets[v];
+  }
+  // where the next face of every vertex gets written
+  int *vertex_cursor = malloc(sizeof(int) * number_of_vertices);
+  if (!vertex_cursor) {
+    fprintf(stderr, "Error: Could not allocate the meshlets\n");
+    exit(1);
+  }
+  for (int v = 0; v < number_of_vertices; ++v) {
+    vertex_cursor[v] = vertex_face_offsets[v];
+  }
+  for (int i = 0; i < number_of_faces; ++i) {
+    vertex_faces[vertex_cursor[faces[i].a]++] = i;
+    vertex_faces[vertex_cursor[faces[i].b]++] = i;
+    vertex_faces[vertex_cursor[faces[i].c]++] = i;
+  }
+  free(vertex_cursor);
+
+  vec3_t extent = vec3_sub(box_max, box_min);
+  for (int i = 0; i < number_of_faces; ++i) {
+    // bring the centroid into a 1024^3 grid over the bounding box
+    vec3_t grid = vec3_sub(face_centroids[i], box_min);
+    uint32_t x = extent.x > 0 ? (uint32_t)(grid.x / extent.x * 1023.0) : 0;
+    uint32_t y = extent.y > 0 ? (uint32_t)(grid.y / extent.y * 1023.0) : 0;
+    uint32_t z = extent.z > 0 ? (uint32_t)(grid.z / extent.z * 1023.0) : 0;
+
+    seed_order[i].morton_code = morton_spread_bits(x) |
+                                (morton_spread_bits(y) << 1) |
+                                (morton_spread_bits(z) << 2);
+    seed_order[i].face_index = i;
+  }
+  qsort(seed_order, number_of_faces, sizeof(face_sort_key_t),
+        compare_face_sort_keys);
+
+  int number_of_meshlets = 0;
+  int number_of_ordered_faces = 0;
+  for (int s = 0; s < number_of_faces; ++s) {
+    int face_index = seed_order[s].face_index;
+    if (face_meshlet[face_index] != -1)
+      continue;
+
+    int meshlet_index = number_of_meshlets++;
+    meshlet_t *meshlet = &built_meshlets[meshlet_index];
+    meshlet->first_face = number_of_ordered_faces;
+    meshlet->number_of_faces = 0;
+
+    vec3_t centroid_sum = {0, 0, 0};
+    vec3_t normal_sum = {0, 0, 0};
+    float radius = 0.0;
+    int number_of_candidates = 0;
+
+    while (face_index != -1) {
+      // add the face to the meshlet
+      face_meshlet[face_index] = meshlet_index;
+      face_order[number_of_ordered_faces++] = face_index;
+      meshlet->number_of_faces++;
+      centroid_sum = vec3_add(centroid_sum, face_centroids[face_index]);
+      normal_sum = vec3_add(normal_sum, face_normals[face_index]);
+
+      if (meshlet->number_of_faces == MESHLET_MAX_FACES)
+        break;
+
+      // its neighbours become candidates for the meshlet
+      int corners[3] = {faces[face_index].a, faces[face_index].b,
+                        faces[face_index].c};
+      for (int j = 0; j < 3; ++j) {
+        for (int k = vertex_face_offsets[corners[j]];
+             k < vertex_face_offsets[corners[j] + 1]; ++k) {
+          int neighbour = vertex_faces[k];
+          if (face_meshlet[neighbour] != -1 ||
+              face_candidate_of[neighbour] == meshlet_index)
+            continue;
+          face_candidate_of[neighbour] = meshlet_index;
+          candidates[number_of_candidates++] = neighbour;
+        }
+      }
+
+      vec3_t center = centroid_sum;
+      vec3_div(&center, meshlet->number_of_faces);
+      vec3_t axis = normal_sum;
+      vec3_normalize(&axis);
+      radius = max(radius,
+                   vec3_magnitude(vec3_sub(face_centroids[face_index], center)));
+
+      // pick the best candidate
+      int best_candidate = -1;
+      float best_score = 0.0;
+      for (int c = 0; c < number_of_candidates; ++c) {
+        int candidate = candidates[c];
+        float normal_dot = vec3_dot(face_normals[candidate], axis);
+        // degenerate faces do not change the cone
+        if (face_normals[candidate].x == 0 && face_normals[candidate].y == 0 &&
+            face_normals[candidate].z == 0)
+          normal_dot = 1.0;
+        if (normal_dot < MESHLET_MIN_NORMAL_DOT)
+          continue;
+
+        float distance =
+            vec3_magnitude(vec3_sub(face_centroids[candidate], center));
+        float score = distance / (radius + 1e-6) +
+                      MESHLET_CONE_WEIGHT * (1.0 - normal_dot);
+        if (best_candidate == -1 || score < best_score) {
+          best_candidate = c;
+          best_score = score;
+        }
+      }
+
+      face_index = -1;
+      if (best_candidate != -1) {
+        face_index = candidates[best_candidate];
+        // swap remove the chosen candidate
+        candidates[best_candidate] = candidates[--number_of_candidates];
+        continue;
+      }
+
+      // no connected face fits anymore(hard edges, small disconnected
+      // pieces), look for one among the next seeds which are close by along
+      // the morton curve
+      int window_end = min(s + 1 + MESHLET_SEED_WINDOW, number_of_faces);
+      for (int w = s + 1; w < window_end; ++w) {
+        int candidate = seed_order[w].face_index;
+        if (face_meshlet[candidate] != -1)
+          continue;
+        float normal_dot = vec3_dot(face_normals[candidate], axis);
+        if (face_normals[candidate].x == 0 && face_normals[candidate].y == 0 &&
+            face_normals[candidate].z == 0)
+          normal_dot = 1.0;
+        if (normal_dot < MESHLET_MIN_NORMAL_DOT)
+          continue;
+
+        float distance =
+            vec3_magnitude(vec3_sub(face_centroids[candidate], center));
+        float score = distance / (radius + 1e-6) +
+                      MESHLET_CONE_WEIGHT * (1.0 - normal_dot);
+        if (face_index == -1 || score < best_score) {
+          face_index = candidate;
+          best_score = score;
+        }
+      }
+    }
+  }
+
+  // write the faces back in meshlet order
+  for (int i = 0; i < number_of_faces; ++i) {
+    ordered_faces[i] = faces[face_order[i]];
+  }
+  for (int i = 0; i < number_of_faces; ++i) {
+    faces[i] = ordered_faces[i];
+  }
+
+  for (int m = 0; m < number_of_meshlets; ++m) {
+    meshlet_compute_bounds(vertices, faces, &built_meshlets[m]);
+  }
+
+  free(face_normals);
+  free(face_centroids);
+  free(seed_order);
+  free(vertex_face_offsets);
+  free(vertex_faces);
+  free(face_meshlet);
+  free(face_candidate_of);
+  free(candidates);
+  free(face_order);
+  free(ordered_faces);
+
+  *meshlets = realloc(built_meshlets, sizeof(meshlet_t) * number_of_meshlets);
+  return number_of_meshlets;
+}
+
+bool meshlet_is_visible(meshlet_t *meshlet, mat4_t model_view_matrix,
+                        float max_scale, bool can_cone_cull,
+                        frustum_t *frustum) {
+  vec3_t center = vec3_from_vec4(mat4_mul_vec4(
+      model_view_matrix, vec4_from_vec3(meshlet->bounding_sphere_center)));
+  float radius = meshlet->bounding_sphere_radius * max_scale;
+
+  if (!frustum_is_sphere_visible(frustum, center, radius))
+    return false;
+
+  if (!can_cone_cull || meshlet->cone_cutoff >= 1.0)
+    return true;
+
+  vec4_t axis = vec4_from_vec3(meshlet->cone_axis);
+  axis.w = 0.0; // the axis is a direction so it should not be translated
+  vec3_t cone_axis = vec3_from_vec4(mat4_mul_vec4(model_view_matrix, axis));
+  vec3_normalize(&cone_axis);
+
+  // the camera is at the origin so the center is also the vector from the
+  // camera to the meshlet. The meshlet is backfacing when every point of the
+  // sphere sees all the normals of the cone pointing away from the camera
+  float distance_to_camera = vec3_magnitude(center);
+  return vec3_dot(center, cone_axis) <
+         meshlet->cone_cutoff * distance_to_camera + radius;
+}
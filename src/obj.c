@@ -0,0 +1,494 @@
+#include "obj.h"
+#include "threads.h"
+#include "triangle.h"
+#include "vector.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// largest polygon that gets split into triangles, the rest of its corners
+// are dropped
+#define OBJ_MAX_POLYGON_CORNERS 64
+// files are only split into chunks of at least this many bytes
+#define OBJ_MIN_CHUNK_SIZE (256 * 1024)
+
+// A piece of the file that starts and ends at line boundaries. The counting
+// pass fills in how many elements of every kind it has, after the prefix sum
+// the first_* are where the filling pass writes them
+typedef struct {
+  const char *start;
+  const char *end;
+  int number_of_positions;
+  int number_of_normals;
+  int number_of_tex_coords;
+  int number_of_faces;
+  int first_position;
+  int first_normal;
+  int first_tex_coord;
+  int first_face;
+} obj_chunk_t;
+
+typedef struct {
+  obj_data_t *obj;
+  obj_chunk_t *chunks;
+} obj_job_t;
+
+// makes room for one more element of an array that doubles when it is full
+void *obj_grow(void *data, int count, int *capacity, size_t element_size) {
+  if (count < *capacity)
+    return data;
+  int new_capacity = *capacity > 0 ? *capacity * 2 : 1024;
+  void *grown = realloc(data, element_size * new_capacity);
+  if (!grown) {
+    fprintf(stderr, "Error: Could not grow the OBJ data to %d\n",
+            new_capacity);
+    exit(1);
+  }
+  *capacity = new_capacity;
+  return grown;
+}
+
+/////////////////////////////////////////////////////
+///////////////// NUMBER SCANNING ///////////////////
+/////////////////////////////////////////////////////
+
+bool obj_is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+bool obj_is_digit(char c) { return c >= '0' && c <= '9'; }
+
+void obj_skip_spaces(const char **cursor, const char *end) {
+  while (*cursor < end && obj_is_space(**cursor))
+    (*cursor)++;
+}
+
+void obj_skip_line(const char **cursor, const char *end) {
+  while (*cursor < end && **cursor != '\n')
+    (*cursor)++;
+  if (*cursor < end)
+    (*cursor)++;
+}
+
+// [-+]digits[.digits][(e|E)[-+]digits], the digits are gathered into an
+// integer and scaled once by a power of ten so there is only one rounding
+float obj_parse_float(const char **cursor, const char *end) {
+  static const double powers_of_ten[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+      1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+      1e22};
+
+  obj_skip_spaces(cursor, end);
+  const char *c = *cursor;
+  bool is_negative = false;
+  if (c < end && (*c == '-' || *c == '+')) {
+    is_negative = *c == '-';
+    c++;
+  }
+
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  int digits = 0;
+  for (; c < end && obj_is_digit(*c); ++c) {
+    // digits past what fits into the mantissa only move the exponent
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*c - '0');
+      if (mantissa)
+        digits++;
+    } else {
+      exponent++;
+    }
+  }
+  if (c < end && *c == '.') {
+    for (c++; c < end && obj_is_digit(*c); ++c) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*c - '0');
+        exponent--;
+        if (mantissa)
+          digits++;
+      }
+    }
+  }
+  if (c < end && (*c == 'e' || *c == 'E')) {
+    c++;
+    bool is_exponent_negative = false;
+    if (c < end && (*c == '-' || *c == '+')) {
+      is_exponent_negative = *c == '-';
+      c++;
+    }
+    int written_exponent = 0;
+    for (; c < end && obj_is_digit(*c); ++c) {
+      if (written_exponent < 1000)
+        written_exponent = written_exponent * 10 + (*c - '0');
+    }
+    exponent += is_exponent_negative ? -written_exponent : written_exponent;
+  }
+  *cursor = c;
+
+  double value = (double)mantissa;
+  while (exponent > 22) {
+    value *= 1e22;
+    exponent -= 22;
+  }
+  while (exponent < -22) {
+    value /= 1e22;
+    exponent += 22;
+  }
+  value = exponent >= 0 ? value * powers_of_ten[exponent]
+                        : value / powers_of_ten[-exponent];
+  return (float)(is_negative ? -value : value);
+}
+
+// [-+]digits, 0 when there are no digits
+int obj_parse_int(const char **cursor, const char *end) {
+  const char *c = *cursor;
+  bool is_negative = false;
+  if (c < end && (*c == '-' || *c == '+')) {
+    is_negative = *c == '-';
+    c++;
+  }
+  int value = 0;
+  for (; c < end && obj_is_digit(*c); ++c) {
+    value = value * 10 + (*c - '0');
+  }
+  *cursor = c;
+  return is_negative ? -value : value;
+}
+
+// OBJ indices start at 1 and negative ones count back from the last element,
+// -1 when the index is missing
+int obj_resolve_index(int index, int count) {
+  if (index > 0)
+    return index - 1;
+  if (index < 0)
+    return count + index;
+  return -1;
+}
+
+/////////////////////////////////////////////////////
+/////////////////////// PARSER //////////////////////
+/////////////////////////////////////////////////////
+
+// counts the corners of a face line without parsing them
+int obj_count_face_corners(const char **cursor, const char *end) {
+  int number_of_corners = 0;
+  while (true) {
+    obj_skip_spaces(cursor, end);
+    if (*cursor >= end || !(obj_is_digit(**cursor) || **cursor == '-'))
+      break;
+    while (*cursor < end && !obj_is_space(**cursor) && **cursor != '\n')
+      (*cursor)++;
+    number_of_corners++;
+  }
+  return number_of_corners;
+}
+
+void obj_parse_face(obj_data_t *obj, obj_chunk_t *chunk, const char **cursor,
+                    const char *end) {
+  int vertex_indices[OBJ_MAX_POLYGON_CORNERS];
+  int texture_indices[OBJ_MAX_POLYGON_CORNERS];
+  int normal_indices[OBJ_MAX_POLYGON_CORNERS];
+  int number_of_corners = 0;
+
+  // relative indices count back from what the file has up to this line
+  int number_of_positions = chunk->first_position + chunk->number_of_positions;
+  int number_of_tex_coords =
+      chunk->first_tex_coord + chunk->number_of_tex_coords;
+  int number_of_normals = chunk->first_normal + chunk->number_of_normals;
+
+  while (true) {
+    obj_skip_spaces(cursor, end);
+    if (*cursor >= end || !(obj_is_digit(**cursor) || **cursor == '-'))
+      break;
+
+    // v, v/vt, v//vn or v/vt/vn
+    int v = obj_parse_int(cursor, end);
+    int vt = 0;
+    int vn = 0;
+    if (*cursor < end && **cursor == '/') {
+      (*cursor)++;
+      if (*cursor < end && **cursor != '/')
+        vt = obj_parse_int(cursor, end);
+      if (*cursor < end && **cursor == '/') {
+        (*cursor)++;
+        vn = obj_parse_int(cursor, end);
+      }
+    }
+
+    if (number_of_corners < OBJ_MAX_POLYGON_CORNERS) {
+      vertex_indices[number_of_corners] =
+          obj_resolve_index(v, number_of_positions);
+      texture_indices[number_of_corners] =
+          obj_resolve_index(vt, number_of_tex_coords);
+      normal_indices[number_of_corners] =
+          obj_resolve_index(vn, number_of_normals);
+      number_of_corners++;
+    }
+  }
+
+  // triangle fan around the first corner
+  for (int i = 2; i < number_of_corners; ++i) {
+    obj->faces[chunk->first_face + chunk->number_of_faces++] =
+        (face_t){.a = vertex_indices[0],
+                 .b = vertex_indices[i - 1],
+                 .c = vertex_indices[i],
+                 .n_a = normal_indices[0],
+                 .n_b = normal_indices[i - 1],
+                 .n_c = normal_indices[i],
+                 .a_uv = texture_indices[0],
+                 .b_uv = texture_indices[i - 1],
+                 .c_uv = texture_indices[i],
+                 .color = 0xFFFFFFFF};
+  }
+}
+
+// The counting pass only finds out how many elements of every kind the chunk
+// has, the filling pass parses them into the arrays starting at the offsets
+// of the chunk
+void obj_parse_chunk(obj_data_t *obj, obj_chunk_t *chunk, bool is_counting) {
+  chunk->number_of_positions = 0;
+  chunk->number_of_normals = 0;
+  chunk->number_of_tex_coords = 0;
+  chunk->number_of_faces = 0;
+
+  const char *cursor = chunk->start;
+  const char *end = chunk->end;
+  while (cursor < end) {
+    obj_skip_spaces(&cursor, end);
+    const char *c = cursor;
+    if (end - c >= 2 && c[0] == 'v' && obj_is_space(c[1])) {
+      cursor += 2;
+      if (!is_counting) {
+        vec3_t position;
+        position.x = obj_parse_float(&cursor, end);
+        position.y = obj_parse_float(&cursor, end);
+        position.z = obj_parse_float(&cursor, end);
+        position.y *= -1;
+        obj->positions[chunk->first_position + chunk->number_of_positions] =
+            position;
+      }
+      chunk->number_of_positions++;
+    } else if (end - c >= 3 && c[0] == 'v' && c[1] == 'n' &&
+               obj_is_space(c[2])) {
+      cursor += 3;
+      if (!is_counting) {
+        vec3_t normal;
+        normal.x = obj_parse_float(&cursor, end);
+        normal.y = obj_parse_float(&cursor, end);
+        normal.z = obj_parse_float(&cursor, end);
+        obj->normals[chunk->first_normal + chunk->number_of_normals] = normal;
+      }
+      chunk->number_of_normals++;
+    } else if (end - c >= 3 && c[0] == 'v' && c[1] == 't' &&
+               obj_is_space(c[2])) {
+      cursor += 3;
+      if (!is_counting) {
+        tex2_t tex_coord;
+        tex_coord.u = obj_parse_float(&cursor, end);
+        tex_coord.v = obj_parse_float(&cursor, end);
+        tex_coord.v = 1.0 - tex_coord.v;
+        obj->tex_coords[chunk->first_tex_coord + chunk->number_of_tex_coords] =
+            tex_coord;
+      }
+      chunk->number_of_tex_coords++;
+    } else if (end - c >= 2 && c[0] == 'f' && obj_is_space(c[1])) {
+      cursor += 2;
+      if (is_counting) {
+        int number_of_corners = obj_count_face_corners(&cursor, end);
+        if (number_of_corners > OBJ_MAX_POLYGON_CORNERS)
+          number_of_corners = OBJ_MAX_POLYGON_CORNERS;
+        if (number_of_corners > 2)
+          chunk->number_of_faces += number_of_corners - 2;
+      } else {
+        obj_parse_face(obj, chunk, &cursor, end);
+      }
+    }
+    // comments, groups, materials and anything that is left over
+    obj_skip_line(&cursor, end);
+  }
+}
+
+void obj_count_chunk_job(void *job_data, int chunk_index, int thread_index) {
+  obj_job_t *job = (obj_job_t *)job_data;
+  obj_parse_chunk(job->obj, &job->chunks[chunk_index], true);
+}
+
+void obj_fill_chunk_job(void *job_data, int chunk_index, int thread_index) {
+  obj_job_t *job = (obj_job_t *)job_data;
+  obj_parse_chunk(job->obj, &job->chunks[chunk_index], false);
+}
+
+// corners without a normal get the flat normal of their face and corners
+// without a texture coordinate get a shared (0, 0)
+void obj_fill_missing_attributes(obj_data_t *obj) {
+  int default_tex_coord = -1;
+  for (int i = 0; i < obj->number_of_faces; ++i) {
+    face_t *face = &obj->faces[i];
+    if (face->a < 0 || face->b < 0 || face->c < 0 ||
+        face->a >= obj->number_of_positions ||
+        face->b >= obj->number_of_positions ||
+        face->c >= obj->number_of_positions) {
+      fprintf(stderr, "Error: Face %d uses a vertex that does not exist\n",
+              i + 1);
+      exit(1);
+    }
+
+    int *normal_indices[3] = {&face->n_a, &face->n_b, &face->n_c};
+    int *texture_indices[3] = {&face->a_uv, &face->b_uv, &face->c_uv};
+    int flat_normal = -1;
+    for (int j = 0; j < 3; ++j) {
+      if (*normal_indices[j] < 0 ||
+          *normal_indices[j] >= obj->number_of_normals) {
+        if (flat_normal == -1) {
+          // same winding as the back face culling
+          vec3_t ab =
+              vec3_sub(obj->positions[face->b], obj->positions[face->a]);
+          vec3_t ac =
+              vec3_sub(obj->positions[face->c], obj->positions[face->a]);
+          vec3_t normal = vec3_cross(ac, ab);
+          vec3_normalize(&normal);
+          obj->normals = obj_grow(obj->normals, obj->number_of_normals,
+                                  &obj->normals_capacity, sizeof(vec3_t));
+          obj->normals[obj->number_of_normals] = normal;
+          flat_normal = obj->number_of_normals++;
+        }
+        *normal_indices[j] = flat_normal;
+      }
+      if (*texture_indices[j] < 0 ||
+          *texture_indices[j] >= obj->number_of_tex_coords) {
+        if (default_tex_coord == -1) {
+          obj->tex_coords =
+              obj_grow(obj->tex_coords, obj->number_of_tex_coords,
+                       &obj->tex_coords_capacity, sizeof(tex2_t));
+          obj->tex_coords[obj->number_of_tex_coords] = (tex2_t){0.0, 0.0};
+          default_tex_coord = obj->number_of_tex_coords++;
+        }
+        *texture_indices[j] = default_tex_coord;
+      }
+    }
+  }
+}
+
+// runs the job over all the chunks, on the pool when there is more than one
+void obj_run_chunks(thread_pool_t *thread_pool, job_function_t function,
+                    obj_job_t *job, int number_of_chunks) {
+  if (thread_pool && number_of_chunks > 1) {
+    threads_run_job(thread_pool, function, job, number_of_chunks);
+    return;
+  }
+  for (int i = 0; i < number_of_chunks; ++i) {
+    function(job, i, 0);
+  }
+}
+
+void obj_parse(const char *data, size_t size, obj_data_t *obj,
+               thread_pool_t *thread_pool) {
+  // a few chunks per thread so that a chunk with long lines does not hold up
+  // the rest, but never chunks so small that splitting costs more than it
+  // saves
+  int number_of_chunks = 1;
+  if (thread_pool) {
+    number_of_chunks = thread_pool->number_of_threads * 4;
+    if ((size_t)number_of_chunks > size / OBJ_MIN_CHUNK_SIZE)
+      number_of_chunks = size / OBJ_MIN_CHUNK_SIZE;
+    if (number_of_chunks < 1)
+      number_of_chunks = 1;
+  }
+
+  // the chunks are cut at the first line break after every even split
+  obj_chunk_t *chunks = calloc(number_of_chunks, sizeof(obj_chunk_t));
+  if (!chunks) {
+    fprintf(stderr, "Error: Could not allocate the OBJ chunks\n");
+    exit(1);
+  }
+  const char *end = data + size;
+  const char *chunk_start = data;
+  for (int i = 0; i < number_of_chunks; ++i) {
+    const char *chunk_end = end;
+    if (i < number_of_chunks - 1) {
+      chunk_end = data + size / number_of_chunks * (i + 1);
+      if (chunk_end < chunk_start)
+        chunk_end = chunk_start;
+      obj_skip_line(&chunk_end, end);
+    }
+    chunks[i].start = chunk_start;
+    chunks[i].end = chunk_end;
+    chunk_start = chunk_end;
+  }
+
+  obj_job_t job = {.obj = obj, .chunks = chunks};
+  obj_run_chunks(thread_pool, obj_count_chunk_job, &job, number_of_chunks);
+
+  // prefix sum of the counts gives every chunk its place in the arrays
+  for (int i = 0; i < number_of_chunks; ++i) {
+    chunks[i].first_position = obj->number_of_positions;
+    chunks[i].first_normal = obj->number_of_normals;
+    chunks[i].first_tex_coord = obj->number_of_tex_coords;
+    chunks[i].first_face = obj->number_of_faces;
+    obj->number_of_positions += chunks[i].number_of_positions;
+    obj->number_of_normals += chunks[i].number_of_normals;
+    obj->number_of_tex_coords += chunks[i].number_of_tex_coords;
+    obj->number_of_faces += chunks[i].number_of_faces;
+  }
+
+  // exact sizes, only the missing attributes can still be appended
+  obj->positions_capacity = obj->number_of_positions + 1;
+  obj->normals_capacity = obj->number_of_normals + 1;
+  obj->tex_coords_capacity = obj->number_of_tex_coords + 1;
+  obj->faces_capacity = obj->number_of_faces + 1;
+  obj->positions = malloc(sizeof(vec3_t) * obj->positions_capacity);
+  obj->normals = malloc(sizeof(vec3_t) * obj->normals_capacity);
+  obj->tex_coords = malloc(sizeof(tex2_t) * obj->tex_coords_capacity);
+  obj->faces = malloc(sizeof(face_t) * obj->faces_capacity);
+  if (!obj->positions || !obj->normals || !obj->tex_coords || !obj->faces) {
+    fprintf(stderr, "Error: Could not allocate the OBJ data\n");
+    exit(1);
+  }
+
+  obj_run_chunks(thread_pool, obj_fill_chunk_job, &job, number_of_chunks);
+  free(chunks);
+}
+
+void obj_load(char *filename, obj_data_t *obj, thread_pool_t *thread_pool) {
+  *obj = (obj_data_t){0};
+
+  int file_descriptor = open(filename, O_RDONLY);
+  if (file_descriptor == -1) {
+    fprintf(stderr, "Error: Could not open file: %s\n", filename);
+    exit(1);
+  }
+  struct stat file_stat;
+  if (fstat(file_descriptor, &file_stat) == -1) {
+    fprintf(stderr, "Error: Could not read the size of: %s\n", filename);
+    exit(1);
+  }
+
+  size_t file_size = file_stat.st_size;
+  if (file_size > 0) {
+    const char *data =
+        mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    if (data == MAP_FAILED) {
+      fprintf(stderr, "Error: Could not map file: %s\n", filename);
+      exit(1);
+    }
+    // the whole file is read twice(counting and filling) so it is worth
+    // bringing it in ahead of the parser
+    madvise((void *)data, file_size, MADV_WILLNEED);
+    obj_parse(data, file_size, obj, thread_pool);
+    munmap((void *)data, file_size);
+  }
+  close(file_descriptor);
+
+  obj_fill_missing_attributes(obj);
+}
+
+void obj_free(obj_data_t *obj) {
+  free(obj->positions);
+  free(obj->normals);
+  free(obj->tex_coords);
+  free(obj->faces);
+  *obj = (obj_data_t){0};
+}
@@ -0,0 +1,122 @@
+#include "occlusion.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "triangle.h"
+#include "vector.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void occlusion_buffer_init(occlusion_buffer_t *buffer) {
+  buffer->width = OCCLUSION_BUFFER_WIDTH;
+  buffer->height = OCCLUSION_BUFFER_HEIGHT;
+  buffer->depth = malloc(sizeof(float) * buffer->width * buffer->height);
+  buffer->projected_vertices = NULL;
+  buffer->projected_vertices_capacity = 0;
+  if (!buffer->depth) {
+    fprintf(stderr, "Error: Could not allocate the occlusion buffer\n");
+    exit(1);
+  }
+  occlusion_buffer_clear(buffer);
+}
+
+void occlusion_buffer_free(occlusion_buffer_t *buffer) {
+  free(buffer->depth);
+  free(buffer->projected_vertices);
+}
+
+void occlusion_buffer_clear(occlusion_buffer_t *buffer) {
+  memset(buffer->depth, 0, sizeof(float) * buffer->width * buffer->height);
+}
+
+// Clip Space => pixels of the buffer
+vec2_t occlusion_buffer_project(occlusion_buffer_t *buffer, vec4_t v) {
+  vec2_t projected = {(v.x / v.w + 1.0) * 0.5 * buffer->width,
+                      (v.y / v.w + 1.0) * 0.5 * buffer->height};
+  return projected;
+}
+
+void occlusion_buffer_draw_mesh(occlusion_buffer_t *buffer, mesh_t *mesh,
+                                mat4_t model_view_projection_matrix) {
+  if (buffer->projected_vertices_capacity < mesh->number_of_vertices) {
+    buffer->projected_vertices_capacity = mesh->number_of_vertices;
+    buffer->projected_vertices =
+        realloc(buffer->projected_vertices,
+                sizeof(vec4_t) * buffer->projected_vertices_capacity);
+    if (!buffer->projected_vertices) {
+      fprintf(stderr, "Error: Could not grow the occluder vertices\n");
+      exit(1);
+    }
+  }
+
+  // the vertices are shared between the faces, project each of them once
+  for (int i = 0; i < mesh->number_of_vertices; ++i) {
+    buffer->projected_vertices[i] = mat4_mul_vec4(
+        model_view_projection_matrix,
+        vec4_from_vec3(mesh_get_vertex_position(mesh, &mesh->vertices[i])));
+  }
+
+  mesh_lod_t *level = &mesh->lods[0];
+  for (int i = 0; i < level->number_of_faces; ++i) {
+    uint32_t indices[3];
+    mesh_get_face_indices(mesh, level, i, indices);
+    vec4_t a = buffer->projected_vertices[indices[0]];
+    vec4_t b = buffer->projected_vertices[indices[1]];
+    vec4_t c = buffer->projected_vertices[indices[2]];
+
+    // leaving a triangle out only makes the buffer see through more
+    if (a.w < OCCLUSION_NEAR || b.w < OCCLUSION_NEAR || c.w < OCCLUSION_NEAR)
+      continue;
+
+    float farthest_depth = 1.0 / fmaxf(a.w, fmaxf(b.w, c.w));
+    draw_triangle_depth_only(occlusion_buffer_project(buffer, a),
+                             occlusion_buffer_project(buffer, b),
+                             occlusion_buffer_project(buffer, c),
+                             farthest_depth, buffer->depth, buffer->width,
+                             buffer->height);
+  }
+}
+
+bool occlusion_buffer_is_box_occluded(occlusion_buffer_t *buffer,
+                                      vec3_t box_min, vec3_t box_max,
+                                      mat4_t view_projection_matrix) {
+  // screen rectangle and nearest depth of the 8 corners
+  float x_min = buffer->width, y_min = buffer->height;
+  float x_max = 0.0, y_max = 0.0;
+  float nearest_depth = 0.0;
+  for (int i = 0; i < 8; ++i) {
+    vec3_t corner = {i & 1 ? box_max.x : box_min.x,
+                     i & 2 ? box_max.y : box_min.y,
+                     i & 4 ? box_max.z : box_min.z};
+    vec4_t projected =
+        mat4_mul_vec4(view_projection_matrix, vec4_from_vec3(corner));
+    // the box reaches the camera
+    if (projected.w < OCCLUSION_NEAR)
+      return false;
+
+    vec2_t p = occlusion_buffer_project(buffer, projected);
+    x_min = fminf(x_min, p.x);
+    y_min = fminf(y_min, p.y);
+    x_max = fmaxf(x_max, p.x);
+    y_max = fmaxf(y_max, p.y);
+    nearest_depth = fmaxf(nearest_depth, 1.0 / projected.w);
+  }
+
+  // every pixel the rectangle touches
+  int start_x = fmaxf(floorf(x_min), 0);
+  int start_y = fmaxf(floorf(y_min), 0);
+  int end_x = fminf(floorf(x_max), buffer->width - 1);
+  int end_y = fminf(floorf(y_max), buffer->height - 1);
+  if (start_x > end_x || start_y > end_y)
+    return false;
+
+  for (int y = start_y; y <= end_y; ++y) {
+    for (int x = start_x; x <= end_x; ++x) {
+      if (buffer->depth[x + buffer->width * y] <= nearest_depth)
+        return false;
+    }
+  }
+  return true;
+}
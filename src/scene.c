@@ -0,0 +1,504 @@
+#include "scene.h"
+#include "arena.h"
+#include "clipping.h"
+#include "config.h"
+#include "instance.h"
+#include "matrix.h"
+#include "occlusion.h"
+#include "threads.h"
+#include "vector.h"
+#include <float.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  scene_t *scene;
+  triangle_arena_t *thread_triangle_arenas;
+  render_stats_t *thread_stats;
+  mat4_t view_matrix;
+  mat4_t projection_matrix;
+  frustum_t *frustum;
+} scene_job_t;
+
+////////////////////////////////////////////////////////////////
+//////////////////////////// BOUNDS ////////////////////////////
+////////////////////////////////////////////////////////////////
+
+float vec3_get_axis(vec3_t v, int axis) {
+  return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+void bounds_reset(vec3_t *box_min, vec3_t *box_max) {
+  *box_min = vec3_new(FLT_MAX, FLT_MAX, FLT_MAX);
+  *box_max = vec3_new(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+void bounds_extend(vec3_t *box_min, vec3_t *box_max, vec3_t min, vec3_t max) {
+  box_min->x = min.x < box_min->x ? min.x : box_min->x;
+  box_min->y = min.y < box_min->y ? min.y : box_min->y;
+  box_min->z = min.z < box_min->z ? min.z : box_min->z;
+  box_max->x = max.x > box_max->x ? max.x : box_max->x;
+  box_max->y = max.y > box_max->y ? max.y : box_max->y;
+  box_max->z = max.z > box_max->z ? max.z : box_max->z;
+}
+
+bool bounds_equal(vec3_t a_min, vec3_t a_max, vec3_t b_min, vec3_t b_max) {
+  return a_min.x == b_min.x && a_min.y == b_min.y && a_min.z == b_min.z &&
+         a_max.x == b_max.x && a_max.y == b_max.y && a_max.z == b_max.z;
+}
+
+float bounds_surface_area(vec3_t box_min, vec3_t box_max) {
+  vec3_t size = vec3_sub(box_max, box_min);
+  if (size.x < 0 || size.y < 0 || size.z < 0)
+    return 0.0;
+  return 2.0 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+vec3_t scene_object_centroid(scene_object_t *object) {
+  vec3_t centroid =
+      vec3_add(object->bounding_box_min, object->bounding_box_max);
+  vec3_mul(&centroid, 0.5);
+  return centroid;
+}
+
+// bounds of the 8 transformed corners of the Model Space box of the mesh
+void scene_object_update_bounds(scene_object_t *object) {
+  bounds_reset(&object->bounding_box_min, &object->bounding_box_max);
+  vec3_t model_min = object->mesh->bounding_box_min;
+  vec3_t model_max = object->mesh->bounding_box_max;
+  for (int i = 0; i < 8; ++i) {
+    vec3_t corner = {i & 1 ? model_max.x : model_min.x,
+                     i & 2 ? model_max.y : model_min.y,
+                     i & 4 ? model_max.z : model_min.z};
+    vec3_t world_corner = vec3_from_vec4(mat4_mul_vec4(
+        object->instance.model_matrix, vec4_from_vec3(corner)));
+    bounds_extend(&object->bounding_box_min, &object->bounding_box_max,
+                  world_corner, world_corner);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+//////////////////////////// OBJECTS ///////////////////////////
+////////////////////////////////////////////////////////////////
+
+void scene_init(scene_t *scene, int initial_capacity) {
+  scene->capacity = initial_capacity > 0 ? initial_capacity : 1;
+  scene->number_of_objects = 0;
+  scene->number_of_occluders = 0;
+  scene->objects = malloc(sizeof(scene_object_t) * scene->capacity);
+  scene->object_order = malloc(sizeof(int) * scene->capacity);
+  scene->visible_objects = malloc(sizeof(int) * scene->capacity);
+  scene->object_leaves = malloc(sizeof(int) * scene->capacity);
+  // a binary tree with one object per leaf at most has 2n-1 nodes
+  scene->nodes = malloc(sizeof(bvh_node_t) * (2 * scene->capacity - 1));
+  scene->dirty_leaves = malloc(sizeof(int) * (2 * scene->capacity - 1));
+  if (!scene->objects || !scene->object_order || !scene->visible_objects ||
+      !scene->object_leaves || !scene->nodes || !scene->dirty_leaves) {
+    fprintf(stderr, "Error: Could not allocate the scene\n");
+    exit(1);
+  }
+  scene->number_of_nodes = 0;
+  scene->number_of_visible_objects = 0;
+  scene->is_bvh_built = false;
+  scene->number_of_dirty_leaves = 0;
+  occlusion_buffer_init(&scene->occlusion_buffer);
+}
+
+void scene_free(scene_t *scene) {
+  free(scene->objects);
+  free(scene->object_order);
+  free(scene->visible_objects);
+  free(scene->object_leaves);
+  free(scene->nodes);
+  free(scene->dirty_leaves);
+  occlusion_buffer_free(&scene->occlusion_buffer);
+}
+
+int scene_add_object(scene_t *scene, mesh_t *mesh, material_t *material,
+                     mat4_t scale_matrix, mat4_t rotation_matrix,
+                     mat4_t translation_matrix) {
+  if (scene->number_of_objects == scene->capacity) {
+    scene->capacity *= 2;
+    scene->objects =
+        realloc(scene->objects, sizeof(scene_object_t) * scene->capacity);
+    scene->object_order =
+        realloc(scene->object_order, sizeof(int) * scene->capacity);
+    scene->visible_objects =
+        realloc(scene->visible_objects, sizeof(int) * scene->capacity);
+    scene->object_leaves =
+        realloc(scene->object_leaves, sizeof(int) * scene->capacity);
+    scene->nodes =
+        realloc(scene->nodes, sizeof(bvh_node_t) * (2 * scene->capacity - 1));
+    scene->dirty_leaves =
+        realloc(scene->dirty_leaves, sizeof(int) * (2 * scene->capacity - 1));
+    if (!scene->objects || !scene->object_order || !scene->visible_objects ||
+        !scene->object_leaves || !scene->nodes || !scene->dirty_leaves) {
+      fprintf(stderr, "Error: Could not grow the scene to %d objects\n",
+              scene->capacity);
+      exit(1);
+    }
+  }
+
+  int object_id = scene->number_of_objects++;
+  scene_object_t *object = &scene->objects[object_id];
+  object->mesh = mesh;
+  object->instance = instance_new(scale_matrix, rotation_matrix,
+                                  translation_matrix, material);
+  object->is_occluder = false;
+  scene_object_update_bounds(object);
+
+  // the new object is not in the tree yet
+  scene->is_bvh_built = false;
+  return object_id;
+}
+
+void scene_set_object_transform(scene_t *scene, int object_id,
+                                mat4_t scale_matrix, mat4_t rotation_matrix,
+                                mat4_t translation_matrix) {
+  scene_object_t *object = &scene->objects[object_id];
+  object->instance.model_matrix =
+      mat4_make_model(scale_matrix, rotation_matrix, translation_matrix);
+  object->instance.rotation_matrix = rotation_matrix;
+  scene_object_update_bounds(object);
+
+  // the whole tree is built again anyway
+  if (!scene->is_bvh_built)
+    return;
+  int leaf = scene->object_leaves[object_id];
+  if (!scene->nodes[leaf].is_dirty) {
+    scene->nodes[leaf].is_dirty = true;
+    scene->dirty_leaves[scene->number_of_dirty_leaves++] = leaf;
+  }
+}
+
+void scene_set_object_occluder(scene_t *scene, int object_id,
+                               bool is_occluder) {
+  scene_object_t *object = &scene->objects[object_id];
+  if (object->is_occluder != is_occluder)
+    scene->number_of_occluders += is_occluder ? 1 : -1;
+  object->is_occluder = is_occluder;
+}
+
+////////////////////////////////////////////////////////////////
+////////////////////////// BVH BUILD ///////////////////////////
+////////////////////////////////////////////////////////////////
+
+void bvh_node_update_bounds(scene_t *scene, bvh_node_t *node) {
+  bounds_reset(&node->bounding_box_min, &node->bounding_box_max);
+  if (node->left_child == -1) {
+    for (int i = 0; i < node->number_of_objects; ++i) {
+      scene_object_t *object =
+          &scene->objects[scene->object_order[node->first_object + i]];
+      bounds_extend(&node->bounding_box_min, &node->bounding_box_max,
+                    object->bounding_box_min, object->bounding_box_max);
+    }
+    return;
+  }
+  for (int c = 0; c < 2; ++c) {
+    bvh_node_t *child = &scene->nodes[node->left_child + c];
+    bounds_extend(&node->bounding_box_min, &node->bounding_box_max,
+                  child->bounding_box_min, child->bounding_box_max);
+  }
+}
+
+// finds the split with the lowest Surface Area Heuristic cost
+// cost = area(left) * objects(left) + area(right) * objects(right)
+// Returns the number of objects that end up on the left
+int bvh_partition_sah(scene_t *scene, int first_object,
+                      int number_of_objects) {
+  int *order = &scene->object_order[first_object];
+
+  vec3_t centroid_min, centroid_max;
+  bounds_reset(&centroid_min, &centroid_max);
+  for (int i = 0; i < number_of_objects; ++i) {
+    vec3_t centroid = scene_object_centroid(&scene->objects[order[i]]);
+    bounds_extend(&centroid_min, &centroid_max, centroid, centroid);
+  }
+
+  float best_cost = FLT_MAX;
+  int best_axis = -1;
+  int best_bin = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    float axis_min = vec3_get_axis(centroid_min, axis);
+    float axis_extent = vec3_get_axis(centroid_max, axis) - axis_min;
+    if (axis_extent <= 0)
+      continue;
+
+    int bin_counts[SCENE_BVH_SAH_BINS] = {0};
+    vec3_t bin_min[SCENE_BVH_SAH_BINS], bin_max[SCENE_BVH_SAH_BINS];
+    for (int b = 0; b < SCENE_BVH_SAH_BINS; ++b) {
+      bounds_reset(&bin_min[b], &bin_max[b]);
+    }
+    for (int i = 0; i < number_of_objects; ++i) {
+      scene_object_t *object = &scene->objects[order[i]];
+      float centroid = vec3_get_axis(scene_object_centroid(object), axis);
+      int b = (centroid - axis_min) / axis_extent * SCENE_BVH_SAH_BINS;
+      b = b < SCENE_BVH_SAH_BINS ? b : SCENE_BVH_SAH_BINS - 1;
+      bin_counts[b]++;
+      bounds_extend(&bin_min[b], &bin_max[b], object->bounding_box_min,
+                    object->bounding_box_max);
+    }
+
+    // sweep from the right to get the cost of every right side
+    float right_areas[SCENE_BVH_SAH_BINS];
+    int right_counts[SCENE_BVH_SAH_BINS];
+    vec3_t sweep_min, sweep_max;
+    bounds_reset(&sweep_min, &sweep_max);
+    int count = 0;
+    for (int b = SCENE_BVH_SAH_BINS - 1; b > 0; --b) {
+      bounds_extend(&sweep_min, &sweep_max, bin_min[b], bin_max[b]);
+      count += bin_counts[b];
+      right_areas[b] = bounds_surface_area(sweep_min, sweep_max);
+      right_counts[b] = count;
+    }
+
+    // then from the left, splitting in front of bin b
+    bounds_reset(&sweep_min, &sweep_max);
+    count = 0;
+    for (int b = 1; b < SCENE_BVH_SAH_BINS; ++b) {
+      bounds_extend(&sweep_min, &sweep_max, bin_min[b - 1], bin_max[b - 1]);
+      count += bin_counts[b - 1];
+      if (count == 0 || right_counts[b] == 0)
+        continue;
+      float cost = bounds_surface_area(sweep_min, sweep_max) * count +
+                   right_areas[b] * right_counts[b];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = b;
+      }
+    }
+  }
+
+  // every centroid is at the same spot, any split is as good as the other
+  if (best_axis == -1)
+    return number_of_objects / 2;
+
+  float axis_min = vec3_get_axis(centroid_min, best_axis);
+  float axis_extent = vec3_get_axis(centroid_max, best_axis) - axis_min;
+  int left_count = 0;
+  for (int i = 0; i < number_of_objects; ++i) {
+    float centroid = vec3_get_axis(
+        scene_object_centroid(&scene->objects[order[i]]), best_axis);
+    int b = (centroid - axis_min) / axis_extent * SCENE_BVH_SAH_BINS;
+    b = b < SCENE_BVH_SAH_BINS ? b : SCENE_BVH_SAH_BINS - 1;
+    if (b < best_bin) {
+      int temp = order[left_count];
+      order[left_count++] = order[i];
+      order[i] = temp;
+    }
+  }
+  return left_count;
+}
+
+void bvh_build_node(scene_t *scene, int node_index, int parent,
+                    int first_object, int number_of_objects, int depth) {
+  bvh_node_t *node = &scene->nodes[node_index];
+  node->first_object = first_object;
+  node->number_of_objects = number_of_objects;
+  node->left_child = -1;
+  node->parent = parent;
+  node->is_dirty = false;
+
+  if (number_of_objects > SCENE_BVH_MAX_LEAF_OBJECTS) {
+    // past a certain depth the SAH splits are badly unbalanced, halving
+    // the objects from there on keeps the tree within the traversal stack
+    int left_count =
+        depth < SCENE_BVH_MAX_SAH_DEPTH
+            ? bvh_partition_sah(scene, first_object, number_of_objects)
+            : number_of_objects / 2;
+    int left_child = scene->number_of_nodes;
+    scene->number_of_nodes += 2;
+    node->left_child = left_child;
+    bvh_build_node(scene, left_child, node_index, first_object, left_count,
+                   depth + 1);
+    bvh_build_node(scene, left_child + 1, node_index, first_object + left_count,
+                   number_of_objects - left_count, depth + 1);
+  } else {
+    for (int i = 0; i < number_of_objects; ++i) {
+      scene->object_leaves[scene->object_order[first_object + i]] = node_index;
+    }
+  }
+  bvh_node_update_bounds(scene, &scene->nodes[node_index]);
+}
+
+void scene_build_bvh(scene_t *scene) {
+  for (int i = 0; i < scene->number_of_objects; ++i) {
+    scene->object_order[i] = i;
+  }
+  scene->number_of_nodes = 1;
+  bvh_build_node(scene, 0, -1, 0, scene->number_of_objects, 0);
+  scene->is_bvh_built = true;
+  scene->number_of_dirty_leaves = 0;
+}
+
+void scene_refit_bvh(scene_t *scene) {
+  for (int i = 0; i < scene->number_of_dirty_leaves; ++i) {
+    int node_index = scene->dirty_leaves[i];
+    scene->nodes[node_index].is_dirty = false;
+    // the nodes above one that kept its bounds already enclose it, two
+    // dirty leaves under the same node both pass through it so the second
+    // one sees the final bounds of the first
+    while (node_index != -1) {
+      bvh_node_t *node = &scene->nodes[node_index];
+      vec3_t old_min = node->bounding_box_min;
+      vec3_t old_max = node->bounding_box_max;
+      bvh_node_update_bounds(scene, node);
+      if (bounds_equal(old_min, old_max, node->bounding_box_min,
+                       node->bounding_box_max))
+        break;
+      node_index = node->parent;
+    }
+  }
+  scene->number_of_dirty_leaves = 0;
+}
+
+////////////////////////////////////////////////////////////////
+/////////////////////////// TRAVERSAL //////////////////////////
+////////////////////////////////////////////////////////////////
+
+void scene_collect_visible_objects(scene_t *scene, frustum_t *world_frustum,
+                                   render_stats_t *stats) {
+  scene->number_of_visible_objects = 0;
+  if (scene->number_of_objects == 0)
+    return;
+
+  // SCENE_BVH_MAX_SAH_DEPTH levels of SAH splits and then at most 31 levels
+  // of halving keep the depth[and the stack] under 64
+  int stack[64];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0) {
+    bvh_node_t *node = &scene->nodes[stack[--stack_size]];
+    box_visibility_t visibility = frustum_test_box(
+        world_frustum, node->bounding_box_min, node->bounding_box_max);
+    if (visibility == BOX_OUTSIDE) {
+      stats->culled_draws += node->number_of_objects;
+      continue;
+    }
+
+    // the whole node is inside so none of the objects below it need a test
+    if (visibility == BOX_INSIDE) {
+      for (int i = 0; i < node->number_of_objects; ++i) {
+        scene->visible_objects[scene->number_of_visible_objects++] =
+            scene->object_order[node->first_object + i];
+      }
+      continue;
+    }
+
+    if (node->left_child == -1) {
+      for (int i = 0; i < node->number_of_objects; ++i) {
+        int object_id = scene->object_order[node->first_object + i];
+        scene_object_t *object = &scene->objects[object_id];
+        if (frustum_test_box(world_frustum, object->bounding_box_min,
+                             object->bounding_box_max) == BOX_OUTSIDE) {
+          stats->culled_draws++;
+          continue;
+        }
+        scene->visible_objects[scene->number_of_visible_objects++] = object_id;
+      }
+      continue;
+    }
+
+    // push the right child first so the left one is visited first
+    stack[stack_size++] = node->left_child + 1;
+    stack[stack_size++] = node->left_child;
+  }
+}
+
+// draws the visible occluders into the occlusion buffer and removes the
+// objects completely behind them from the visible objects
+void scene_cull_occluded_objects(scene_t *scene, mat4_t view_matrix,
+                                 mat4_t projection_matrix,
+                                 render_stats_t *stats) {
+  if (scene->number_of_occluders == 0)
+    return;
+  occlusion_buffer_t *occlusion_buffer = &scene->occlusion_buffer;
+  mat4_t view_projection_matrix = mat4_mul_mat4(projection_matrix, view_matrix);
+
+  occlusion_buffer_clear(occlusion_buffer);
+  bool has_occluders = false;
+  for (int i = 0; i < scene->number_of_visible_objects; ++i) {
+    scene_object_t *object = &scene->objects[scene->visible_objects[i]];
+    // a streamed mesh would have to page in every face of its full detail
+    if (!object->is_occluder || object->mesh->stream)
+      continue;
+    occlusion_buffer_draw_mesh(
+        occlusion_buffer, object->mesh,
+        mat4_mul_mat4(view_projection_matrix, object->instance.model_matrix));
+    has_occluders = true;
+  }
+  if (!has_occluders)
+    return;
+
+  // compact the visible objects, the order stays the same
+  int number_of_unoccluded_objects = 0;
+  for (int i = 0; i < scene->number_of_visible_objects; ++i) {
+    int object_id = scene->visible_objects[i];
+    scene_object_t *object = &scene->objects[object_id];
+    // the occluders are kept, one in the buffer can not be behind itself
+    if (!object->is_occluder &&
+        occlusion_buffer_is_box_occluded(
+            occlusion_buffer, object->bounding_box_min,
+            object->bounding_box_max, view_projection_matrix)) {
+      stats->occluded_draws++;
+      continue;
+    }
+    scene->visible_objects[number_of_unoccluded_objects++] = object_id;
+  }
+  scene->number_of_visible_objects = number_of_unoccluded_objects;
+}
+
+void scene_draw_job(void *job_data, int visible_index, int thread_index) {
+  scene_job_t *job = (scene_job_t *)job_data;
+  scene_object_t *object =
+      &job->scene->objects[job->scene->visible_objects[visible_index]];
+  instance_draw(object->mesh, &object->instance,
+                &job->thread_triangle_arenas[thread_index],
+                &job->thread_stats[thread_index], job->view_matrix,
+                job->projection_matrix, job->frustum);
+}
+
+void scene_draw(scene_t *scene, thread_pool_t *thread_pool,
+                triangle_arena_t *thread_triangle_arenas,
+                render_stats_t *thread_stats, draw_list_t *draw_list,
+                mat4_t view_matrix, mat4_t projection_matrix,
+                frustum_t *frustum, render_stats_t *stats) {
+  if (!scene->is_bvh_built)
+    scene_build_bvh(scene);
+  else if (scene->number_of_dirty_leaves > 0)
+    scene_refit_bvh(scene);
+
+  // the BVH is in World Space, move the frustum there instead of moving
+  // every node into View Space
+  frustum_t world_frustum = frustum_transform(frustum, view_matrix);
+  scene_collect_visible_objects(scene, &world_frustum, stats);
+#if USE_OCCLUSION_CULLING
+  scene_cull_occluded_objects(scene, view_matrix, projection_matrix, stats);
+#endif
+
+  for (int t = 0; t < thread_pool->number_of_threads; ++t) {
+    thread_stats[t] = (render_stats_t){0};
+  }
+  scene_job_t job = {.scene = scene,
+                     .thread_triangle_arenas = thread_triangle_arenas,
+                     .thread_stats = thread_stats,
+                     .view_matrix = view_matrix,
+                     .projection_matrix = projection_matrix,
+                     .frustum = frustum};
+  threads_run_job(thread_pool, scene_draw_job, &job,
+                  scene->number_of_visible_objects);
+
+  for (int i = 0; i < scene->number_of_visible_objects; ++i) {
+    draw_call_t *draw_call =
+        &scene->objects[scene->visible_objects[i]].instance.draw_call;
+    draw_list_add(draw_list, draw_call->material, draw_call->triangle_arena,
+                  draw_call->first_triangle, draw_call->triangle_count,
+                  draw_call->depth);
+  }
+  for (int t = 0; t < thread_pool->number_of_threads; ++t) {
+    stats->culled_draws += thread_stats[t].culled_draws;
+    stats->culled_meshlets += thread_stats[t].culled_meshlets;
+  }
+}
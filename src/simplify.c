@@ -0,0 +1,465 @@
+#include "simplify.h"
+#include "triangle.h"
+#include "vector.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// symmetric 4x4 matrix of a sum of squared distances to planes
+// stored as the upper triangle: aa ab ac ad bb bc bd cc cd dd
+typedef struct {
+  double q[10];
+} quadric_t;
+
+typedef struct {
+  float cost;
+  int from; // vertex that disappears
+  int to;   // vertex it gets merged into
+  int from_version;
+  int to_version;
+} collapse_t;
+
+typedef struct {
+  int *faces;
+  int count;
+  int capacity;
+} vertex_faces_t;
+
+////////////////////////////////////////////////////////////////
+////////////////////////// QUADRICS ////////////////////////////
+////////////////////////////////////////////////////////////////
+
+quadric_t quadric_from_plane(vec3_t normal, float distance, float weight) {
+  double a = normal.x, b = normal.y, c = normal.z, d = distance;
+  quadric_t quadric = {.q = {weight * a * a, weight * a * b, weight * a * c,
+                             weight * a * d, weight * b * b, weight * b * c,
+                             weight * b * d, weight * c * c, weight * c * d,
+                             weight * d * d}};
+  return quadric;
+}
+
+void quadric_add(quadric_t *a, quadric_t *b) {
+  for (int i = 0; i < 10; ++i) {
+    a->q[i] += b->q[i];
+  }
+}
+
+// sum of the squared distances of p to all the planes of the quadric
+float quadric_error(quadric_t *quadric, vec3_t p) {
+  double *q = quadric->q;
+  double x = p.x, y = p.y, z = p.z;
+  double error = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z +
+                 2 * q[3] * x + q[4] * y * y + 2 * q[5] * y * z +
+                 2 * q[6] * y + q[7] * z * z + 2 * q[8] * z + q[9];
+  return error > 0 ? error : 0;
+}
+
+////////////////////////////////////////////////////////////////
+////////////////////// PRIORITY QUEUE //////////////////////////
+////////////////////////////////////////////////////////////////
+
+typedef struct {
+  collapse_t *entries;
+  int count;
+  int capacity;
+} collapse_heap_t;
+
+void collapse_heap_push(collapse_heap_t *heap, collapse_t collapse) {
+  if (heap->count == heap->capacity) {
+    heap->capacity = heap->capacity ? heap->capacity * 2 : 1024;
+    heap->entries =
+        realloc(heap->entries, sizeof(collapse_t) * heap->capacity);
+    if (!heap->entries) {
+      fprintf(stderr, "Error: Could not grow the simplification queue\n");
+      exit(1);
+    }
+  }
+  // sift up
+  int i = heap->count++;
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (heap->entries[parent].cost <= collapse.cost)
+      break;
+    heap->entries[i] = heap->entries[parent];
+    i = parent;
+  }
+  heap->entries[i] = collapse;
+}
+
+collapse_t collapse_heap_pop(collapse_heap_t *heap) {
+  collapse_t top = heap->entries[0];
+  collapse_t last = heap->entries[--heap->count];
+  // sift down
+  int i = 0;
+  while (true) {
+    int child = 2 * i + 1;
+    if (child >= heap->count)
+      break;
+    if (child + 1 < heap->count &&
+        heap->entries[child + 1].cost < heap->entries[child].cost)
+      child++;
+    if (last.cost <= heap->entries[child].cost)
+      break;
+    heap->entries[i] = heap->entries[child];
+    i = child;
+  }
+  if (heap->count > 0)
+    heap->entries[i] = last;
+  return top;
+}
+
+////////////////////////////////////////////////////////////////
+/////////////////////// SIMPLIFICATION /////////////////////////
+////////////////////////////////////////////////////////////////
+
+void vertex_faces_push(vertex_faces_t *list, int face) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 8;
+    list->faces = realloc(list->faces, sizeof(int) * list->capacity);
+    if (!list->faces) {
+      fprintf(stderr, "Error: Could not grow the vertex face list\n");
+      exit(1);
+    }
+  }
+  list->faces[list->count++] = face;
+}
+
+vec3_t face_normal(vec3_t a, vec3_t b, vec3_t c) {
+  return vec3_cross(vec3_sub(c, a), vec3_sub(b, a));
+}
+
+bool face_has_vertex(face_t *face, int v) {
+  return face->a == v || face->b == v || face->c == v;
+}
+
+// the corner[0,1,2] of the face that uses the vertex
+int face_corner_of(face_t *face, int v) {
+  return face->a == v ? 0 : (face->b == v ? 1 : 2);
+}
+
+void face_set_corner(face_t *face, int corner, int v, int n, int uv) {
+  if (corner == 0) {
+    face->a = v, face->n_a = n, face->a_uv = uv;
+  } else if (corner == 1) {
+    face->b = v, face->n_b = n, face->b_uv = uv;
+  } else {
+    face->c = v, face->n_c = n, face->c_uv = uv;
+  }
+}
+
+void face_get_corner(face_t *face, int corner, int *n, int *uv) {
+  *n = corner == 0 ? face->n_a : (corner == 1 ? face->n_b : face->n_c);
+  *uv = corner == 0 ? face->a_uv : (corner == 1 ? face->b_uv : face->c_uv);
+}
+
+typedef struct {
+  vec3_t *vertices;
+  face_t *faces;
+  bool *is_face_alive;
+  vertex_faces_t *vertex_faces;
+  quadric_t *quadrics;
+  int *versions;
+  int *neighbour_marks; // scratch, stamp of the last query that saw a vertex
+  int mark;
+} simplifier_t;
+
+// checks that moving `from` onto `to` does not flip any of the faces that
+// survive the collapse and does not pinch the surface[more than two shared
+// neighbours means the collapse would create non manifold geometry]
+bool is_collapse_valid(simplifier_t *s, int from, int to) {
+  // two stamps are taken up front(the neighbours of `to` and the shared ones)
+  // so that no later query can see either of them, whichever way this returns
+  s->mark += 2;
+  int mark = s->mark - 1;
+  int shared_mark = s->mark;
+  vertex_faces_t *to_faces = &s->vertex_faces[to];
+  for (int i = 0; i < to_faces->count; ++i) {
+    face_t *face = &s->faces[to_faces->faces[i]];
+    if (!s->is_face_alive[to_faces->faces[i]])
+      continue;
+    s->neighbour_marks[face->a] = mark;
+    s->neighbour_marks[face->b] = mark;
+    s->neighbour_marks[face->c] = mark;
+  }
+
+  int shared_neighbours = 0;
+  vertex_faces_t *from_faces = &s->vertex_faces[from];
+  for (int i = 0; i < from_faces->count; ++i) {
+    int f = from_faces->faces[i];
+    if (!s->is_face_alive[f])
+      continue;
+    face_t *face = &s->faces[f];
+    int corners[3] = {face->a, face->b, face->c};
+    for (int j = 0; j < 3; ++j) {
+      int v = corners[j];
+      if (v == from || v == to)
+        continue;
+      if (s->neighbour_marks[v] == mark) {
+        s->neighbour_marks[v] = shared_mark;
+        shared_neighbours++;
+      }
+    }
+
+    // faces that contain the edge disappear, the others must not flip
+    if (face_has_vertex(face, to))
+      continue;
+    vec3_t old_corners[3] = {s->vertices[face->a], s->vertices[face->b],
+                             s->vertices[face->c]};
+    vec3_t new_corners[3] = {old_corners[0], old_corners[1], old_corners[2]};
+    new_corners[face_corner_of(face, from)] = s->vertices[to];
+    vec3_t old_normal =
+        face_normal(old_corners[0], old_corners[1], old_corners[2]);
+    vec3_t new_normal =
+        face_normal(new_corners[0], new_corners[1], new_corners[2]);
+    if (vec3_dot(old_normal, new_normal) <= 0)
+      return false;
+  }
+  return shared_neighbours <= 2;
+}
+
+void push_best_collapse(simplifier_t *s, collapse_heap_t *heap, int v0,
+                        int v1) {
+  quadric_t quadric = s->quadrics[v0];
+  quadric_add(&quadric, &s->quadrics[v1]);
+  // half edge collapse: the edge is merged into one of its end points so no
+  // new vertex(and no new attributes) has to be created
+  float cost_to_v1 = quadric_error(&quadric, s->vertices[v1]);
+  float cost_to_v0 = quadric_error(&quadric, s->vertices[v0]);
+  collapse_t collapse = {.cost = cost_to_v1, .from = v0, .to = v1};
+  if (cost_to_v0 < cost_to_v1) {
+    collapse = (collapse_t){.cost = cost_to_v0, .from = v1, .to = v0};
+  }
+  collapse.from_version = s->versions[collapse.from];
+  collapse.to_version = s->versions[collapse.to];
+  collapse_heap_push(heap, collapse);
+}
+
+void apply_collapse(simplifier_t *s, int from, int to, int *live_faces) {
+  // attributes the `to` vertex uses on one of the faces that disappear, the
+  // faces that get moved over to `to` take them as well
+  int to_normal = -1;
+  int to_uv = -1;
+  vertex_faces_t *from_faces = &s->vertex_faces[from];
+  for (int i = 0; i < from_faces->count; ++i) {
+    int f = from_faces->faces[i];
+    if (!s->is_face_alive[f] || !face_has_vertex(&s->faces[f], to))
+      continue;
+    face_get_corner(&s->faces[f], face_corner_of(&s->faces[f], to),
+                    &to_normal, &to_uv);
+    s->is_face_alive[f] = false;
+    (*live_faces)--;
+  }
+
+  for (int i = 0; i < from_faces->count; ++i) {
+    int f = from_faces->faces[i];
+    if (!s->is_face_alive[f])
+      continue;
+    face_t *face = &s->faces[f];
+    int corner = face_corner_of(face, from);
+    int normal, uv;
+    face_get_corner(face, corner, &normal, &uv);
+    if (to_normal != -1) {
+      normal = to_normal;
+      uv = to_uv;
+    }
+    face_set_corner(face, corner, to, normal, uv);
+    vertex_faces_push(&s->vertex_faces[to], f);
+  }
+  from_faces->count = 0;
+
+  // drop the faces that died from the list of the surviving vertex
+  vertex_faces_t *to_faces = &s->vertex_faces[to];
+  int kept = 0;
+  for (int i = 0; i < to_faces->count; ++i) {
+    if (s->is_face_alive[to_faces->faces[i]])
+      to_faces->faces[kept++] = to_faces->faces[i];
+  }
+  to_faces->count = kept;
+
+  quadric_add(&s->quadrics[to], &s->quadrics[from]);
+  s->versions[from]++;
+  s->versions[to]++;
+}
+
+face_t *copy_live_faces(simplifier_t *s, int number_of_faces, int live_faces) {
+  face_t *level_faces =
+      malloc(sizeof(face_t) * (live_faces > 0 ? live_faces : 1));
+  if (!level_faces) {
+    fprintf(stderr, "Error: Could not allocate the simplified faces\n");
+    exit(1);
+  }
+  int count = 0;
+  for (int f = 0; f < number_of_faces; ++f) {
+    if (s->is_face_alive[f])
+      level_faces[count++] = s->faces[f];
+  }
+  return level_faces;
+}
+
+int compare_edges(const void *a, const void *b) {
+  const int *edge_a = a;
+  const int *edge_b = b;
+  if (edge_a[0] != edge_b[0])
+    return edge_a[0] - edge_b[0];
+  return edge_a[1] - edge_b[1];
+}
+
+int simplify_build_levels(vec3_t *vertices, int number_of_vertices,
+                          face_t *faces, int number_of_faces, float reduction,
+                          int max_levels, simplified_level_t *levels) {
+  if (number_of_faces == 0 || max_levels == 0)
+    return 0;
+
+  simplifier_t s = {.vertices = vertices, .mark = 0};
+  s.faces = malloc(sizeof(face_t) * number_of_faces);
+  s.is_face_alive = malloc(sizeof(bool) * number_of_faces);
+  s.vertex_faces = calloc(number_of_vertices, sizeof(vertex_faces_t));
+  s.quadrics = calloc(number_of_vertices, sizeof(quadric_t));
+  s.versions = calloc(number_of_vertices, sizeof(int));
+  s.neighbour_marks = calloc(number_of_vertices, sizeof(int));
+  // every edge as [smaller vertex, larger vertex, face]
+  int *edges = malloc(sizeof(int) * 3 * 3 * number_of_faces);
+  if (!s.faces || !s.is_face_alive || !s.vertex_faces || !s.quadrics ||
+      !s.versions || !s.neighbour_marks || !edges) {
+    fprintf(stderr, "Error: Could not allocate the simplifier\n");
+    exit(1);
+  }
+  memcpy(s.faces, faces, sizeof(face_t) * number_of_faces);
+
+  // every vertex starts with the planes of the faces around it
+  for (int f = 0; f < number_of_faces; ++f) {
+    face_t *face = &s.faces[f];
+    s.is_face_alive[f] = true;
+    vertex_faces_push(&s.vertex_faces[face->a], f);
+    vertex_faces_push(&s.vertex_faces[face->b], f);
+    vertex_faces_push(&s.vertex_faces[face->c], f);
+
+    vec3_t normal = face_normal(vertices[face->a], vertices[face->b],
+                                vertices[face->c]);
+    vec3_normalize(&normal);
+    quadric_t plane =
+        quadric_from_plane(normal, -vec3_dot(normal, vertices[face->a]), 1.0);
+    quadric_add(&s.quadrics[face->a], &plane);
+    quadric_add(&s.quadrics[face->b], &plane);
+    quadric_add(&s.quadrics[face->c], &plane);
+
+    int corners[3] = {face->a, face->b, face->c};
+    for (int j = 0; j < 3; ++j) {
+      int v0 = corners[j];
+      int v1 = corners[(j + 1) % 3];
+      int *edge = &edges[3 * (3 * f + j)];
+      edge[0] = v0 < v1 ? v0 : v1;
+      edge[1] = v0 < v1 ? v1 : v0;
+      edge[2] = f;
+    }
+  }
+
+  // sorting the edges brings the two faces of an interior edge together,
+  // the edges that only have one face are on the border of the mesh
+  int number_of_edges = 3 * number_of_faces;
+  qsort(edges, number_of_edges, sizeof(int) * 3, compare_edges);
+
+  collapse_heap_t heap = {0};
+  for (int i = 0; i < number_of_edges;) {
+    int *edge = &edges[3 * i];
+    int j = i + 1;
+    while (j < number_of_edges && edges[3 * j] == edge[0] &&
+           edges[3 * j + 1] == edge[1])
+      j++;
+
+    if (j - i == 1) {
+      // border edge: add a plane perpendicular to the face through the edge
+      // so that the border does not shrink
+      face_t *face = &s.faces[edge[2]];
+      vec3_t normal = face_normal(vertices[face->a], vertices[face->b],
+                                  vertices[face->c]);
+      vec3_t edge_direction = vec3_sub(vertices[edge[1]], vertices[edge[0]]);
+      vec3_t border_normal = vec3_cross(edge_direction, normal);
+      vec3_normalize(&border_normal);
+      quadric_t plane = quadric_from_plane(
+          border_normal, -vec3_dot(border_normal, vertices[edge[0]]),
+          SIMPLIFY_BOUNDARY_WEIGHT);
+      quadric_add(&s.quadrics[edge[0]], &plane);
+      quadric_add(&s.quadrics[edge[1]], &plane);
+    }
+    i = j;
+  }
+
+  for (int i = 0; i < number_of_edges;) {
+    int *edge = &edges[3 * i];
+    if (edge[0] != edge[1])
+      push_best_collapse(&s, &heap, edge[0], edge[1]);
+    int j = i + 1;
+    while (j < number_of_edges && edges[3 * j] == edge[0] &&
+           edges[3 * j + 1] == edge[1])
+      j++;
+    i = j;
+  }
+  free(edges);
+
+  int live_faces = number_of_faces;
+  int number_of_levels = 0;
+  int target_faces = number_of_faces * reduction;
+  float max_cost = 0.0;
+
+  while (number_of_levels < max_levels) {
+    while (live_faces > target_faces && heap.count > 0) {
+      collapse_t collapse = collapse_heap_pop(&heap);
+      // one of the vertices changed since the collapse was queued
+      if (collapse.from_version != s.versions[collapse.from] ||
+          collapse.to_version != s.versions[collapse.to])
+        continue;
+      if (!is_collapse_valid(&s, collapse.from, collapse.to))
+        continue;
+
+      if (collapse.cost > max_cost)
+        max_cost = collapse.cost;
+      apply_collapse(&s, collapse.from, collapse.to, &live_faces);
+
+      // the edges around the merged vertex have new costs
+      s.mark++;
+      vertex_faces_t *to_faces = &s.vertex_faces[collapse.to];
+      for (int i = 0; i < to_faces->count; ++i) {
+        face_t *face = &s.faces[to_faces->faces[i]];
+        int corners[3] = {face->a, face->b, face->c};
+        for (int j = 0; j < 3; ++j) {
+          int v = corners[j];
+          if (v == collapse.to || s.neighbour_marks[v] == s.mark)
+            continue;
+          s.neighbour_marks[v] = s.mark;
+          push_best_collapse(&s, &heap, collapse.to, v);
+        }
+      }
+    }
+
+    // stop once the simplification gets stuck, a level that barely has less
+    // faces than the previous one is not worth its memory
+    int previous_faces = number_of_levels > 0
+                             ? levels[number_of_levels - 1].number_of_faces
+                             : number_of_faces;
+    if (live_faces == 0 || live_faces > previous_faces * 0.9)
+      break;
+
+    simplified_level_t *level = &levels[number_of_levels++];
+    level->faces = copy_live_faces(&s, number_of_faces, live_faces);
+    level->number_of_faces = live_faces;
+    level->error = sqrtf(max_cost);
+
+    target_faces = live_faces * reduction;
+  }
+
+  for (int v = 0; v < number_of_vertices; ++v) {
+    free(s.vertex_faces[v].faces);
+  }
+  free(s.faces);
+  free(s.is_face_alive);
+  free(s.vertex_faces);
+  free(s.quadrics);
+  free(s.versions);
+  free(s.neighbour_marks);
+  free(heap.entries);
+
+  return number_of_levels;
+}
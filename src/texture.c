@@ -1,12 +1,242 @@
 #include "texture.h"
+#include "config.h"
+#include "texture_cache.h"
+#include "texture_compression.h"
+#include "utilities.h"
+#include "virtual_texture.h"
+#include <math.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-texture_t load_texture_data(char *filename) {
-  texture_t texture_data;
+// average of the 2x2 texels(per channel) of the previous level, the last
+// row/column is repeated for odd sizes
+void texture_downsample(texture_mip_t *source, texture_mip_t *destination) {
+  uint32_t *source_texels = (uint32_t *)source->data;
+  uint32_t *destination_texels = (uint32_t *)destination->data;
+  for (int y = 0; y < destination->height; ++y) {
+    int y0 = min(y * 2, source->height - 1);
+    int y1 = min(y * 2 + 1, source->height - 1);
+    for (int x = 0; x < destination->width; ++x) {
+      int x0 = min(x * 2, source->width - 1);
+      int x1 = min(x * 2 + 1, source->width - 1);
+      uint32_t texels[4] = {source_texels[x0 + source->width * y0],
+                            source_texels[x1 + source->width * y0],
+                            source_texels[x0 + source->width * y1],
+                            source_texels[x1 + source->width * y1]};
+      uint32_t result = 0;
+      for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t sum = 2;
+        for (int t = 0; t < 4; ++t) {
+          sum += (texels[t] >> shift) & 0xFF;
+        }
+        result |= (sum / 4) << shift;
+      }
+      destination_texels[x + destination->width * y] = result;
+    }
+  }
+}
+
+// copies level 0 into one allocation together with the rest of the chain
+void texture_build_mips(texture_t *texture, uint32_t *pixels) {
+  int width = texture->width;
+  int height = texture->height;
+  size_t total_texels = 0;
+  texture->number_of_mips = 0;
+  while (texture->number_of_mips < TEXTURE_MAX_MIPS) {
+    texture->mips[texture->number_of_mips++] =
+        (texture_mip_t){.width = width, .height = height};
+    total_texels += (size_t)width * height;
+    if (width == 1 && height == 1)
+      break;
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+  }
+
+  uint32_t *data = malloc(sizeof(uint32_t) * total_texels);
+  if (!data) {
+    fprintf(stderr, "Error: Could not allocate the mips of the texture\n");
+    exit(1);
+  }
+  for (int m = 0; m < texture->number_of_mips; ++m) {
+    texture->mips[m].data = data;
+    data += (size_t)texture->mips[m].width * texture->mips[m].height;
+  }
+  memcpy(texture->mips[0].data, pixels,
+         sizeof(uint32_t) * texture->width * texture->height);
+  for (int m = 1; m < texture->number_of_mips; ++m) {
+    texture_downsample(&texture->mips[m - 1], &texture->mips[m]);
+  }
+}
+
+/////////////////////////////////////////////////////
+/////////////////// COMPRESSION /////////////////////
+/////////////////////////////////////////////////////
+
+size_t texture_get_mip_size(texture_format_t format, int width, int height) {
+  size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+  switch (format) {
+  case TEXTURE_FORMAT_BC1:
+  case TEXTURE_FORMAT_BC4:
+    return blocks * 8;
+  case TEXTURE_FORMAT_BC5:
+    return blocks * 16;
+  default:
+    return (size_t)width * height * sizeof(uint32_t);
+  }
+}
+
+// The smallest format that keeps what the texels have: two channels(blue
+// always 0, opaque) => BC5, grey => BC4, alpha that is only 0 or 255 => BC1.
+// Anything else stays RGBA8
+texture_format_t texture_choose_format(texture_mip_t *level) {
+  uint32_t *texels = (uint32_t *)level->data;
+  bool is_opaque = true;
+  bool has_binary_alpha = true;
+  bool has_blue = false;
+  bool is_grey = true;
+  for (size_t i = 0; i < (size_t)level->width * level->height; ++i) {
+    uint32_t r = texels[i] & 0xFF;
+    uint32_t g = (texels[i] >> 8) & 0xFF;
+    uint32_t b = (texels[i] >> 16) & 0xFF;
+    uint32_t a = texels[i] >> 24;
+    is_opaque = is_opaque && a == 255;
+    has_binary_alpha = has_binary_alpha && (a == 0 || a == 255);
+    has_blue = has_blue || b != 0;
+    is_grey = is_grey && r == g && g == b;
+  }
+  if (is_opaque && !has_blue)
+    return TEXTURE_FORMAT_BC5;
+  if (is_opaque && is_grey)
+    return TEXTURE_FORMAT_BC4;
+  if (has_binary_alpha)
+    return TEXTURE_FORMAT_BC1;
+  return TEXTURE_FORMAT_RGBA8;
+}
+
+// encodes every level into one allocation of blocks and frees the texels
+void texture_compress(texture_t *texture, texture_format_t format) {
+  size_t total_size = 0;
+  for (int m = 0; m < texture->number_of_mips; ++m) {
+    total_size += texture_get_mip_size(format, texture->mips[m].width,
+                                       texture->mips[m].height);
+  }
+  uint8_t *blocks = malloc(total_size);
+  if (!blocks) {
+    fprintf(stderr, "Error: Could not allocate the compressed texture\n");
+    exit(1);
+  }
+
+  uint32_t *texels_to_free = (uint32_t *)texture->mips[0].data;
+  uint8_t *block = blocks;
+  for (int m = 0; m < texture->number_of_mips; ++m) {
+    texture_mip_t *level = &texture->mips[m];
+    uint32_t *texels = (uint32_t *)level->data;
+    level->data = block;
+    for (int block_y = 0; block_y < level->height; block_y += 4) {
+      for (int block_x = 0; block_x < level->width; block_x += 4) {
+        // blocks past the edge repeat the last row/column
+        uint32_t block_texels[16];
+        for (int i = 0; i < 16; ++i) {
+          int x = min(block_x + i % 4, level->width - 1);
+          int y = min(block_y + i / 4, level->height - 1);
+          block_texels[i] = texels[x + level->width * y];
+        }
+        if (format == TEXTURE_FORMAT_BC1) {
+          texture_encode_bc1_block(block_texels, block);
+          block += 8;
+        } else if (format == TEXTURE_FORMAT_BC4) {
+          texture_encode_bc4_block(block_texels, 0, block);
+          block += 8;
+        } else {
+          texture_encode_bc5_block(block_texels, block);
+          block += 16;
+        }
+      }
+    }
+  }
+  free(texels_to_free);
+  texture->format = format;
+}
+
+// decoded blocks of this thread, direct mapped by the address of the block
+typedef struct {
+  const uint8_t *block;
+  int generation;
+  uint32_t texels[16];
+} texture_cached_block_t;
+
+_Thread_local texture_cached_block_t
+    texture_block_cache[TEXTURE_BLOCK_CACHE_SIZE];
+// bumped whenever a texture is freed, a new texture can get the address of
+// the old one and the threads must not hand out its blocks
+atomic_int texture_generation;
+
+uint32_t texture_fetch_texel(texture_format_t format, const void *data,
+                             int width, int x, int y) {
+  if (format == TEXTURE_FORMAT_RGBA8)
+    return ((const uint32_t *)data)[x + width * y];
+
+  size_t block_size = format == TEXTURE_FORMAT_BC5 ? 16 : 8;
+  size_t block_index = x / 4 + (size_t)(width + 3) / 4 * (y / 4);
+  const uint8_t *block = (const uint8_t *)data + block_index * block_size;
+  int generation = atomic_load_explicit(&texture_generation,
+                                        memory_order_relaxed);
+
+  texture_cached_block_t *cached =
+      &texture_block_cache[((uintptr_t)block / block_size) &
+                           (TEXTURE_BLOCK_CACHE_SIZE - 1)];
+  if (cached->block != block || cached->generation != generation) {
+    if (format == TEXTURE_FORMAT_BC1)
+      texture_decode_bc1_block(block, cached->texels);
+    else if (format == TEXTURE_FORMAT_BC4)
+      texture_decode_bc4_block(block, cached->texels);
+    else
+      texture_decode_bc5_block(block, cached->texels);
+    cached->block = block;
+    cached->generation = generation;
+  }
+  return cached->texels[(x % 4) + (y % 4) * 4];
+}
+
+void texture_invalidate_block_cache(void) {
+  atomic_fetch_add(&texture_generation, 1);
+}
+
+uint32_t texture_fetch(texture_t *texture, int x, int y, int level) {
+  if (texture->virtual_texture)
+    return virtual_texture_fetch(texture->virtual_texture, x, y, level);
+
+  texture_mip_t *mip = &texture->mips[level];
+  // odd sizes round down, the last row/column stands in for the rest
+  int mip_x = x >> level < mip->width ? x >> level : mip->width - 1;
+  int mip_y = y >> level < mip->height ? y >> level : mip->height - 1;
+  return texture_fetch_texel(texture->format, mip->data, mip->width, mip_x,
+                             mip_y);
+}
+
+int texture_get_mip_level(texture_t *texture, tex2_t t0, tex2_t t1, tex2_t t2,
+                          float screen_area) {
+  float texel_area = fabsf((t1.u - t0.u) * (t2.v - t0.v) -
+                           (t2.u - t0.u) * (t1.v - t0.v)) *
+                     texture->width * texture->height;
+  if (screen_area <= 0 || texel_area <= screen_area)
+    return 0;
+  // every level halves the texels on each side
+  int level = (int)(0.5 * log2f(texel_area / screen_area));
+  return level < texture->number_of_mips - 1 ? level
+                                             : texture->number_of_mips - 1;
+}
+
+// the image decoded into RGBA8 levels, compressed when it is enabled
+texture_t texture_decode_image(char *filename) {
+  texture_t texture_data = {0};
   unsigned char *data =
       stbi_load(filename, &texture_data.width, &texture_data.height,
                 &texture_data.no_of_channels, 4);
@@ -14,11 +244,70 @@ texture_t load_texture_data(char *filename) {
     fprintf(stderr, "Error loading texture data\n");
     exit(1);
   }
+  texture_data.format = TEXTURE_FORMAT_RGBA8;
+  texture_build_mips(&texture_data, (uint32_t *)data);
+  stbi_image_free(data);
+#if USE_TEXTURE_COMPRESSION
+  texture_format_t format = texture_choose_format(&texture_data.mips[0]);
+  if (format != TEXTURE_FORMAT_RGBA8)
+    texture_compress(&texture_data, format);
+#endif
+  return texture_data;
+}
+
+texture_t load_texture_data(char *filename, uint64_t source_hash) {
+  texture_t texture_data = {0};
+#if USE_TEXTURE_CACHE
+  // the image is only decoded when there is no cache of it yet or the file
+  // changed since the cache was written
+  char *cache_filename = texture_cache_filename(filename);
+  if (!texture_cache_load(cache_filename, source_hash, &texture_data)) {
+    texture_data = texture_decode_image(filename);
+    texture_cache_save(cache_filename, source_hash, &texture_data);
+#if USE_VIRTUAL_TEXTURES
+    // a virtual texture pages in from the file, the decoded levels would keep
+    // all of it resident
+    texture_t mapped_texture;
+    if (virtual_texture_is_needed(&texture_data) &&
+        texture_cache_load(cache_filename, source_hash, &mapped_texture)) {
+      free_texture_data(texture_data);
+      texture_data = mapped_texture;
+    }
+#endif
+  }
+  free(cache_filename);
+#else
+  texture_data = texture_decode_image(filename);
+#endif
 
-  texture_data.data = (uint32_t *)data;
+#if USE_VIRTUAL_TEXTURES
+  if (virtual_texture_is_needed(&texture_data))
+    texture_data.virtual_texture = virtual_texture_create(&texture_data);
+#endif
   return texture_data;
 }
 
+void free_texture_data(texture_t texture) {
+  texture_invalidate_block_cache();
+  if (texture.virtual_texture)
+    virtual_texture_free(texture.virtual_texture);
+  if (texture.mapping)
+    munmap(texture.mapping, texture.mapping_size);
+  else
+    free(texture.mips[0].data);
+}
+
+size_t texture_get_size(texture_t *texture) {
+  if (texture->virtual_texture)
+    return virtual_texture_get_size(texture->virtual_texture);
+  size_t bytes = 0;
+  for (int m = 0; m < texture->number_of_mips; ++m) {
+    bytes += texture_get_mip_size(texture->format, texture->mips[m].width,
+                                  texture->mips[m].height);
+  }
+  return bytes;
+}
+
 tex2_t tex2_clone(tex2_t *t) {
   tex2_t new_tex_coord = {.u = t->u, .v = t->v};
   return new_tex_coord;
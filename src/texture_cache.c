@@ -0,0 +1,130 @@
+#include "texture_cache.h"
+#include "config.h"
+#include "texture.h"
+#include "utilities.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+char *texture_cache_filename(char *image_filename) {
+  return filename_replace_extension(image_filename, ".rtex");
+}
+
+uint64_t texture_cache_hash_file(char *filename) {
+  int settings[] = {TEXTURE_CACHE_VERSION, TEXTURE_MAX_MIPS,
+                    USE_TEXTURE_COMPRESSION};
+  uint64_t hash = hash_fnv1a(HASH_SEED, settings, sizeof(settings));
+  return hash_file(hash, filename);
+}
+
+bool texture_cache_load(char *cache_filename, uint64_t source_hash,
+                        texture_t *texture) {
+  int file_descriptor = open(cache_filename, O_RDONLY);
+  if (file_descriptor == -1)
+    return false;
+  struct stat file_stat;
+  if (fstat(file_descriptor, &file_stat) == -1 ||
+      (size_t)file_stat.st_size < sizeof(texture_cache_header_t)) {
+    close(file_descriptor);
+    return false;
+  }
+  size_t file_size = file_stat.st_size;
+  char *data =
+      mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  close(file_descriptor);
+  if (data == MAP_FAILED)
+    return false;
+
+  // a stale or truncated cache is rebuilt, never trusted
+  texture_cache_header_t *header = (texture_cache_header_t *)data;
+  bool is_valid = memcmp(header->magic, "RTEX", 4) == 0 &&
+                  header->version == TEXTURE_CACHE_VERSION &&
+                  header->source_hash == source_hash &&
+                  header->file_size == file_size &&
+                  header->format >= TEXTURE_FORMAT_RGBA8 &&
+                  header->format <= TEXTURE_FORMAT_BC5 &&
+                  header->number_of_mips >= 1 &&
+                  header->number_of_mips <= TEXTURE_MAX_MIPS;
+  for (int m = 0; is_valid && m < header->number_of_mips; ++m) {
+    texture_cache_mip_t *mip = &header->mips[m];
+    is_valid = mip->width > 0 && mip->height > 0 &&
+               mip->offset % TEXTURE_CACHE_ALIGNMENT == 0 &&
+               mip->offset <= file_size &&
+               texture_get_mip_size(header->format, mip->width,
+                                    mip->height) <= file_size - mip->offset;
+  }
+  if (!is_valid) {
+    munmap(data, file_size);
+    return false;
+  }
+
+  *texture = (texture_t){.format = header->format,
+                         .no_of_channels = header->no_of_channels,
+                         .number_of_mips = header->number_of_mips,
+                         .mapping = data,
+                         .mapping_size = file_size};
+  for (int m = 0; m < header->number_of_mips; ++m) {
+    texture->mips[m] =
+        (texture_mip_t){.width = header->mips[m].width,
+                        .height = header->mips[m].height,
+                        .data = data + header->mips[m].offset};
+  }
+  texture->width = texture->mips[0].width;
+  texture->height = texture->mips[0].height;
+  return true;
+}
+
+void texture_cache_save(char *cache_filename, uint64_t source_hash,
+                        texture_t *texture) {
+  texture_cache_header_t header = {.magic = {'R', 'T', 'E', 'X'},
+                                   .version = TEXTURE_CACHE_VERSION,
+                                   .source_hash = source_hash,
+                                   .format = texture->format,
+                                   .no_of_channels = texture->no_of_channels,
+                                   .number_of_mips = texture->number_of_mips};
+  size_t offset =
+      align_up(sizeof(texture_cache_header_t), TEXTURE_CACHE_ALIGNMENT);
+  for (int m = 0; m < texture->number_of_mips; ++m) {
+    texture_mip_t *mip = &texture->mips[m];
+    header.mips[m] = (texture_cache_mip_t){
+        .offset = offset, .width = mip->width, .height = mip->height};
+    offset = align_up(offset + texture_get_mip_size(texture->format,
+                                                    mip->width, mip->height),
+                      TEXTURE_CACHE_ALIGNMENT);
+  }
+  header.file_size = offset;
+
+  // written next to the cache and renamed over it once complete, so a crash
+  // half way never leaves a truncated cache behind
+  char *temporary_filename = filename_append(cache_filename, ".tmp");
+  FILE *file = fopen(temporary_filename, "wb");
+  if (!file) {
+    fprintf(stderr, "Warning: Could not write the texture cache: %s\n",
+            cache_filename);
+    free(temporary_filename);
+    return;
+  }
+  bool is_written = file_write_at(file, 0, &header, sizeof(header));
+  for (int m = 0; is_written && m < texture->number_of_mips; ++m) {
+    texture_mip_t *mip = &texture->mips[m];
+    is_written = file_write_at(
+        file, header.mips[m].offset, mip->data,
+        texture_get_mip_size(texture->format, mip->width, mip->height));
+  }
+  // pad the end so the size matches the header
+  is_written = is_written && file_write_at(file, header.file_size, "", 0);
+  is_written = fclose(file) == 0 && is_written;
+
+  if (!is_written || rename(temporary_filename, cache_filename) != 0) {
+    fprintf(stderr, "Warning: Could not write the texture cache: %s\n",
+            cache_filename);
+    remove(temporary_filename);
+  }
+  free(temporary_filename);
+}
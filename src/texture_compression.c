@@ -0,0 +1,286 @@
+#include "texture_compression.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/////////////////////////////////////////////////////
+/////////////////////// BC1 /////////////////////////
+/////////////////////////////////////////////////////
+
+uint16_t texture_pack_565(float r, float g, float b) {
+  int r5 = (int)(r * 31.0 / 255.0 + 0.5);
+  int g6 = (int)(g * 63.0 / 255.0 + 0.5);
+  int b5 = (int)(b * 31.0 / 255.0 + 0.5);
+  r5 = r5 < 0 ? 0 : (r5 > 31 ? 31 : r5);
+  g6 = g6 < 0 ? 0 : (g6 > 63 ? 63 : g6);
+  b5 = b5 < 0 ? 0 : (b5 > 31 ? 31 : b5);
+  return (uint16_t)((r5 << 11) | (g6 << 5) | b5);
+}
+
+uint32_t texture_unpack_565(uint16_t color) {
+  uint32_t r5 = (color >> 11) & 0x1F;
+  uint32_t g6 = (color >> 5) & 0x3F;
+  uint32_t b5 = color & 0x1F;
+  uint32_t r = (r5 << 3) | (r5 >> 2);
+  uint32_t g = (g6 << 2) | (g6 >> 4);
+  uint32_t b = (b5 << 3) | (b5 >> 2);
+  return 0xFF000000 | (b << 16) | (g << 8) | r;
+}
+
+// weighted average of two texels, per channel
+uint32_t texture_mix(uint32_t a, uint32_t b, int weight_a, int weight_b) {
+  uint32_t result = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    uint32_t channel = (((a >> shift) & 0xFF) * weight_a +
+                        ((b >> shift) & 0xFF) * weight_b) /
+                       (weight_a + weight_b);
+    result |= channel << shift;
+  }
+  return result;
+}
+
+// the colors the indices of a block pick from, the same for the encoder and
+// the decoder so the encoder measures exactly what gets decoded
+void texture_bc1_palette(uint16_t color0, uint16_t color1,
+                         uint32_t palette[4]) {
+  palette[0] = texture_unpack_565(color0);
+  palette[1] = texture_unpack_565(color1);
+  if (color0 > color1) {
+    palette[2] = texture_mix(palette[0], palette[1], 2, 1);
+    palette[3] = texture_mix(palette[0], palette[1], 1, 2);
+  } else {
+    // 3 colors and transparent black
+    palette[2] = texture_mix(palette[0], palette[1], 1, 1);
+    palette[3] = 0x00000000;
+  }
+}
+
+int texture_color_distance(uint32_t a, uint32_t b) {
+  int distance = 0;
+  for (int shift = 0; shift < 24; shift += 8) {
+    int d = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+    distance += d * d;
+  }
+  return distance;
+}
+
+void texture_encode_bc1_block(uint32_t texels[16], uint8_t block[8]) {
+  // only the opaque texels decide the endpoints
+  float colors[16][3];
+  int number_of_colors = 0;
+  bool has_transparent = false;
+  float mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; ++i) {
+    if ((texels[i] >> 24) < 128) {
+      has_transparent = true;
+      continue;
+    }
+    for (int c = 0; c < 3; ++c) {
+      colors[number_of_colors][c] = (texels[i] >> (c * 8)) & 0xFF;
+      mean[c] += colors[number_of_colors][c];
+    }
+    number_of_colors++;
+  }
+
+  uint16_t color0 = 0;
+  uint16_t color1 = 0;
+  if (number_of_colors > 0) {
+    for (int c = 0; c < 3; ++c) {
+      mean[c] /= number_of_colors;
+    }
+
+    // the endpoints are the two colors furthest apart along the principal
+    // axis of the colors(a few power iterations of the covariance)
+    float covariance[3][3] = {{0}};
+    for (int i = 0; i < number_of_colors; ++i) {
+      for (int a = 0; a < 3; ++a) {
+        for (int b = 0; b < 3; ++b) {
+          covariance[a][b] +=
+              (colors[i][a] - mean[a]) * (colors[i][b] - mean[b]);
+        }
+      }
+    }
+    float axis[3] = {1, 1, 1};
+    for (int iteration = 0; iteration < 8; ++iteration) {
+      float next[3];
+      for (int a = 0; a < 3; ++a) {
+        next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] +
+                  covariance[a][2] * axis[2];
+      }
+      float length =
+          sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+      if (length < 1e-6)
+        break;
+      for (int a = 0; a < 3; ++a) {
+        axis[a] = next[a] / length;
+      }
+    }
+
+    int lowest = 0;
+    int highest = 0;
+    float lowest_projection = INFINITY;
+    float highest_projection = -INFINITY;
+    for (int i = 0; i < number_of_colors; ++i) {
+      float projection = colors[i][0] * axis[0] + colors[i][1] * axis[1] +
+                         colors[i][2] * axis[2];
+      if (projection < lowest_projection) {
+        lowest_projection = projection;
+        lowest = i;
+      }
+      if (projection > highest_projection) {
+        highest_projection = projection;
+        highest = i;
+      }
+    }
+    color0 = texture_pack_565(colors[highest][0], colors[highest][1],
+                              colors[highest][2]);
+    color1 = texture_pack_565(colors[lowest][0], colors[lowest][1],
+                              colors[lowest][2]);
+  }
+
+  // color0 > color1 selects 4 colors, anything else 3 colors and transparent
+  if ((has_transparent && color0 > color1) ||
+      (!has_transparent && color0 < color1)) {
+    uint16_t swap = color0;
+    color0 = color1;
+    color1 = swap;
+  }
+
+  uint32_t palette[4];
+  texture_bc1_palette(color0, color1, palette);
+  int number_of_opaque_entries = color0 > color1 ? 4 : 3;
+  uint32_t indices = 0;
+  for (int i = 0; i < 16; ++i) {
+    int best_index = 3;
+    if ((texels[i] >> 24) >= 128) {
+      int best_distance = texture_color_distance(texels[i], palette[0]);
+      best_index = 0;
+      for (int p = 1; p < number_of_opaque_entries; ++p) {
+        int distance = texture_color_distance(texels[i], palette[p]);
+        if (distance < best_distance) {
+          best_distance = distance;
+          best_index = p;
+        }
+      }
+    }
+    indices |= (uint32_t)best_index << (i * 2);
+  }
+
+  block[0] = color0 & 0xFF;
+  block[1] = color0 >> 8;
+  block[2] = color1 & 0xFF;
+  block[3] = color1 >> 8;
+  for (int b = 0; b < 4; ++b) {
+    block[4 + b] = (indices >> (b * 8)) & 0xFF;
+  }
+}
+
+void texture_decode_bc1_block(const uint8_t block[8], uint32_t texels[16]) {
+  uint16_t color0 = block[0] | (block[1] << 8);
+  uint16_t color1 = block[2] | (block[3] << 8);
+  uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) |
+                     ((uint32_t)block[7] << 24);
+  uint32_t palette[4];
+  texture_bc1_palette(color0, color1, palette);
+  for (int i = 0; i < 16; ++i) {
+    texels[i] = palette[(indices >> (i * 2)) & 0x3];
+  }
+}
+
+/////////////////////////////////////////////////////
+/////////////////////// BC4 /////////////////////////
+/////////////////////////////////////////////////////
+
+void texture_bc4_palette(uint8_t value0, uint8_t value1, int palette[8]) {
+  palette[0] = value0;
+  palette[1] = value1;
+  if (value0 > value1) {
+    for (int p = 1; p < 7; ++p) {
+      palette[p + 1] = ((7 - p) * value0 + p * value1) / 7;
+    }
+  } else {
+    // 4 values in between and the two extremes
+    for (int p = 1; p < 5; ++p) {
+      palette[p + 1] = ((5 - p) * value0 + p * value1) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+void texture_encode_bc4_block(uint32_t texels[16], int shift,
+                              uint8_t block[8]) {
+  int values[16];
+  int lowest = 255;
+  int highest = 0;
+  for (int i = 0; i < 16; ++i) {
+    values[i] = (texels[i] >> shift) & 0xFF;
+    lowest = values[i] < lowest ? values[i] : lowest;
+    highest = values[i] > highest ? values[i] : highest;
+  }
+
+  // highest > lowest selects the 8 value mode that spans the whole range
+  int palette[8];
+  texture_bc4_palette(highest, lowest, palette);
+  uint64_t indices = 0;
+  for (int i = 0; i < 16; ++i) {
+    int best_index = 0;
+    int best_distance = 256;
+    for (int p = 0; p < 8; ++p) {
+      int distance = values[i] > palette[p] ? values[i] - palette[p]
+                                            : palette[p] - values[i];
+      if (distance < best_distance) {
+        best_distance = distance;
+        best_index = p;
+      }
+    }
+    indices |= (uint64_t)best_index << (i * 3);
+  }
+
+  block[0] = highest;
+  block[1] = lowest;
+  for (int b = 0; b < 6; ++b) {
+    block[2 + b] = (indices >> (b * 8)) & 0xFF;
+  }
+}
+
+// the 16 values of the channel of a BC4 block
+void texture_decode_bc4_values(const uint8_t block[8], int values[16]) {
+  int palette[8];
+  texture_bc4_palette(block[0], block[1], palette);
+  uint64_t indices = 0;
+  for (int b = 0; b < 6; ++b) {
+    indices |= (uint64_t)block[2 + b] << (b * 8);
+  }
+  for (int i = 0; i < 16; ++i) {
+    values[i] = palette[(indices >> (i * 3)) & 0x7];
+  }
+}
+
+void texture_decode_bc4_block(const uint8_t block[8], uint32_t texels[16]) {
+  int values[16];
+  texture_decode_bc4_values(block, values);
+  // the one channel is grey, it goes back into all three
+  for (int i = 0; i < 16; ++i) {
+    texels[i] = 0xFF000000 | values[i] << 16 | values[i] << 8 | values[i];
+  }
+}
+
+/////////////////////////////////////////////////////
+/////////////////////// BC5 /////////////////////////
+/////////////////////////////////////////////////////
+
+void texture_encode_bc5_block(uint32_t texels[16], uint8_t block[16]) {
+  texture_encode_bc4_block(texels, 0, block);
+  texture_encode_bc4_block(texels, 8, block + 8);
+}
+
+void texture_decode_bc5_block(const uint8_t block[16], uint32_t texels[16]) {
+  int red[16];
+  int green[16];
+  texture_decode_bc4_values(block, red);
+  texture_decode_bc4_values(block + 8, green);
+  for (int i = 0; i < 16; ++i) {
+    texels[i] = 0xFF000000 | (green[i] << 8) | red[i];
+  }
+}
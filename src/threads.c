@@ -1,123 +1,368 @@
 #include "threads.h"
 #include "appstate.h"
 #include "config.h"
+#include "display.h"
 #include "triangle.h"
+#include "utilities.h"
 #include <pthread.h>
-#include <semaphore.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
-void threads_initialize(app_state_t *app_state, pthread_t **thread_pool,
-                        thread_t **thread_data, sem_t **start_signals,
-                        sem_t **done_signals, atomic_int *tile_counter,
-                        bool *is_main_thread_running, material_t *base_material,
-                        material_t *skybox_material, scene_info_t *scene_info) {
+// index of the thread in the pool, the main thread is 0 and any thread outside
+// of the pool -1
+static _Thread_local int thread_current_index = -1;
 
+/////////////////////////////////////////////////////
+/////////////////////// DEQUE ///////////////////////
+/////////////////////////////////////////////////////
+
+// only called by the owner, false when the deque is full
+bool thread_deque_push(thread_deque_t *deque, job_t *job) {
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  if (bottom - top >= THREADS_DEQUE_SIZE)
+    return false;
+  atomic_store_explicit(&deque->slots[bottom & (THREADS_DEQUE_SIZE - 1)], job,
+                        memory_order_relaxed);
+  // the slot is written before the stealers can see it
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+  return true;
+}
+
+// only called by the owner, takes the job pushed last
+job_t *thread_deque_pop(thread_deque_t *deque) {
+  // the bottom is moved before the top is read(both sequentially
+  // consistent) so a stealer and the owner can not both take the last job
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store(&deque->bottom, bottom);
+  long top = atomic_load(&deque->top);
+  if (top > bottom) {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return NULL;
+  }
+  job_t *job = atomic_load_explicit(
+      &deque->slots[bottom & (THREADS_DEQUE_SIZE - 1)], memory_order_relaxed);
+  if (top == bottom) {
+    // the last job, whoever moves the top gets it
+    if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1))
+      job = NULL;
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return job;
+}
+
+// called by the other threads, takes the job pushed first
+job_t *thread_deque_steal(thread_deque_t *deque) {
+  long top = atomic_load(&deque->top);
+  long bottom = atomic_load(&deque->bottom);
+  if (top >= bottom)
+    return NULL;
+  job_t *job = atomic_load_explicit(
+      &deque->slots[top & (THREADS_DEQUE_SIZE - 1)], memory_order_relaxed);
+  // another thread got it first
+  if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1))
+    return NULL;
+  return job;
+}
+
+/////////////////////////////////////////////////////
+/////////////////////// JOBS ////////////////////////
+/////////////////////////////////////////////////////
+
+// wakes the sleeping threads, the sleepers count themselves before they check
+// for work(both sequentially consistent) so none of them is missed
+void threads_wake(thread_pool_t *thread_pool) {
+  if (atomic_load(&thread_pool->sleeping_threads) == 0)
+    return;
+  pthread_mutex_lock(&thread_pool->lock);
+  pthread_cond_broadcast(&thread_pool->wake_signal);
+  pthread_mutex_unlock(&thread_pool->lock);
+}
+
+void threads_run_indices(thread_pool_t *thread_pool, job_t *job,
+                         int thread_index);
+
+// a thread outside of the pool has no deque, the job is queued under the lock
+// and the threads of the pool take it once their deques are empty
+void threads_inject(thread_pool_t *thread_pool, job_t *job,
+                    int number_of_slots) {
+  pthread_mutex_lock(&thread_pool->lock);
+  job->injected_slots = number_of_slots;
+  job->next_injected = thread_pool->injected_jobs;
+  thread_pool->injected_jobs = job;
+  atomic_fetch_add(&thread_pool->number_of_injected, number_of_slots);
+  atomic_fetch_add(&thread_pool->queued_jobs, number_of_slots);
+  pthread_mutex_unlock(&thread_pool->lock);
+  threads_wake(thread_pool);
+}
+
+// one slot of an injected job, NULL when there is none
+job_t *threads_take_injected(thread_pool_t *thread_pool) {
+  if (atomic_load(&thread_pool->number_of_injected) == 0)
+    return NULL;
+  pthread_mutex_lock(&thread_pool->lock);
+  job_t *job = thread_pool->injected_jobs;
+  if (job) {
+    atomic_fetch_sub(&thread_pool->number_of_injected, 1);
+    if (--job->injected_slots == 0)
+      thread_pool->injected_jobs = job->next_injected;
+  }
+  pthread_mutex_unlock(&thread_pool->lock);
+  return job;
+}
+
+// hands the job to the threads through the deque of the calling thread
+void threads_push(thread_pool_t *thread_pool, job_t *job, int thread_index) {
+  // a slot per thread that can help, the indices are shared out through
+  // next_index
+  int number_of_slots = job->count < thread_pool->number_of_threads
+                            ? job->count
+                            : thread_pool->number_of_threads;
+  atomic_store(&job->references, number_of_slots);
+  if (thread_index < 0) {
+    threads_inject(thread_pool, job, number_of_slots);
+    return;
+  }
+  for (int s = 0; s < number_of_slots; ++s) {
+    if (thread_deque_push(&thread_pool->deques[thread_index], job)) {
+      atomic_fetch_add(&thread_pool->queued_jobs, 1);
+      threads_wake(thread_pool);
+    } else {
+      // the deque is full, the thread helps right away instead
+      threads_run_indices(thread_pool, job, thread_index);
+    }
+  }
+}
+
+// the last index of the job ran, the threads waiting on its counter are woken
+void threads_finish(thread_pool_t *thread_pool, job_t *job) {
+  // the job(and maybe the counter) can be gone as soon as the counter is 0
+  threads_counter_t *counter = job->counter;
+  if (atomic_fetch_sub(&counter->value, 1) != 1)
+    return;
+
+  pthread_mutex_lock(&thread_pool->lock);
+  pthread_cond_broadcast(&thread_pool->wake_signal);
+  pthread_mutex_unlock(&thread_pool->lock);
+}
+
+// runs indices of the job till none is left and lets go of it
+void threads_run_indices(thread_pool_t *thread_pool, job_t *job,
+                         int thread_index) {
+  while (true) {
+    int job_index = atomic_fetch_add(&job->next_index, 1);
+    if (job_index >= job->count)
+      break;
+    job->function(job->data, job_index, thread_index);
+  }
+  if (atomic_fetch_sub(&job->references, 1) == 1)
+    threads_finish(thread_pool, job);
+}
+
+// Runs indices of a job the thread does not wait for only till `counter` is 0,
+// so a wait does not turn into drawing every tile of the frame. What is left
+// goes back into the deque of the thread for the others
+void threads_help(thread_pool_t *thread_pool, job_t *job, int thread_index,
+                  threads_counter_t *counter) {
+  while (atomic_load(&counter->value) > 0) {
+    int job_index = atomic_fetch_add(&job->next_index, 1);
+    if (job_index >= job->count)
+      break;
+    job->function(job->data, job_index, thread_index);
+  }
+  // the job keeps the reference of the slot
+  if (atomic_load(&job->next_index) < job->count &&
+      thread_deque_push(&thread_pool->deques[thread_index], job)) {
+    atomic_fetch_add(&thread_pool->queued_jobs, 1);
+    threads_wake(thread_pool);
+    return;
+  }
+  // nothing left or no room to hand it back
+  threads_run_indices(thread_pool, job, thread_index);
+}
+
+// a job from the own deque, stolen from another thread or injected from
+// outside of the pool, NULL when there is none
+job_t *threads_find_job(thread_pool_t *thread_pool, int thread_index) {
+  job_t *job = thread_deque_pop(&thread_pool->deques[thread_index]);
+  for (int i = 1; !job && i < thread_pool->number_of_threads; ++i) {
+    int victim = (thread_index + i) % thread_pool->number_of_threads;
+    job = thread_deque_steal(&thread_pool->deques[victim]);
+  }
+  if (!job)
+    job = threads_take_injected(thread_pool);
+  if (job)
+    atomic_fetch_sub(&thread_pool->queued_jobs, 1);
+  return job;
+}
+
+void threads_submit(thread_pool_t *thread_pool, job_t *job,
+                    job_function_t function, void *data, int count,
+                    threads_counter_t *counter) {
+  *job = (job_t){.function = function,
+                 .data = data,
+                 .count = count,
+                 .counter = counter};
+  if (count <= 0)
+    return;
+  atomic_fetch_add(&counter->value, 1);
+  threads_push(thread_pool, job, thread_current_index);
+}
+
+void threads_wait(thread_pool_t *thread_pool, threads_counter_t *counter) {
+  int thread_index = thread_current_index;
+  if (thread_index < 0) {
+    // whoever finishes the counter broadcasts under the lock
+    pthread_mutex_lock(&thread_pool->lock);
+    while (atomic_load(&counter->value) > 0)
+      pthread_cond_wait(&thread_pool->wake_signal, &thread_pool->lock);
+    pthread_mutex_unlock(&thread_pool->lock);
+    return;
+  }
+
+  while (atomic_load(&counter->value) > 0) {
+    job_t *job = threads_find_job(thread_pool, thread_index);
+    if (job) {
+      if (job->counter == counter)
+        threads_run_indices(thread_pool, job, thread_index);
+      else
+        threads_help(thread_pool, job, thread_index, counter);
+      continue;
+    }
+
+    // the last indices are still running on the other threads
+    pthread_mutex_lock(&thread_pool->lock);
+    atomic_fetch_add(&thread_pool->sleeping_threads, 1);
+    while (atomic_load(&thread_pool->queued_jobs) == 0 &&
+           atomic_load(&counter->value) > 0)
+      pthread_cond_wait(&thread_pool->wake_signal, &thread_pool->lock);
+    atomic_fetch_sub(&thread_pool->sleeping_threads, 1);
+    pthread_mutex_unlock(&thread_pool->lock);
+  }
+}
+
+void threads_run_job(thread_pool_t *thread_pool, job_function_t function,
+                     void *data, int count) {
+  job_t job;
+  threads_counter_t counter = {0};
+  threads_submit(thread_pool, &job, function, data, count, &counter);
+  threads_wait(thread_pool, &counter);
+}
+
+/////////////////////////////////////////////////////
+////////////////////// THREADS //////////////////////
+/////////////////////////////////////////////////////
+
+void threads_initialize(thread_pool_t *thread_pool) {
   // Get the total no of cores in the system
   int total_no_of_cores_in_the_system = sysconf(_SC_NPROCESSORS_ONLN);
-  *thread_pool = malloc(sizeof(pthread_t) * total_no_of_cores_in_the_system);
-  *thread_data = malloc(sizeof(thread_t) * total_no_of_cores_in_the_system);
-  *start_signals = malloc(sizeof(sem_t) * total_no_of_cores_in_the_system);
-  *done_signals = malloc(sizeof(sem_t) * total_no_of_cores_in_the_system);
+  thread_pool->number_of_threads = total_no_of_cores_in_the_system;
+  thread_pool->threads =
+      malloc(sizeof(pthread_t) * total_no_of_cores_in_the_system);
+  thread_pool->thread_data =
+      malloc(sizeof(thread_t) * total_no_of_cores_in_the_system);
+  thread_pool->deques =
+      calloc(total_no_of_cores_in_the_system, sizeof(thread_deque_t));
+  if (!thread_pool->threads || !thread_pool->thread_data ||
+      !thread_pool->deques) {
+    fprintf(stderr, "Error: Could not allocate the thread pool\n");
+    exit(1);
+  }
+  atomic_init(&thread_pool->queued_jobs, 0);
+  atomic_init(&thread_pool->number_of_injected, 0);
+  atomic_init(&thread_pool->sleeping_threads, 0);
+  atomic_init(&thread_pool->is_running, true);
+  pthread_mutex_init(&thread_pool->lock, NULL);
+  pthread_cond_init(&thread_pool->wake_signal, NULL);
+  thread_pool->injected_jobs = NULL;
 
-  // start the threads
+  // start the threads, the main thread is thread 0
+  thread_current_index = 0;
   for (int i = 0; i < total_no_of_cores_in_the_system; ++i) {
-    sem_init(&(*start_signals)[i], 0, 0);
-    sem_init(&(*done_signals)[i], 0, 0);
-    thread_t thread_data_for_current_index = {
-        .app_state = app_state,
-        .tile_counter = tile_counter,
-        .start_signal = &(*start_signals)[i],
-        .done_signal = &(*done_signals)[i],
-        .is_main_thread_running = is_main_thread_running,
-        .base_material = base_material,
-        .skybox_material = skybox_material,
-        .scene_info = scene_info};
-
-    (*thread_data)[i] = thread_data_for_current_index;
-    pthread_create(&(*thread_pool)[i], NULL, thread_render, &(*thread_data)[i]);
+    thread_pool->thread_data[i] =
+        (thread_t){.thread_index = i, .thread_pool = thread_pool};
+    if (i > 0)
+      pthread_create(&thread_pool->threads[i], NULL, thread_worker,
+                     &thread_pool->thread_data[i]);
   }
 }
 
-void threads_cleanup(pthread_t *thread_pool, thread_t *thread_data,
-                     sem_t *start_signals, sem_t *done_signals) {
+void threads_cleanup(thread_pool_t *thread_pool) {
   // cleanup all the threads and free the dynamically allocated memory
-  int total_no_of_cores_in_the_system = sysconf(_SC_NPROCESSORS_ONLN);
-  for (int i = 0; i < total_no_of_cores_in_the_system; ++i) {
-    *thread_data[i].is_main_thread_running = false;
-    sem_post(&start_signals[i]);
-    pthread_join(thread_pool[i], NULL);
-    sem_destroy(&start_signals[i]);
-    sem_destroy(&done_signals[i]);
+  pthread_mutex_lock(&thread_pool->lock);
+  atomic_store(&thread_pool->is_running, false);
+  pthread_cond_broadcast(&thread_pool->wake_signal);
+  pthread_mutex_unlock(&thread_pool->lock);
+  for (int i = 1; i < thread_pool->number_of_threads; ++i) {
+    pthread_join(thread_pool->threads[i], NULL);
   }
-  free(thread_pool);
-  free(thread_data);
-  free(start_signals);
-  free(done_signals);
+  pthread_mutex_destroy(&thread_pool->lock);
+  pthread_cond_destroy(&thread_pool->wake_signal);
+  free(thread_pool->threads);
+  free(thread_pool->thread_data);
+  free(thread_pool->deques);
 }
 
-void *thread_render(void *arg) {
+void *thread_worker(void *arg) {
   thread_t *thread_data = (thread_t *)arg;
-
-  // calculate the total tiles in the X&Y directions
-  int total_tiles_in_x = (WINDOW_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
-  int total_tiles_in_y = (WINDOW_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
-  int total_tiles = total_tiles_in_x * total_tiles_in_y;
+  thread_pool_t *thread_pool = thread_data->thread_pool;
+  int thread_index = thread_data->thread_index;
+  thread_current_index = thread_index;
 
   while (true) {
-    // wait till the start signal is given
-    sem_wait(thread_data->start_signal);
+    job_t *job = threads_find_job(thread_pool, thread_index);
+    if (job) {
+      threads_run_indices(thread_pool, job, thread_index);
+      continue;
+    }
+
+    // sleep till something is queued
+    pthread_mutex_lock(&thread_pool->lock);
+    atomic_fetch_add(&thread_pool->sleeping_threads, 1);
+    while (atomic_load(&thread_pool->queued_jobs) == 0 &&
+           atomic_load(&thread_pool->is_running))
+      pthread_cond_wait(&thread_pool->wake_signal, &thread_pool->lock);
+    atomic_fetch_sub(&thread_pool->sleeping_threads, 1);
+    pthread_mutex_unlock(&thread_pool->lock);
+
     // end the thread if the main thread stops running
-    if (*thread_data->is_main_thread_running == false)
+    if (!atomic_load(&thread_pool->is_running))
       break;
+  }
+  return NULL;
+}
 
-    // The main working that is kept alive untill all the tiles has been
-    // rendered
-    while (true) {
-      // get which tile to render from the global tile pool
-      // once you get the tile id just increment this counter so that the next
-      // thread can up for the tiles that has still not yet been rendered
-      int tile_id = atomic_fetch_add(thread_data->tile_counter, 1);
-      // if tile counter exceeds the total tiles then end the thread
-      if (tile_id >= total_tiles)
-        break;
-
-      // do all the calculations here
-      // calculate the min(top_left) and max(bottom_right) of the tile boundary
-      int tile_x_min = (tile_id % total_tiles_in_x) * TILE_SIZE;
-      int tile_y_min = (tile_id / total_tiles_in_x) * TILE_SIZE;
-      int tile_x_max = tile_x_min + TILE_SIZE - 1;
-      int tile_y_max = tile_y_min + TILE_SIZE - 1;
-
-      bounding_box_t tile_bounding_box = {.x_min = tile_x_min,
-                                          .y_min = tile_y_min,
-                                          .x_max = tile_x_max,
-                                          .y_max = tile_y_max};
-
-      // render Mesh
-      for (int i = 0;
-           i < *thread_data->base_material->triangles_to_render_count; ++i) {
-        draw_triangle_fill_tiled_with_lighting_effect(
-            thread_data->base_material->triangles_to_render[i],
-            thread_data->base_material, thread_data->scene_info,
-            tile_bounding_box, thread_data->app_state);
-      }
-
-      // render Skybox
-      for (int i = 0;
-           i < *thread_data->skybox_material->triangles_to_render_count; ++i) {
-        draw_triangle_fill_tiled_with_lighting_effect(
-            thread_data->skybox_material->triangles_to_render[i],
-            thread_data->skybox_material, thread_data->scene_info,
-            tile_bounding_box, thread_data->app_state);
-      }
-    }
+void thread_render_tile(void *job_data, int tile_id, int thread_index) {
+  tile_job_t *tile_job = (tile_job_t *)job_data;
+
+  // calculate the min(top_left) and max(bottom_right) of the tile boundary
+  int tile_x_min = (tile_id % TILES_X) * TILE_SIZE;
+  int tile_y_min = (tile_id / TILES_X) * TILE_SIZE;
+  // the last row/column of tiles can hang outside the screen
+  int tile_x_max = min(tile_x_min + TILE_SIZE - 1, WINDOW_WIDTH - 1);
+  int tile_y_max = min(tile_y_min + TILE_SIZE - 1, WINDOW_HEIGHT - 1);
 
-    // send the signal that the work has been completed
-    sem_post(thread_data->done_signal);
+  bounding_box_t tile_bounding_box = {.x_min = tile_x_min,
+                                      .y_min = tile_y_min,
+                                      .x_max = tile_x_max,
+                                      .y_max = tile_y_max};
+
+  // every tile clears its own pixels instead of a pass over the whole screen
+  display_clear_tile(tile_job->app_state, tile_id, 0xFF000000);
+
+  // render all the draws of the frame in the order they were submitted
+  draw_list_t *draw_list = tile_job->draw_list;
+  for (int d = 0; d < draw_list->count; ++d) {
+    draw_call_t *draw_call = &draw_list->draw_calls[d];
+    triangle_t *triangles =
+        &draw_call->triangle_arena->triangles[draw_call->first_triangle];
+    for (int i = 0; i < draw_call->triangle_count; ++i) {
+      draw_triangle_fill_tiled_with_lighting_effect(
+          triangles[i], draw_call->material, tile_job->scene_info,
+          tile_bounding_box, tile_job->app_state);
+    }
   }
-  return NULL;
 }
@@ -47,6 +47,18 @@ void draw_triangle_wireframe(triangle_t triangle, app_state_t *app_state) {
   draw_line(x2, y2, x0, y0, app_state);
 }
 
+vec2_t snap_to_subpixel(vec2_t v) {
+  vec2_t snapped = {.x = roundf(v.x * SUBPIXEL_STEPS) / SUBPIXEL_STEPS,
+                    .y = roundf(v.y * SUBPIXEL_STEPS) / SUBPIXEL_STEPS};
+  return snapped;
+}
+
+// Edge Function of the point p against the edge a->b, done in double so
+// that it is exact for vertices on the subpixel grid
+double edge_function(vec2_t a, vec2_t b, vec2_t p) {
+  return (double)(b.x - a.x) * (p.y - a.y) - (double)(b.y - a.y) * (p.x - a.x);
+}
+
 bool is_top_flat_or_left(vec2_t edge) {
   bool is_top_flat = edge.y == 0 && edge.x > 0;
   bool is_left = edge.y < 0;
@@ -58,10 +70,10 @@ void draw_triangle_fill_with_lighting_effect(triangle_t triangle,
                                              material_t *material_data,
                                              scene_info_t *scene_info,
                                              app_state_t *app_state) {
-  // the three vertices of the triangle in vec2
-  vec2_t v0 = vec2_from_vec4(triangle.vertices[0]);
-  vec2_t v1 = vec2_from_vec4(triangle.vertices[1]);
-  vec2_t v2 = vec2_from_vec4(triangle.vertices[2]);
+  // the three vertices of the triangle in vec2 on the subpixel grid
+  vec2_t v0 = snap_to_subpixel(vec2_from_vec4(triangle.vertices[0]));
+  vec2_t v1 = snap_to_subpixel(vec2_from_vec4(triangle.vertices[1]));
+  vec2_t v2 = snap_to_subpixel(vec2_from_vec4(triangle.vertices[2]));
 
   // the three vertices of the triangle in vec4
   vec4_t v0_pos = triangle.view_space_vertices[0];
@@ -90,10 +102,11 @@ void draw_triangle_fill_with_lighting_effect(triangle_t triangle,
   float z2 = triangle.vertices[2].w;
 
   // Bounding box inside containing the three vertices of the triangle
-  int x_min = min(v0.x, min(v1.x, v2.x));
-  int y_min = min(v0.y, min(v1.y, v2.y));
-  int x_max = max(v0.x, max(v1.x, v2.x));
-  int y_max = max(v0.y, max(v1.y, v2.y));
+  // clamped to the screen as the guard band lets the triangles hang outside
+  int x_min = max(min(v0.x, min(v1.x, v2.x)), 0);
+  int y_min = max(min(v0.y, min(v1.y, v2.y)), 0);
+  int x_max = min(max(v0.x, max(v1.x, v2.x)), WINDOW_WIDTH - 1);
+  int y_max = min(max(v0.y, max(v1.y, v2.y)), WINDOW_HEIGHT - 1);
 
   // constant Edge Function Deltas used for the horizontal and vertical steps
   float delta_w0_col = (v0.y - v1.y);
@@ -112,6 +125,16 @@ void draw_triangle_fill_with_lighting_effect(triangle_t triangle,
   // area of the triangle
   float area = fabsf(vec2_cross(v0v1, v2v0));
 
+#if USE_VIRTUAL_TEXTURES
+  // one level for the whole triangle, it also decides which pages of a
+  // virtual texture get paged in
+  int mip_level =
+      texture_get_mip_level(material_data->base_texture_data, v0_tex_coord,
+                            v1_tex_coord, v2_tex_coord, area);
+#else
+  int mip_level = 0;
+#endif
+
   // For all the edges of the triangle
   // find if they are flat_top or left
   float bias0 = is_top_flat_or_left(v0v1) ? 0 : -0.0001;
@@ -120,43 +143,40 @@ void draw_triangle_fill_with_lighting_effect(triangle_t triangle,
 
   // take a starting point at the top left of the bounding box
   vec2_t p0 = {x_min + 0.5, y_min + 0.5};
-  // the three vectors pointing from the three vertices to the point
-  vec2_t v0p = vec2_sub(p0, v0);
-  vec2_t v1p = vec2_sub(p0, v1);
-  vec2_t v2p = vec2_sub(p0, v2);
 
   // Check if the point is left or right of the triangle edges(using Edge
-  // Function)
-  float w0_row = vec2_cross(v0v1, v0p) + bias0;
-  float w1_row = vec2_cross(v1v2, v1p) + bias1;
-  float w2_row = vec2_cross(v2v0, v2p) + bias2;
+  // Function), the steps below are exact as well so the sums never drift
+  double w0_row = edge_function(v0, v1, p0) + bias0;
+  double w1_row = edge_function(v1, v2, p0) + bias1;
+  double w2_row = edge_function(v2, v0, p0) + bias2;
 
   // Loop through all the pixels contained within this bounding box around the
   // triangle
   for (int y = y_min; y <= y_max; ++y) {
-    float w0 = w0_row;
-    float w1 = w1_row;
-    float w2 = w2_row;
+    double w0 = w0_row;
+    double w1 = w1_row;
+    double w2 = w2_row;
     for (int x = x_min; x <= x_max; ++x) {
 
       // check if the point is inside the triangle
       bool is_inside_triangle = w0 >= 0 && w1 >= 0 && w2 >= 0;
 
-      // Draw on the pixel if it is inside the triangle
-      if (is_inside_triangle) {
-        float alpha = w1 / area; // Edge v1->v2
-        float beta = w2 / area;  // Edge v2->v0
-        float gamma = w0 / area; // Edge v0->v1
+      float alpha = w1 / area; // Edge v1->v2
+      float beta = w2 / area;  // Edge v2->v0
+      float gamma = w0 / area; // Edge v0->v1
+      float interpolated_z =
+          alpha * (1 / z0) + beta * (1 / z1) + gamma * (1 / z2);
 
+      // Only shade the pixel if it is inside the triangle and in front of
+      // what is already in the z_buffer
+      if (is_inside_triangle &&
+          interpolated_z > app_state->z_buffer[x + (WINDOW_WIDTH * y)]) {
         // Interpolate on the UV coordinates to get the texture
         float u = alpha * (v0_tex_coord.u / z0) + beta * (v1_tex_coord.u / z1) +
                   gamma * (v2_tex_coord.u / z2);
         float v = alpha * (v0_tex_coord.v / z0) + beta * (v1_tex_coord.v / z1) +
                   gamma * (v2_tex_coord.v / z2);
 
-        float interpolated_z =
-            alpha * (1 / z0) + beta * (1 / z1) + gamma * (1 / z2);
-
         u /= interpolated_z;
         v /= interpolated_z;
 
@@ -167,7 +187,7 @@ void draw_triangle_fill_with_lighting_effect(triangle_t triangle,
         int tex_y = abs((int)(v * texture_data->height) % texture_data->height);
 
         uint32_t interpolated_color =
-            texture_data->data[tex_x + (texture_data->width * tex_y)];
+            texture_fetch(texture_data, tex_x, tex_y, mip_level);
 
         // // interpolate on the positions
         float pos_x = alpha * (v0_pos.x / z0) + beta * (v1_pos.x / z1) +
@@ -218,11 +238,8 @@ void draw_triangle_fill_with_lighting_effect(triangle_t triangle,
               interpolated_normal, interpolated_color);
         }
 
-        // Check and update the z_buffer
-        if (interpolated_z > app_state->z_buffer[x + (WINDOW_WIDTH * y)]) {
-          display_draw_pixel(x, y, interpolated_color, app_state);
-          app_state->z_buffer[x + (WINDOW_WIDTH * y)] = interpolated_z;
-        }
+        display_draw_pixel(x, y, interpolated_color, app_state);
+        app_state->z_buffer[x + (WINDOW_WIDTH * y)] = interpolated_z;
       }
       w0 += delta_w0_col;
       w1 += delta_w1_col;
@@ -234,14 +251,54 @@ void draw_triangle_fill_with_lighting_effect(triangle_t triangle,
   }
 }
 
+// largest value the Edge Function takes over a block of pixels, it is linear
+// so the largest value is at one of the corners
+double edge_function_max(double w, float delta_col, float delta_row,
+                         int block_width, int block_height) {
+  return w + fmax(delta_col * block_width, 0) +
+         fmax(delta_row * block_height, 0);
+}
+
+// farthest depth in the z_buffer of the pixels of a block
+float hi_z_block_farthest_depth(app_state_t *app_state, int block_x,
+                                int block_y) {
+  int end_x = min(block_x + HI_Z_BLOCK_SIZE - 1, WINDOW_WIDTH - 1);
+  int end_y = min(block_y + HI_Z_BLOCK_SIZE - 1, WINDOW_HEIGHT - 1);
+  float farthest_depth = app_state->z_buffer[block_x + WINDOW_WIDTH * block_y];
+  for (int y = block_y; y <= end_y; ++y) {
+    for (int x = block_x; x <= end_x; ++x) {
+      farthest_depth =
+          fminf(farthest_depth, app_state->z_buffer[x + WINDOW_WIDTH * y]);
+    }
+  }
+  return farthest_depth;
+}
+
+// farthest depth of the blocks of a tile
+float hi_z_tile_farthest_depth(app_state_t *app_state,
+                               bounding_box_t tile_bounding_box) {
+  float farthest_depth = INFINITY;
+  for (int y = tile_bounding_box.y_min; y <= tile_bounding_box.y_max;
+       y += HI_Z_BLOCK_SIZE) {
+    for (int x = tile_bounding_box.x_min; x <= tile_bounding_box.x_max;
+         x += HI_Z_BLOCK_SIZE) {
+      int block_index =
+          x / HI_Z_BLOCK_SIZE + HI_Z_BLOCKS_X * (y / HI_Z_BLOCK_SIZE);
+      farthest_depth =
+          fminf(farthest_depth, app_state->hi_z_blocks[block_index]);
+    }
+  }
+  return farthest_depth;
+}
+
 void draw_triangle_fill_tiled_with_lighting_effect(
     triangle_t triangle, material_t *material_data, scene_info_t *scene_info,
     bounding_box_t tile_bounding_box, app_state_t *app_state) {
 
-  // the three vertices of the triangle in vec2
-  vec2_t v0 = vec2_from_vec4(triangle.vertices[0]);
-  vec2_t v1 = vec2_from_vec4(triangle.vertices[1]);
-  vec2_t v2 = vec2_from_vec4(triangle.vertices[2]);
+  // the three vertices of the triangle in vec2 on the subpixel grid
+  vec2_t v0 = snap_to_subpixel(vec2_from_vec4(triangle.vertices[0]));
+  vec2_t v1 = snap_to_subpixel(vec2_from_vec4(triangle.vertices[1]));
+  vec2_t v2 = snap_to_subpixel(vec2_from_vec4(triangle.vertices[2]));
 
   // the three vertices of the triangle in vec4
   vec4_t v0_pos = triangle.view_space_vertices[0];
@@ -306,124 +363,237 @@ void draw_triangle_fill_tiled_with_lighting_effect(
   // area of the triangle
   float area = fabsf(vec2_cross(v0v1, v2v0));
 
+#if USE_VIRTUAL_TEXTURES
+  // one level for the whole triangle, it also decides which pages of a
+  // virtual texture get paged in
+  int mip_level =
+      texture_get_mip_level(material_data->base_texture_data, v0_tex_coord,
+                            v1_tex_coord, v2_tex_coord, area);
+#else
+  int mip_level = 0;
+#endif
+
   // For all the edges of the triangle
   // find if they are flat_top or left
   float bias0 = is_top_flat_or_left(v0v1) ? 0 : -0.0001;
   float bias1 = is_top_flat_or_left(v1v2) ? 0 : -0.0001;
   float bias2 = is_top_flat_or_left(v2v0) ? 0 : -0.0001;
 
-  // take a starting point at the top left of the new bounding box
-  vec2_t p0 = {start_x + 0.5, start_y + 0.5};
-  // the three vectors pointing from the three vertices to the point
-  vec2_t v0p = vec2_sub(p0, v0);
-  vec2_t v1p = vec2_sub(p0, v1);
-  vec2_t v2p = vec2_sub(p0, v2);
+#if USE_HIERARCHICAL_Z
+  // nearest depth(greatest 1/w) any pixel of the triangle can have
+  float triangle_nearest_depth =
+      fmaxf(1 / z0, fmaxf(1 / z1, 1 / z2)) * (1.0 + HI_Z_EPSILON);
 
-  // Check if the point is left or right of the triangle edges(using Edge
-  // Function)
-  float w0_row = vec2_cross(v0v1, v0p) + bias0;
-  float w1_row = vec2_cross(v1v2, v1p) + bias1;
-  float w2_row = vec2_cross(v2v0, v2p) + bias2;
-
-  // Loop through all the pixels contained within this new bounding box around
-  // the triangle
-  for (int y = start_y; y <= end_y; ++y) {
-    float w0 = w0_row;
-    float w1 = w1_row;
-    float w2 = w2_row;
-    for (int x = start_x; x <= end_x; ++x) {
-
-      // check if the point is inside the triangle
-      bool is_inside_triangle = w0 >= 0 && w1 >= 0 && w2 >= 0;
+  // everything in the tile is already nearer than the triangle
+  int tile_index = tile_bounding_box.x_min / TILE_SIZE +
+                   TILES_X * (tile_bounding_box.y_min / TILE_SIZE);
+  if (triangle_nearest_depth <= app_state->hi_z_tiles[tile_index])
+    return;
+  bool has_written_tile = false;
+#endif
+
+  // Loop through the blocks of the tile the bounding box touches
+  int first_block_x = start_x - start_x % HI_Z_BLOCK_SIZE;
+  int first_block_y = start_y - start_y % HI_Z_BLOCK_SIZE;
+  int blocks_in_x = (end_x - first_block_x) / HI_Z_BLOCK_SIZE + 1;
+  int blocks_in_y = (end_y - first_block_y) / HI_Z_BLOCK_SIZE + 1;
+  for (int block = 0; block < blocks_in_x * blocks_in_y; ++block) {
+    int block_x = first_block_x + (block % blocks_in_x) * HI_Z_BLOCK_SIZE;
+    int block_y = first_block_y + (block / blocks_in_x) * HI_Z_BLOCK_SIZE;
+#if USE_HIERARCHICAL_Z
+    int block_index =
+        block_x / HI_Z_BLOCK_SIZE + HI_Z_BLOCKS_X * (block_y / HI_Z_BLOCK_SIZE);
+    // everything in the block is already nearer than the triangle
+    if (triangle_nearest_depth <= app_state->hi_z_blocks[block_index])
+      continue;
+    bool has_written_block = false;
+#endif
+
+    // the part of the block inside the bounding box
+    int block_start_x = max(block_x, start_x);
+    int block_start_y = max(block_y, start_y);
+    int block_end_x = min(block_x + HI_Z_BLOCK_SIZE - 1, end_x);
+    int block_end_y = min(block_y + HI_Z_BLOCK_SIZE - 1, end_y);
+
+    // take a starting point at the top left of the block
+    vec2_t p0 = {block_start_x + 0.5, block_start_y + 0.5};
+
+    // Check if the point is left or right of the triangle edges(using Edge
+    // Function), the steps below are exact as well so the sums never drift
+    double w0_row = edge_function(v0, v1, p0) + bias0;
+    double w1_row = edge_function(v1, v2, p0) + bias1;
+    double w2_row = edge_function(v2, v0, p0) + bias2;
+
+    // the whole block is on the outside of one of the edges
+    int block_width = block_end_x - block_start_x;
+    int block_height = block_end_y - block_start_y;
+    if (edge_function_max(w0_row, delta_w0_col, delta_w0_row, block_width,
+                          block_height) < 0 ||
+        edge_function_max(w1_row, delta_w1_col, delta_w1_row, block_width,
+                          block_height) < 0 ||
+        edge_function_max(w2_row, delta_w2_col, delta_w2_row, block_width,
+                          block_height) < 0)
+      continue;
+
+    // Loop through all the pixels of the block
+    for (int y = block_start_y; y <= block_end_y; ++y) {
+      double w0 = w0_row;
+      double w1 = w1_row;
+      double w2 = w2_row;
+      for (int x = block_start_x; x <= block_end_x; ++x) {
+
+        // check if the point is inside the triangle
+        bool is_inside_triangle = w0 >= 0 && w1 >= 0 && w2 >= 0;
 
-      // Draw on the pixel if it is inside the triangle
-      if (is_inside_triangle) {
         float alpha = w1 / area; // Edge v1->v2
         float beta = w2 / area;  // Edge v2->v0
         float gamma = w0 / area; // Edge v0->v1
-
-        // Interpolate on the UV coordinates to get the texture
-        float u = alpha * (v0_tex_coord.u / z0) + beta * (v1_tex_coord.u / z1) +
-                  gamma * (v2_tex_coord.u / z2);
-        float v = alpha * (v0_tex_coord.v / z0) + beta * (v1_tex_coord.v / z1) +
-                  gamma * (v2_tex_coord.v / z2);
-
         float interpolated_z =
             alpha * (1 / z0) + beta * (1 / z1) + gamma * (1 / z2);
 
-        u /= interpolated_z;
-        v /= interpolated_z;
-
-        // get the texture data
-        texture_t *texture_data = material_data->base_texture_data;
-
-        int tex_x = abs((int)(u * texture_data->width) % texture_data->width);
-        int tex_y = abs((int)(v * texture_data->height) % texture_data->height);
-
-        uint32_t interpolated_color =
-            texture_data->data[tex_x + (texture_data->width * tex_y)];
-
-        // // interpolate on the positions
-        float pos_x = alpha * (v0_pos.x / z0) + beta * (v1_pos.x / z1) +
-                      gamma * (v2_pos.x / z2);
-        pos_x /= interpolated_z;
+        // Only shade the pixel if it is inside the triangle and in front of
+        // what is already in the z_buffer
+        if (is_inside_triangle &&
+            interpolated_z > app_state->z_buffer[x + (WINDOW_WIDTH * y)]) {
+          // Interpolate on the UV coordinates to get the texture
+          float u = alpha * (v0_tex_coord.u / z0) +
+                    beta * (v1_tex_coord.u / z1) +
+                    gamma * (v2_tex_coord.u / z2);
+          float v = alpha * (v0_tex_coord.v / z0) +
+                    beta * (v1_tex_coord.v / z1) +
+                    gamma * (v2_tex_coord.v / z2);
+
+          u /= interpolated_z;
+          v /= interpolated_z;
+
+          // get the texture data
+          texture_t *texture_data = material_data->base_texture_data;
+
+          int tex_x = abs((int)(u * texture_data->width) % texture_data->width);
+          int tex_y =
+              abs((int)(v * texture_data->height) % texture_data->height);
+
+          uint32_t interpolated_color =
+              texture_fetch(texture_data, tex_x, tex_y, mip_level);
+
+          // // interpolate on the positions
+          float pos_x = alpha * (v0_pos.x / z0) + beta * (v1_pos.x / z1) +
+                        gamma * (v2_pos.x / z2);
+          pos_x /= interpolated_z;
+
+          float pos_y = alpha * (v0_pos.y / z0) + beta * (v1_pos.y / z1) +
+                        gamma * (v2_pos.y / z2);
+          pos_y /= interpolated_z;
+
+          float pos_z = alpha * (v0_pos.z / z0) + beta * (v1_pos.z / z1) +
+                        gamma * (v2_pos.z / z2);
+          pos_z /= interpolated_z;
+
+          vec3_t interpolated_position = {.x = pos_x, .y = pos_y, .z = pos_z};
+
+          // // Interpolate on the normals
+          float normal_x = alpha * (v0_normal.x / z0) +
+                           beta * (v1_normal.x / z1) +
+                           gamma * (v2_normal.x / z2);
+          normal_x /= interpolated_z;
+
+          float normal_y = alpha * (v0_normal.y / z0) +
+                           beta * (v1_normal.y / z1) +
+                           gamma * (v2_normal.y / z2);
+          normal_y /= interpolated_z;
+
+          float normal_z = alpha * (v0_normal.z / z0) +
+                           beta * (v1_normal.z / z1) +
+                           gamma * (v2_normal.z / z2);
+          normal_z /= interpolated_z;
+
+          vec3_t interpolated_normal = {
+              .x = normal_x, .y = normal_y, .z = normal_z};
+          vec3_normalize(&interpolated_normal);
+
+          // get the lighting effect on the interpolated color value of the
+          // interpolated pixel in case we have light
+          if (material_data->is_PBR) {
+            interpolated_color = light_pbr(
+                scene_info->lights, *scene_info->total_lights_in_scene,
+                interpolated_position, *scene_info->camera_position,
+                interpolated_normal, interpolated_color,
+                material_data->radiance_texture_data,
+                material_data->irradiance_texture_data,
+                material_data->LUT_texture_data);
+          } else {
+            interpolated_color = light_phong(
+                scene_info->lights, *scene_info->total_lights_in_scene,
+                interpolated_position, *scene_info->camera_position,
+                interpolated_normal, interpolated_color);
+          }
 
-        float pos_y = alpha * (v0_pos.y / z0) + beta * (v1_pos.y / z1) +
-                      gamma * (v2_pos.y / z2);
-        pos_y /= interpolated_z;
-
-        float pos_z = alpha * (v0_pos.z / z0) + beta * (v1_pos.z / z1) +
-                      gamma * (v2_pos.z / z2);
-        pos_z /= interpolated_z;
+          display_draw_pixel(x, y, interpolated_color, app_state);
+          app_state->z_buffer[x + (WINDOW_WIDTH * y)] = interpolated_z;
+#if USE_HIERARCHICAL_Z
+          has_written_block = true;
+#endif
+        }
+        w0 += delta_w0_col;
+        w1 += delta_w1_col;
+        w2 += delta_w2_col;
+      }
+      w0_row += delta_w0_row;
+      w1_row += delta_w1_row;
+      w2_row += delta_w2_row;
+    }
 
-        vec3_t interpolated_position = {.x = pos_x, .y = pos_y, .z = pos_z};
+#if USE_HIERARCHICAL_Z
+    if (has_written_block) {
+      app_state->hi_z_blocks[block_index] =
+          hi_z_block_farthest_depth(app_state, block_x, block_y);
+      has_written_tile = true;
+    }
+#endif
+  }
 
-        // // Interpolate on the normals
-        float normal_x = alpha * (v0_normal.x / z0) +
-                         beta * (v1_normal.x / z1) + gamma * (v2_normal.x / z2);
-        normal_x /= interpolated_z;
+#if USE_HIERARCHICAL_Z
+  if (has_written_tile) {
+    app_state->hi_z_tiles[tile_index] =
+        hi_z_tile_farthest_depth(app_state, tile_bounding_box);
+  }
+#endif
+}
 
-        float normal_y = alpha * (v0_normal.y / z0) +
-                         beta * (v1_normal.y / z1) + gamma * (v2_normal.y / z2);
-        normal_y /= interpolated_z;
+void draw_triangle_depth_only(vec2_t v0, vec2_t v1, vec2_t v2, float depth,
+                              float *depth_buffer, int buffer_width,
+                              int buffer_height) {
+  v0 = snap_to_subpixel(v0);
+  v1 = snap_to_subpixel(v1);
+  v2 = snap_to_subpixel(v2);
+
+  // occluders are not back face culled so the winding can be either way
+  if (edge_function(v0, v1, v2) < 0) {
+    vec2_t temp = v1;
+    v1 = v2;
+    v2 = temp;
+  }
 
-        float normal_z = alpha * (v0_normal.z / z0) +
-                         beta * (v1_normal.z / z1) + gamma * (v2_normal.z / z2);
-        normal_z /= interpolated_z;
+  // Bounding box of the triangle clamped to the buffer
+  int x_min = max(floorf(min(v0.x, min(v1.x, v2.x))), 0);
+  int y_min = max(floorf(min(v0.y, min(v1.y, v2.y))), 0);
+  int x_max = min(max(v0.x, max(v1.x, v2.x)), buffer_width - 1);
+  int y_max = min(max(v0.y, max(v1.y, v2.y)), buffer_height - 1);
 
-        vec3_t interpolated_normal = {
-            .x = normal_x, .y = normal_y, .z = normal_z};
-        vec3_normalize(&interpolated_normal);
+  float bias0 = is_top_flat_or_left(vec2_sub(v1, v0)) ? 0 : -0.0001;
+  float bias1 = is_top_flat_or_left(vec2_sub(v2, v1)) ? 0 : -0.0001;
+  float bias2 = is_top_flat_or_left(vec2_sub(v0, v2)) ? 0 : -0.0001;
 
-        // get the lighting effect on the interpolated color value of the
-        // interpolated pixel in case we have light
-        if (material_data->is_PBR) {
-          interpolated_color =
-              light_pbr(scene_info->lights, *scene_info->total_lights_in_scene,
-                        interpolated_position, *scene_info->camera_position,
-                        interpolated_normal, interpolated_color,
-                        material_data->radiance_texture_data,
-                        material_data->irradiance_texture_data,
-                        material_data->LUT_texture_data);
-        } else {
-          interpolated_color = light_phong(
-              scene_info->lights, *scene_info->total_lights_in_scene,
-              interpolated_position, *scene_info->camera_position,
-              interpolated_normal, interpolated_color);
-        }
-
-        // Check and update the z_buffer
-        if (interpolated_z > app_state->z_buffer[x + (WINDOW_WIDTH * y)]) {
-          display_draw_pixel(x, y, interpolated_color, app_state);
-          app_state->z_buffer[x + (WINDOW_WIDTH * y)] = interpolated_z;
-        }
-      }
-      w0 += delta_w0_col;
-      w1 += delta_w1_col;
-      w2 += delta_w2_col;
+  for (int y = y_min; y <= y_max; ++y) {
+    for (int x = x_min; x <= x_max; ++x) {
+      vec2_t p = {x + 0.5, y + 0.5};
+      bool is_inside_triangle = edge_function(v0, v1, p) + bias0 >= 0 &&
+                                edge_function(v1, v2, p) + bias1 >= 0 &&
+                                edge_function(v2, v0, p) + bias2 >= 0;
+      float *buffer_depth = &depth_buffer[x + buffer_width * y];
+      // greater 1/w is nearer
+      if (is_inside_triangle && depth > *buffer_depth)
+        *buffer_depth = depth;
     }
-    w0_row += delta_w0_row;
-    w1_row += delta_w1_row;
-    w2_row += delta_w2_row;
   }
 }
@@ -1,5 +1,12 @@
 #include "utilities.h"
+#include <fcntl.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 float min(float a, float b) { return (a < b) ? a : b; }
 float max(float a, float b) { return (a > b) ? a : b; }
@@ -19,3 +26,81 @@ uint32_t create_color_uint32(color_t color) {
                           (uint32_t)color.r;
   return color_uint32;
 }
+
+uint64_t hash_fnv1a(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+uint64_t hash_file(uint64_t hash, char *filename) {
+  int file_descriptor = open(filename, O_RDONLY);
+  if (file_descriptor == -1) {
+    fprintf(stderr, "Error: Could not open file: %s\n", filename);
+    exit(1);
+  }
+  struct stat file_stat;
+  if (fstat(file_descriptor, &file_stat) == -1) {
+    fprintf(stderr, "Error: Could not read the size of: %s\n", filename);
+    exit(1);
+  }
+  size_t file_size = file_stat.st_size;
+  if (file_size > 0) {
+    const char *data =
+        mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    if (data == MAP_FAILED) {
+      fprintf(stderr, "Error: Could not map file: %s\n", filename);
+      exit(1);
+    }
+    madvise((void *)data, file_size, MADV_SEQUENTIAL);
+    hash = hash_fnv1a(hash, data, file_size);
+    munmap((void *)data, file_size);
+  }
+  close(file_descriptor);
+  return hash;
+}
+
+char *filename_with(char *filename, size_t length, char *suffix) {
+  char *result = malloc(length + strlen(suffix) + 1);
+  if (!result) {
+    fprintf(stderr, "Error: Could not allocate the file name\n");
+    exit(1);
+  }
+  memcpy(result, filename, length);
+  strcpy(result + length, suffix);
+  return result;
+}
+
+char *filename_replace_extension(char *filename, char *extension) {
+  const char *dot = strrchr(filename, '.');
+  const char *separator = strrchr(filename, '/');
+  size_t length = strlen(filename);
+  if (dot && (!separator || dot > separator))
+    length = dot - filename;
+  return filename_with(filename, length, extension);
+}
+
+char *filename_append(char *filename, char *suffix) {
+  return filename_with(filename, strlen(filename), suffix);
+}
+
+size_t align_up(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+bool file_write_at(FILE *file, size_t offset, const void *data, size_t size) {
+  static const char zeros[256] = {0};
+  long position = ftell(file);
+  if (position < 0 || (size_t)position > offset)
+    return false;
+  for (size_t gap = offset - position; gap > 0;) {
+    size_t count = gap < sizeof(zeros) ? gap : sizeof(zeros);
+    if (fwrite(zeros, 1, count, file) != count)
+      return false;
+    gap -= count;
+  }
+  return fwrite(data, 1, size, file) == size;
+}
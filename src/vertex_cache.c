@@ -0,0 +1,398 @@
+#include "vertex_cache.h"
+#include "meshlet.h"
+#include "triangle.h"
+#include "utilities.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Scratch space of Tipsify, every meshlet is ordered on its own with its
+// vertices renumbered to [0, number_of_local_vertices)
+typedef struct {
+  // local index of every mesh vertex, -1 when it is not in the meshlet
+  int *local_index;
+  int *local_vertices;
+  // the corners of the faces of the meshlet in local indices
+  int *face_corners;
+  // faces around every local vertex stored as one array with offsets
+  int *vertex_face_offsets;
+  int *vertex_faces;
+  // faces around the vertex that are still not emitted
+  int *live_faces;
+  // the cache carries over from one meshlet to the next so it is kept for
+  // the mesh vertices
+  int *cache_time;
+  int timestamp;
+  bool *is_emitted;
+  int *dead_end_stack;
+  int *candidates;
+  int *face_order;
+  face_t *ordered_faces;
+} tipsify_t;
+
+// next vertex to fan around: the candidate that is still in the cache and
+// will stay in it for all its remaining faces, the oldest one wins
+int tipsify_next_vertex(tipsify_t *tipsify, int number_of_candidates,
+                        int *dead_end_top, int *cursor,
+                        int number_of_local_vertices) {
+  int best_vertex = -1;
+  int best_priority = -1;
+  for (int c = 0; c < number_of_candidates; ++c) {
+    int v = tipsify->candidates[c];
+    if (tipsify->live_faces[v] == 0)
+      continue;
+    int priority = 0;
+    int age = tipsify->timestamp -
+              tipsify->cache_time[tipsify->local_vertices[v]];
+    if (age + 2 * tipsify->live_faces[v] <= VERTEX_CACHE_SIZE)
+      priority = age;
+    if (priority > best_priority) {
+      best_priority = priority;
+      best_vertex = v;
+    }
+  }
+  if (best_vertex != -1)
+    return best_vertex;
+
+  // dead end: go back to the most recently used vertex that still has faces
+  while (*dead_end_top > 0) {
+    int v = tipsify->dead_end_stack[--(*dead_end_top)];
+    if (tipsify->live_faces[v] > 0)
+      return v;
+  }
+  // and if there is none take the next one in order
+  while (*cursor < number_of_local_vertices) {
+    int v = (*cursor)++;
+    if (tipsify->live_faces[v] > 0)
+      return v;
+  }
+  return -1;
+}
+
+void tipsify_meshlet(tipsify_t *tipsify, face_t *faces, int number_of_faces) {
+  // renumber the vertices of the meshlet
+  int number_of_local_vertices = 0;
+  for (int i = 0; i < number_of_faces; ++i) {
+    int corners[3] = {faces[i].a, faces[i].b, faces[i].c};
+    for (int j = 0; j < 3; ++j) {
+      int v = corners[j];
+      if (tipsify->local_index[v] == -1) {
+        tipsify->local_index[v] = number_of_local_vertices;
+        tipsify->local_vertices[number_of_local_vertices++] = v;
+      }
+      tipsify->face_corners[i * 3 + j] = tipsify->local_index[v];
+    }
+  }
+
+  // faces around every vertex
+  for (int v = 0; v <= number_of_local_vertices; ++v) {
+    tipsify->vertex_face_offsets[v] = 0;
+  }
+  for (int k = 0; k < number_of_faces * 3; ++k) {
+    tipsify->vertex_face_offsets[tipsify->face_corners[k] + 1]++;
+  }
+  // prefix sum of the face counts turns them into offsets
+  for (int v = 0; v < number_of_local_vertices; ++v) {
+    tipsify->vertex_face_offsets[v + 1] += tipsify->vertex_face_offsets[v];
+    // live_faces is the write cursor while the lists get filled
+    tipsify->live_faces[v] = tipsify->vertex_face_offsets[v];
+  }
+  for (int k = 0; k < number_of_faces * 3; ++k) {
+    tipsify->vertex_faces[tipsify->live_faces[tipsify->face_corners[k]]++] =
+        k / 3;
+  }
+  for (int v = 0; v < number_of_local_vertices; ++v) {
+    tipsify->live_faces[v] = tipsify->vertex_face_offsets[v + 1] -
+                             tipsify->vertex_face_offsets[v];
+  }
+  for (int i = 0; i < number_of_faces; ++i) {
+    tipsify->is_emitted[i] = false;
+  }
+
+  // start from the vertex the previous meshlet left the freshest in the cache
+  int fanning_vertex = 0;
+  for (int v = 1; v < number_of_local_vertices; ++v) {
+    if (tipsify->cache_time[tipsify->local_vertices[v]] >
+        tipsify->cache_time[tipsify->local_vertices[fanning_vertex]])
+      fanning_vertex = v;
+  }
+
+  // fan around a vertex emitting all of its faces, then move on to a
+  // neighbour that is still in the cache
+  int number_of_ordered_faces = 0;
+  int dead_end_top = 0;
+  int cursor = 0;
+  while (fanning_vertex != -1) {
+    int number_of_candidates = 0;
+    for (int k = tipsify->vertex_face_offsets[fanning_vertex];
+         k < tipsify->vertex_face_offsets[fanning_vertex + 1]; ++k) {
+      int face_index = tipsify->vertex_faces[k];
+      if (tipsify->is_emitted[face_index])
+        continue;
+      tipsify->is_emitted[face_index] = true;
+      tipsify->face_order[number_of_ordered_faces++] = face_index;
+
+      for (int j = 0; j < 3; ++j) {
+        int v = tipsify->face_corners[face_index * 3 + j];
+        tipsify->dead_end_stack[dead_end_top++] = v;
+        tipsify->candidates[number_of_candidates++] = v;
+        tipsify->live_faces[v]--;
+        // a miss puts the vertex at the front of the cache, the same FIFO
+        // vertex_cache_acmr measures
+        int *cache_time = &tipsify->cache_time[tipsify->local_vertices[v]];
+        if (tipsify->timestamp - *cache_time >= VERTEX_CACHE_SIZE)
+          *cache_time = tipsify->timestamp++;
+      }
+    }
+    fanning_vertex =
+        tipsify_next_vertex(tipsify, number_of_candidates, &dead_end_top,
+                            &cursor, number_of_local_vertices);
+  }
+
+  // write the faces back in the new order
+  for (int i = 0; i < number_of_faces; ++i) {
+    tipsify->ordered_faces[i] = faces[tipsify->face_order[i]];
+  }
+  for (int i = 0; i < number_of_faces; ++i) {
+    faces[i] = tipsify->ordered_faces[i];
+  }
+
+  for (int v = 0; v < number_of_local_vertices; ++v) {
+    tipsify->local_index[tipsify->local_vertices[v]] = -1;
+  }
+}
+
+// Chains the meshlets greedily and orders every one with Tipsify as it gets
+// placed: the next meshlet is the one sharing the most vertices that are still
+// in the cache after the previous one, so it starts with the cache warm
+void vertex_cache_order_meshlets(tipsify_t *tipsify, face_t *faces,
+                                 int number_of_faces, int number_of_vertices,
+                                 meshlet_t *meshlets, int number_of_meshlets) {
+  // meshlets around every vertex stored as one array with per vertex offsets
+  int *vertex_meshlet_offsets = calloc(number_of_vertices + 1, sizeof(int));
+  int *vertex_meshlets = malloc(sizeof(int) * number_of_faces * 3);
+  int *shared_vertices = calloc(number_of_meshlets, sizeof(int));
+  int *cached_vertices = calloc(number_of_meshlets, sizeof(int));
+  int *touched_meshlets = malloc(sizeof(int) * number_of_faces * 3);
+  bool *is_placed = calloc(number_of_meshlets, sizeof(bool));
+  meshlet_t *ordered_meshlets = malloc(sizeof(meshlet_t) * number_of_meshlets);
+  face_t *ordered_faces = malloc(sizeof(face_t) * number_of_faces);
+  if (!vertex_meshlet_offsets || !vertex_meshlets || !shared_vertices ||
+      !cached_vertices ||
+      !touched_meshlets || !is_placed || !ordered_meshlets || !ordered_faces) {
+    fprintf(stderr, "Error: Could not allocate the meshlet order\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < number_of_faces; ++i) {
+    vertex_meshlet_offsets[faces[i].a + 1]++;
+    vertex_meshlet_offsets[faces[i].b + 1]++;
+    vertex_meshlet_offsets[faces[i].c + 1]++;
+  }
+  for (int v = 0; v < number_of_vertices; ++v) {
+    vertex_meshlet_offsets[v + 1] += vertex_meshlet_offsets[v];
+  }
+  int *vertex_cursor = malloc(sizeof(int) * number_of_vertices);
+  if (!vertex_cursor) {
+    fprintf(stderr, "Error: Could not allocate the meshlet order\n");
+    exit(1);
+  }
+  for (int v = 0; v < number_of_vertices; ++v) {
+    vertex_cursor[v] = vertex_meshlet_offsets[v];
+  }
+  for (int m = 0; m < number_of_meshlets; ++m) {
+    for (int i = meshlets[m].first_face;
+         i < meshlets[m].first_face + meshlets[m].number_of_faces; ++i) {
+      vertex_meshlets[vertex_cursor[faces[i].a]++] = m;
+      vertex_meshlets[vertex_cursor[faces[i].b]++] = m;
+      vertex_meshlets[vertex_cursor[faces[i].c]++] = m;
+    }
+  }
+  free(vertex_cursor);
+
+  int number_of_ordered_faces = 0;
+  int next_in_order = 0;
+  int current = 0;
+  for (int o = 0; o < number_of_meshlets; ++o) {
+    is_placed[current] = true;
+    meshlet_t *meshlet = &meshlets[current];
+    ordered_meshlets[o] = *meshlet;
+    ordered_meshlets[o].first_face = number_of_ordered_faces;
+    for (int i = 0; i < meshlet->number_of_faces; ++i) {
+      ordered_faces[number_of_ordered_faces++] =
+          faces[meshlet->first_face + i];
+    }
+    tipsify_meshlet(tipsify, &ordered_faces[ordered_meshlets[o].first_face],
+                    meshlet->number_of_faces);
+
+    // count the corners every unplaced neighbour shares with this meshlet and
+    // how many of them are still in the cache
+    int number_of_touched = 0;
+    for (int i = meshlet->first_face;
+         i < meshlet->first_face + meshlet->number_of_faces; ++i) {
+      int corners[3] = {faces[i].a, faces[i].b, faces[i].c};
+      for (int j = 0; j < 3; ++j) {
+        for (int k = vertex_meshlet_offsets[corners[j]];
+             k < vertex_meshlet_offsets[corners[j] + 1]; ++k) {
+          int neighbour = vertex_meshlets[k];
+          if (is_placed[neighbour])
+            continue;
+          if (shared_vertices[neighbour]++ == 0)
+            touched_meshlets[number_of_touched++] = neighbour;
+          if (tipsify->timestamp - tipsify->cache_time[corners[j]] <
+              VERTEX_CACHE_SIZE)
+            cached_vertices[neighbour]++;
+        }
+      }
+    }
+
+    current = -1;
+    for (int t = 0; t < number_of_touched; ++t) {
+      int neighbour = touched_meshlets[t];
+      if (current == -1 ||
+          cached_vertices[neighbour] > cached_vertices[current] ||
+          (cached_vertices[neighbour] == cached_vertices[current] &&
+           (shared_vertices[neighbour] > shared_vertices[current] ||
+            (shared_vertices[neighbour] == shared_vertices[current] &&
+             neighbour < current))))
+        current = neighbour;
+    }
+    for (int t = 0; t < number_of_touched; ++t) {
+      shared_vertices[touched_meshlets[t]] = 0;
+      cached_vertices[touched_meshlets[t]] = 0;
+    }
+
+    // nothing connected is left, continue with the next one in the old order
+    if (current == -1) {
+      while (next_in_order < number_of_meshlets && is_placed[next_in_order])
+        next_in_order++;
+      current = next_in_order;
+    }
+  }
+
+  for (int m = 0; m < number_of_meshlets; ++m) {
+    meshlets[m] = ordered_meshlets[m];
+  }
+  for (int i = 0; i < number_of_faces; ++i) {
+    faces[i] = ordered_faces[i];
+  }
+
+  free(vertex_meshlet_offsets);
+  free(vertex_meshlets);
+  free(shared_vertices);
+  free(cached_vertices);
+  free(touched_meshlets);
+  free(is_placed);
+  free(ordered_meshlets);
+  free(ordered_faces);
+}
+
+void vertex_cache_optimize_meshlets(face_t *faces, int number_of_vertices,
+                                    meshlet_t *meshlets,
+                                    int number_of_meshlets) {
+  int max_faces = 0;
+  for (int m = 0; m < number_of_meshlets; ++m) {
+    max_faces = max(max_faces, meshlets[m].number_of_faces);
+  }
+  if (max_faces == 0)
+    return;
+
+  // a meshlet can have at most three vertices per face
+  int max_vertices = max_faces * 3;
+  tipsify_t tipsify = {
+      .local_index = malloc(sizeof(int) * number_of_vertices),
+      .local_vertices = malloc(sizeof(int) * max_vertices),
+      .face_corners = malloc(sizeof(int) * max_faces * 3),
+      .vertex_face_offsets = malloc(sizeof(int) * (max_vertices + 1)),
+      .vertex_faces = malloc(sizeof(int) * max_faces * 3),
+      .live_faces = malloc(sizeof(int) * max_vertices),
+      .cache_time = malloc(sizeof(int) * number_of_vertices),
+      .timestamp = VERTEX_CACHE_SIZE + 1,
+      .is_emitted = malloc(sizeof(bool) * max_faces),
+      .dead_end_stack = malloc(sizeof(int) * max_faces * 3),
+      .candidates = malloc(sizeof(int) * max_faces * 3),
+      .face_order = malloc(sizeof(int) * max_faces),
+      .ordered_faces = malloc(sizeof(face_t) * max_faces)};
+  if (!tipsify.local_index || !tipsify.local_vertices ||
+      !tipsify.face_corners || !tipsify.vertex_face_offsets ||
+      !tipsify.vertex_faces || !tipsify.live_faces || !tipsify.cache_time ||
+      !tipsify.is_emitted || !tipsify.dead_end_stack || !tipsify.candidates ||
+      !tipsify.face_order || !tipsify.ordered_faces) {
+    fprintf(stderr, "Error: Could not allocate the vertex cache optimizer\n");
+    exit(1);
+  }
+  for (int v = 0; v < number_of_vertices; ++v) {
+    tipsify.local_index[v] = -1;
+    tipsify.cache_time[v] = 0;
+  }
+
+  int number_of_faces = meshlets[number_of_meshlets - 1].first_face +
+                        meshlets[number_of_meshlets - 1].number_of_faces;
+  // the order the faces came in is put back unless the new one is better
+  float acmr_before =
+      vertex_cache_acmr(faces, number_of_faces, number_of_vertices);
+  face_t *original_faces = malloc(sizeof(face_t) * number_of_faces);
+  meshlet_t *original_meshlets = malloc(sizeof(meshlet_t) * number_of_meshlets);
+  if (!original_faces || !original_meshlets) {
+    fprintf(stderr, "Error: Could not allocate the vertex cache optimizer\n");
+    exit(1);
+  }
+  memcpy(original_faces, faces, sizeof(face_t) * number_of_faces);
+  memcpy(original_meshlets, meshlets, sizeof(meshlet_t) * number_of_meshlets);
+
+  vertex_cache_order_meshlets(&tipsify, faces, number_of_faces,
+                              number_of_vertices, meshlets,
+                              number_of_meshlets);
+  if (vertex_cache_acmr(faces, number_of_faces, number_of_vertices) >=
+      acmr_before) {
+    memcpy(faces, original_faces, sizeof(face_t) * number_of_faces);
+    memcpy(meshlets, original_meshlets, sizeof(meshlet_t) * number_of_meshlets);
+  }
+  free(original_faces);
+  free(original_meshlets);
+
+  free(tipsify.local_index);
+  free(tipsify.local_vertices);
+  free(tipsify.face_corners);
+  free(tipsify.vertex_face_offsets);
+  free(tipsify.vertex_faces);
+  free(tipsify.live_faces);
+  free(tipsify.cache_time);
+  free(tipsify.is_emitted);
+  free(tipsify.dead_end_stack);
+  free(tipsify.candidates);
+  free(tipsify.face_order);
+  free(tipsify.ordered_faces);
+}
+
+float vertex_cache_acmr(face_t *faces, int number_of_faces,
+                        int number_of_vertices) {
+  if (number_of_faces == 0)
+    return 0.0;
+
+  // a vertex is in the FIFO while less than VERTEX_CACHE_SIZE misses
+  // happened since it went in
+  int *cache_time = malloc(sizeof(int) * number_of_vertices);
+  if (!cache_time) {
+    fprintf(stderr, "Error: Could not allocate the vertex cache\n");
+    exit(1);
+  }
+  for (int v = 0; v < number_of_vertices; ++v) {
+    cache_time[v] = -VERTEX_CACHE_SIZE - 1;
+  }
+
+  int misses = 0;
+  for (int i = 0; i < number_of_faces; ++i) {
+    int corners[3] = {faces[i].a, faces[i].b, faces[i].c};
+    for (int j = 0; j < 3; ++j) {
+      if (misses - cache_time[corners[j]] >= VERTEX_CACHE_SIZE) {
+        cache_time[corners[j]] = misses;
+        misses++;
+      }
+    }
+  }
+  free(cache_time);
+
+  return (float)misses / number_of_faces;
+}
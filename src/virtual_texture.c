@@ -0,0 +1,258 @@
+#include "virtual_texture.h"
+#include "texture.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+bool virtual_texture_is_needed(texture_t *texture) {
+  return texture->width >= VIRTUAL_TEXTURE_MIN_SIZE ||
+         texture->height >= VIRTUAL_TEXTURE_MIN_SIZE;
+}
+
+// lets the kernel drop the pages of the file that were copied from, they
+// are read again when a page is needed again
+void virtual_texture_drop_mapping(virtual_texture_t *virtual_texture) {
+  if (virtual_texture->mapping)
+    madvise(virtual_texture->mapping, virtual_texture->mapping_size,
+            MADV_DONTNEED);
+}
+
+virtual_texture_t *virtual_texture_create(texture_t *texture) {
+  virtual_texture_t *virtual_texture = calloc(1, sizeof(virtual_texture_t));
+  if (!virtual_texture) {
+    fprintf(stderr, "Error: Could not allocate the virtual texture\n");
+    exit(1);
+  }
+  virtual_texture->format = texture->format;
+  virtual_texture->page_size =
+      texture_get_mip_size(texture->format, VIRTUAL_TEXTURE_PAGE_SIZE,
+                           VIRTUAL_TEXTURE_PAGE_SIZE);
+
+  // the levels larger than a page are paged
+  int number_of_pages = 0;
+  int l = 0;
+  for (; l < texture->number_of_mips; ++l) {
+    texture_mip_t *mip = &texture->mips[l];
+    if (mip->width <= VIRTUAL_TEXTURE_PAGE_SIZE &&
+        mip->height <= VIRTUAL_TEXTURE_PAGE_SIZE)
+      break;
+    virtual_texture_level_t *level = &virtual_texture->levels[l];
+    *level = (virtual_texture_level_t){
+        .width = mip->width,
+        .height = mip->height,
+        .pages_x = (mip->width + VIRTUAL_TEXTURE_PAGE_SIZE - 1) /
+                   VIRTUAL_TEXTURE_PAGE_SIZE,
+        .pages_y = (mip->height + VIRTUAL_TEXTURE_PAGE_SIZE - 1) /
+                   VIRTUAL_TEXTURE_PAGE_SIZE,
+        .first_page = number_of_pages,
+        .source = mip->data};
+    number_of_pages += level->pages_x * level->pages_y;
+  }
+  virtual_texture->number_of_paged_levels = l;
+  virtual_texture->number_of_pages = number_of_pages;
+
+  // the tail is copied once and stays
+  size_t tail_size = 0;
+  for (int m = l; m < texture->number_of_mips; ++m) {
+    tail_size += texture_get_mip_size(texture->format, texture->mips[m].width,
+                                      texture->mips[m].height);
+  }
+  uint8_t *tail_data = malloc(tail_size);
+  virtual_texture->page_table = malloc(sizeof(int) * (number_of_pages + 1));
+  virtual_texture->feedback =
+      calloc(number_of_pages + 1, sizeof(atomic_uchar));
+  virtual_texture->slot_data =
+      malloc(virtual_texture->page_size * VIRTUAL_TEXTURE_SLOTS);
+  if (!tail_data || !virtual_texture->page_table ||
+      !virtual_texture->feedback || !virtual_texture->slot_data) {
+    fprintf(stderr, "Error: Could not allocate the virtual texture\n");
+    exit(1);
+  }
+  for (int m = l; m < texture->number_of_mips; ++m) {
+    texture_mip_t *mip = &texture->mips[m];
+    size_t size = texture_get_mip_size(texture->format, mip->width,
+                                       mip->height);
+    memcpy(tail_data, mip->data, size);
+    virtual_texture->tail[m - l] = (texture_mip_t){
+        .width = mip->width, .height = mip->height, .data = tail_data};
+    tail_data += size;
+  }
+  virtual_texture->number_of_tail_levels = texture->number_of_mips - l;
+
+  for (int p = 0; p < number_of_pages; ++p) {
+    virtual_texture->page_table[p] = -1;
+  }
+  for (int s = 0; s < VIRTUAL_TEXTURE_SLOTS; ++s) {
+    virtual_texture->slots[s].page = -1;
+  }
+  virtual_texture->mapping = texture->mapping;
+  virtual_texture->mapping_size = texture->mapping_size;
+  virtual_texture_drop_mapping(virtual_texture);
+  return virtual_texture;
+}
+
+void virtual_texture_free(virtual_texture_t *virtual_texture) {
+  free(virtual_texture->tail[0].data);
+  free(virtual_texture->page_table);
+  free(virtual_texture->feedback);
+  free(virtual_texture->slot_data);
+  free(virtual_texture);
+}
+
+uint32_t virtual_texture_fetch(virtual_texture_t *virtual_texture, int x, int y,
+                               int level) {
+  for (int l = level; l < virtual_texture->number_of_paged_levels; ++l) {
+    virtual_texture_level_t *paged = &virtual_texture->levels[l];
+    int level_x = x >> l < paged->width ? x >> l : paged->width - 1;
+    int level_y = y >> l < paged->height ? y >> l : paged->height - 1;
+    int page = paged->first_page + level_x / VIRTUAL_TEXTURE_PAGE_SIZE +
+               paged->pages_x * (level_y / VIRTUAL_TEXTURE_PAGE_SIZE);
+
+    // only the level that was asked for is requested, the read before the
+    // write keeps the threads from fighting over the cache line
+    atomic_uchar *feedback = &virtual_texture->feedback[page];
+    if (l == level && !atomic_load_explicit(feedback, memory_order_relaxed))
+      atomic_store_explicit(feedback, 1, memory_order_relaxed);
+
+    int slot = virtual_texture->page_table[page];
+    if (slot >= 0)
+      return texture_fetch_texel(
+          virtual_texture->format,
+          virtual_texture->slot_data + slot * virtual_texture->page_size,
+          VIRTUAL_TEXTURE_PAGE_SIZE, level_x % VIRTUAL_TEXTURE_PAGE_SIZE,
+          level_y % VIRTUAL_TEXTURE_PAGE_SIZE);
+  }
+
+  // nothing finer is resident, the tail always is
+  int tail_level = level - virtual_texture->number_of_paged_levels;
+  tail_level = tail_level > 0 ? tail_level : 0;
+  texture_mip_t *mip = &virtual_texture->tail[tail_level];
+  int shift = virtual_texture->number_of_paged_levels + tail_level;
+  int mip_x = x >> shift < mip->width ? x >> shift : mip->width - 1;
+  int mip_y = y >> shift < mip->height ? y >> shift : mip->height - 1;
+  return texture_fetch_texel(virtual_texture->format, mip->data, mip->width,
+                             mip_x, mip_y);
+}
+
+/////////////////////////////////////////////////////
+////////////////////// UPDATE ///////////////////////
+/////////////////////////////////////////////////////
+
+// a free slot or the one used the longest ago, -1 when every slot was
+// sampled during the last frame
+int virtual_texture_find_slot(virtual_texture_t *virtual_texture) {
+  int oldest = -1;
+  for (int s = 0; s < VIRTUAL_TEXTURE_SLOTS; ++s) {
+    virtual_texture_slot_t *slot = &virtual_texture->slots[s];
+    if (slot->page == -1)
+      return s;
+    if (slot->last_used != virtual_texture->frame &&
+        (oldest == -1 ||
+         slot->last_used < virtual_texture->slots[oldest].last_used))
+      oldest = s;
+  }
+  return oldest;
+}
+
+// copies page `page` of level `l` into the slot
+void virtual_texture_load_page(virtual_texture_t *virtual_texture, int l,
+                               int page, uint8_t *destination) {
+  virtual_texture_level_t *level = &virtual_texture->levels[l];
+  // a page is rows of texels, or rows of 4x4 blocks for the BC formats
+  int unit = virtual_texture->format == TEXTURE_FORMAT_RGBA8 ? 1 : 4;
+  int page_units = VIRTUAL_TEXTURE_PAGE_SIZE / unit;
+  size_t unit_size = virtual_texture->page_size / (page_units * page_units);
+  int level_units_x = (level->width + unit - 1) / unit;
+  int level_units_y = (level->height + unit - 1) / unit;
+
+  int first_x = (page % level->pages_x) * page_units;
+  int first_y = (page / level->pages_x) * page_units;
+  int units_x = level_units_x - first_x < page_units ? level_units_x - first_x
+                                                     : page_units;
+  int units_y = level_units_y - first_y < page_units ? level_units_y - first_y
+                                                     : page_units;
+  for (int row = 0; row < units_y; ++row) {
+    memcpy(destination + row * page_units * unit_size,
+           level->source +
+               ((size_t)(first_y + row) * level_units_x + first_x) * unit_size,
+           units_x * unit_size);
+  }
+}
+
+void virtual_texture_update(virtual_texture_t *virtual_texture) {
+  virtual_texture->frame++;
+
+  // the resident pages that were sampled are kept before any is replaced
+  bool has_missing_pages = false;
+  for (int p = 0; p < virtual_texture->number_of_pages; ++p) {
+    if (!atomic_load_explicit(&virtual_texture->feedback[p],
+                              memory_order_relaxed))
+      continue;
+    int slot = virtual_texture->page_table[p];
+    if (slot >= 0) {
+      virtual_texture->slots[slot].last_used = virtual_texture->frame;
+      atomic_store_explicit(&virtual_texture->feedback[p], 0,
+                            memory_order_relaxed);
+    } else {
+      has_missing_pages = true;
+    }
+  }
+  if (!has_missing_pages)
+    return;
+
+  // coarse levels first, they are what the finer pages fall back to
+  int uploads = 0;
+  for (int l = virtual_texture->number_of_paged_levels - 1; l >= 0; --l) {
+    virtual_texture_level_t *level = &virtual_texture->levels[l];
+    for (int p = 0; p < level->pages_x * level->pages_y; ++p) {
+      int page = level->first_page + p;
+      if (!atomic_load_explicit(&virtual_texture->feedback[page],
+                                memory_order_relaxed))
+        continue;
+      atomic_store_explicit(&virtual_texture->feedback[page], 0,
+                            memory_order_relaxed);
+      int slot = uploads < VIRTUAL_TEXTURE_MAX_UPLOADS
+                     ? virtual_texture_find_slot(virtual_texture)
+                     : -1;
+      // it is asked for again the next frame
+      if (slot == -1)
+        continue;
+
+      virtual_texture_slot_t *evicted = &virtual_texture->slots[slot];
+      if (evicted->page != -1)
+        virtual_texture->page_table[evicted->page] = -1;
+      else
+        virtual_texture->number_of_resident_pages++;
+      virtual_texture_load_page(virtual_texture, l, p,
+                                virtual_texture->slot_data +
+                                    slot * virtual_texture->page_size);
+      *evicted = (virtual_texture_slot_t){.page = page,
+                                          .last_used = virtual_texture->frame};
+      virtual_texture->page_table[page] = slot;
+      uploads++;
+    }
+  }
+
+  if (uploads > 0) {
+    // the slots that got new pages may still be decoded on the threads
+    texture_invalidate_block_cache();
+    virtual_texture_drop_mapping(virtual_texture);
+  }
+}
+
+size_t virtual_texture_get_size(virtual_texture_t *virtual_texture) {
+  size_t bytes = virtual_texture->page_size *
+                 virtual_texture->number_of_resident_pages;
+  for (int m = 0; m < virtual_texture->number_of_tail_levels; ++m) {
+    bytes += texture_get_mip_size(virtual_texture->format,
+                                  virtual_texture->tail[m].width,
+                                  virtual_texture->tail[m].height);
+  }
+  bytes += (sizeof(int) + sizeof(atomic_uchar)) *
+           virtual_texture->number_of_pages;
+  return bytes;
+}